@@ -0,0 +1,249 @@
+/* --- File elect_energy.h --- */
+/* Coulomb energy engine shared by all kernels (scalar, omp simd, AVX2, AVX-512) */
+#ifndef ELECT_ENERGY_H
+#define ELECT_ENERGY_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* Arrays are padded to the widest SIMD width (16 floats, AVX-512) and aligned to 64 bytes */
+#define CHARGES_PAD 16
+#define CHARGES_ALIGN 64
+
+/* Structure of arrays holding positions and charges */
+typedef struct
+{
+	long n;			  /* number of charges */
+	long n_pad;		  /* padded length, multiple of CHARGES_PAD */
+	float *x, *y, *z; /* coordinates */
+	float *q;		  /* charges */
+	void *map;		  /* file mapping holding the arrays, NULL if they are allocated */
+	size_t map_bytes; /* length of the mapping */
+} charges;
+
+/* Instruction set used by the pair kernels */
+enum energy_isa
+{
+	ISA_AUTO = 0, /* pick the fastest kernel supported by this CPU */
+	ISA_SCALAR,
+	ISA_OMP_SIMD,
+	ISA_AVX2,
+	ISA_AVX512
+};
+
+/* Treatment of the potential at the cutoff radius */
+enum energy_cut_mode
+{
+	CUT_TRUNCATE = 0, /* plain 1/r, discontinuous at the cutoff */
+	CUT_SHIFT,		  /* 1/r - 1/rc, the energy goes to zero at the cutoff */
+	CUT_SWITCH		  /* 1/r smoothly switched off between r_switch and rc */
+};
+
+/* Accuracy of distance^-1 in the AVX kernels */
+enum energy_precision
+{
+	PREC_RAW = 0, /* hardware estimate only, 12 (AVX2) or 14 (AVX-512) bits */
+	PREC_NR1,	  /* one Newton-Raphson step */
+	PREC_NR2,	  /* two Newton-Raphson steps */
+	PREC_EXACT	  /* sqrt and division, correctly rounded */
+};
+
+/* Distribution of the i blocks of the AVX kernels over the threads */
+enum energy_schedule
+{
+	SCHED_DYNAMIC = 0, /* schedule(dynamic), one block at a time */
+	SCHED_BALANCED	   /* one contiguous range of rows per thread, all with the same number of pairs */
+};
+
+typedef struct
+{
+	int isa;		/* one of enum energy_isa */
+	int precision;	/* one of enum energy_precision */
+	float cutoff;	/* cutoff radius, 0 means all pairs */
+	int cut_mode;	/* one of enum energy_cut_mode */
+	float r_switch; /* start of the switching region for CUT_SWITCH */
+	/* Smooth particle mesh Ewald for periodic systems */
+	int spme;		  /* nonzero: periodic SPME, cutoff is the real-space cutoff */
+	float box[3];	  /* periodic box lengths */
+	float ewald_beta; /* splitting parameter, 0 means chosen from ewald_tol */
+	float ewald_tol;  /* erfc(beta*cutoff) */
+	int grid[3];	  /* SPME grid, powers of two, 0 means chosen from beta */
+	int spme_order;	  /* B-spline interpolation order */
+	/* Cache tiling of the AVX all-pairs kernels, in SIMD vectors, 0 means automatic */
+	long tile_i; /* i vectors applied to a j tile while it is in cache */
+	long tile_j; /* j vectors per tile */
+	int schedule; /* one of enum energy_schedule */
+} energy_opts;
+
+/* Components of the energy and the time spent on them in seconds */
+typedef struct
+{
+	double real, recip, self, total;
+	double t_real, t_recip;
+	float beta;	 /* splitting parameter used */
+	int grid[3]; /* grid used */
+	/* Time each thread spent in the loops of the all-pairs AVX kernels */
+	int threads;
+	double t_thread_min, t_thread_mean, t_thread_max;
+} energy_parts;
+
+/* Charges binned into cubic cells of at least the cutoff size. The sorted copies of the
+   coordinates and charges make every cell a contiguous range [start[c], start[c+1]) */
+typedef struct
+{
+	int nc[3];		  /* number of cells in each dimension */
+	float lo[3];	  /* lower corner of the grid */
+	float size[3];	  /* cell size in each dimension */
+	long n;			  /* number of charges */
+	long *start;	  /* first charge of every cell, nc[0]*nc[1]*nc[2]+1 entries */
+	float *x, *y, *z; /* coordinates sorted by cell */
+	float *q;		  /* charges sorted by cell */
+	long *cell, *fill; /* scratch of the bucket sort */
+	long max_n, max_cells; /* lengths allocated, a rebuild reallocates only beyond them */
+} cell_list;
+
+/* Buffers of the cutoff and SPME energies. Kept from one frame of a trajectory to the
+   next, only the first frame allocates them; without a workspace every call does */
+typedef struct
+{
+	cell_list *cells;		 /* rebuilt in place for every frame */
+	double *grid;			 /* SPME charge grid, complex */
+	long grid_points;		 /* points allocated */
+	double *bsp_mod[3];		 /* B-spline moduli of the grid below */
+	int grid_size[3], order; /* grid and order of the moduli, 0 before the first frame */
+	double *lines;			 /* FFT line of every thread */
+	int line_threads, line_length;
+} energy_workspace;
+
+/* Forces of the all-pairs kernels, see elect_energy_forces.c */
+typedef struct
+{
+	long n_pad;			 /* length of the force arrays */
+	int threads;		 /* number of per-thread buffers */
+	float *buf;			 /* per-thread SoA buffers, 3*n_pad floats each */
+	float *fx, *fy, *fz; /* total force on every charge, in the buffer of thread 0 */
+	double virial[6];	 /* sum of r (x) F: xx, yy, zz, xy, xz, yz */
+} energy_forces;
+
+/* Trajectory: frames of the same charges, mapped from a binary file. The coordinates
+   are copied into two buffers, a loader thread fills one with the next frame while the
+   current one, in the other, is computed */
+typedef struct
+{
+	long frames;	  /* number of frames */
+	float box[3];	  /* periodic box, zero if there is none */
+	charges frame;	  /* current frame, q points into the mapping, x, y, z into a buffer */
+	void *map;		  /* the mapped file */
+	size_t map_bytes; /* length of the mapping */
+	float *buf[2];	  /* x, y and z of a frame, n_pad each */
+	long loaded[2];	  /* frame in each buffer, -1 for none */
+	long next;		  /* frame the loader thread copies */
+	int next_buf;	  /* into this buffer */
+	int loading;	  /* the loader thread is running */
+	pthread_t loader;
+} trajectory;
+
+void energy_opts_default(energy_opts *opts);
+
+/* Charge container */
+charges *charges_alloc(long n);
+void charges_free(charges *c);
+void charges_pad(charges *c);
+charges *charges_lattice(int n, float a, unsigned int seed);
+void charges_first_touch(charges *c, const energy_opts *opts);
+
+/* Charge set files (elect_energy_io.c). charges_read maps the binary format, or reads an
+   XYZ text file. box receives the periodic box, zero if there is none, and may be NULL.
+   Errors are reported on stderr and return NULL or -1 */
+charges *charges_read(const char *path, float *box);
+charges *charges_map(const char *path, float *box);
+charges *charges_read_xyz(const char *path, float *box);
+int charges_write(const charges *c, const char *path, const float *box);
+
+trajectory *trajectory_open(const char *path);
+/* Frame k, valid until the next call. The next frame is read ahead while k is computed */
+const charges *trajectory_frame(trajectory *t, long k);
+void trajectory_close(trajectory *t);
+/* Multi-frame XYZ file to a binary trajectory, returns the number of frames or -1 */
+int trajectory_convert_xyz(const char *xyz, const char *path);
+
+/* CPU detection */
+int energy_isa_supported(int isa);
+int energy_select_isa(int isa);
+int energy_isa_from_name(const char *name);
+const char *energy_isa_name(int isa);
+int energy_cut_mode_from_name(const char *name);
+const char *energy_cut_mode_name(int mode);
+int energy_precision_from_name(const char *name);
+const char *energy_precision_name(int precision);
+int energy_schedule_from_name(const char *name);
+const char *energy_schedule_name(int schedule);
+
+/* Sum of all pairwise interactions q[i]*q[j]/dist[i,j], of the pairs within the
+   cutoff if opts->cutoff is set, or the periodic SPME energy if opts->spme is set */
+double coulomb_energy(const charges *c, const energy_opts *opts);
+/* The same, parts receives the thread times of the AVX kernels or the components of the
+   SPME energy, and may be NULL */
+double coulomb_energy_parts(const charges *c, const energy_opts *opts, energy_parts *parts);
+/* The same with the buffers of w, for many frames of the same charges; w may be NULL */
+double coulomb_energy_work(const charges *c, const energy_opts *opts, energy_workspace *w, energy_parts *parts);
+energy_workspace *energy_workspace_create(void);
+void energy_workspace_free(energy_workspace *w);
+
+/* Cell list / cutoff neighbour search. With a box the charges are wrapped into it.
+   cell_list_rebuild bins the charges into cl again, keeping its arrays, or into a new
+   list if cl is NULL */
+cell_list *cell_list_build(const charges *c, float cutoff, const float *box);
+cell_list *cell_list_rebuild(cell_list *cl, const charges *c, float cutoff, const float *box);
+void cell_list_free(cell_list *cl);
+double coulomb_energy_cutoff(const charges *c, const energy_opts *opts);
+double coulomb_energy_cutoff_work(const charges *c, const energy_opts *opts, energy_workspace *w);
+
+/* Periodic energy with smooth particle mesh Ewald, parts may be NULL. NaN without a
+   periodic box or with a cutoff above half the box */
+double coulomb_energy_spme(const charges *c, const energy_opts *opts, energy_parts *parts);
+double coulomb_energy_spme_work(const charges *c, const energy_opts *opts, energy_workspace *w, energy_parts *parts);
+
+/* Real-space Ewald interaction erfc(beta*r)/r of charge (xi,yi,zi) with charges j0..j1-1
+   of a periodic cell list, without the factor q[i]. Pairs at r=0 or beyond the cutoff
+   are skipped. One version per instruction set, like the all-pairs kernels */
+float ewald_real_range_simd(const cell_list *cl, long j0, long j1, float xi, float yi, float zi,
+							const float *box, float rc2, float beta);
+float ewald_real_range_avx2(const cell_list *cl, long j0, long j1, float xi, float yi, float zi,
+							const float *box, float rc2, float beta);
+float ewald_real_range_avx512(const cell_list *cl, long j0, long j1, float xi, float yi, float zi,
+							  const float *box, float rc2, float beta);
+
+/* Tile sizes of an all-pairs kernel with v_count vectors of width floats. Unset sizes
+   are chosen so that a j tile fills half of L2 and every thread gets several i blocks */
+void energy_tile_sizes(const energy_opts *opts, int width, long v_count, long *tile_i, long *tile_j);
+/* Rows [*i_first, *i_end) of part 'part' of 'parts' equal-work parts of the triangle
+   of v_count rows */
+void energy_partition(long v_count, int parts, int part, long *i_first, long *i_end);
+/* Thread times in energy_parts: reset, and add the time of one thread */
+void energy_parts_clear_threads(energy_parts *parts);
+void energy_parts_add_thread(energy_parts *parts, double t);
+
+/* Energy of all pairs and the forces and virial in f. The buffers of f are allocated once
+   for n_pad charges and omp_get_max_threads() threads and can be reused. The scalar kernel
+   stands in for the omp simd one */
+double coulomb_energy_forces(const charges *c, const energy_opts *opts, energy_forces *f);
+energy_forces *energy_forces_alloc(long n_pad);
+void energy_forces_free(energy_forces *f);
+/* Used by the kernels: the cleared buffer of thread t, and the reduction of the buffers of
+   the 'used' threads that ran, followed by the virial */
+float *energy_forces_thread(energy_forces *f, int t);
+void energy_forces_reduce(energy_forces *f, const charges *c, int used);
+/* Largest error of the forces on 'samples' charges against finite differences with step h,
+   relative to the largest force component of each charge */
+double energy_forces_check(const charges *c, const energy_forces *f, int samples, double h);
+
+/* Individual kernels. The AVX kernels must only be called if the CPU supports them,
+   they compute distance^-1 with opts->precision. With forces, f may be NULL */
+double coulomb_energy_scalar(const charges *c);
+double coulomb_energy_omp_simd(const charges *c);
+double coulomb_energy_forces_scalar(const charges *c, energy_forces *f);
+double coulomb_energy_avx2(const charges *c, const energy_opts *opts, energy_parts *parts, energy_forces *f);
+double coulomb_energy_avx512(const charges *c, const energy_opts *opts, energy_parts *parts, energy_forces *f);
+
+#endif
@@ -0,0 +1,234 @@
+/* --- File elect_energy_cells.c --- */
+/* Cutoff energy with a cell list: charges are bucket sorted by their 3D cell index and
+   only pairs in neighbouring cells are evaluated, so the cost grows linearly with N */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "elect_energy.h"
+
+#define MAX_CELLS_PER_SIDE 1024
+
+/* Coordinate v wrapped into the periodic box in dimension d */
+static inline float wrap(float v, const float *box, int d)
+{
+	return box ? v - box[d] * floorf(v / box[d]) : v;
+}
+
+cell_list *cell_list_build(const charges *c, float cutoff, const float *box)
+{
+	return cell_list_rebuild(NULL, c, cutoff, box);
+}
+
+cell_list *cell_list_rebuild(cell_list *cl, const charges *c, float cutoff, const float *box)
+{
+	float hi[3], *pos[3] = {c->x, c->y, c->z};
+	long i, n = c->n, n_cells, *cell, *fill;
+	int d;
+
+	if (!cl)
+		cl = calloc(1, sizeof(cell_list));
+
+	for (d = 0; d < 3; d++)
+	{
+		if (box)
+		{
+			/* Periodic cells tile the box exactly */
+			cl->lo[d] = 0.0f;
+			cl->nc[d] = (int)(box[d] / cutoff);
+			if (cl->nc[d] < 1)
+				cl->nc[d] = 1;
+			if (cl->nc[d] > MAX_CELLS_PER_SIDE)
+				cl->nc[d] = MAX_CELLS_PER_SIDE;
+			cl->size[d] = box[d] / cl->nc[d];
+			continue;
+		}
+		/* Bounding box of the charges */
+		cl->lo[d] = hi[d] = n > 0 ? pos[d][0] : 0.0f;
+		for (i = 1; i < n; i++)
+		{
+			cl->lo[d] = fminf(cl->lo[d], pos[d][i]);
+			hi[d] = fmaxf(hi[d], pos[d][i]);
+		}
+		/* Cells are at least as large as the cutoff so that only neighbours can interact */
+		cl->nc[d] = (int)((hi[d] - cl->lo[d]) / cutoff);
+		if (cl->nc[d] < 1)
+			cl->nc[d] = 1;
+		if (cl->nc[d] > MAX_CELLS_PER_SIDE)
+			cl->nc[d] = MAX_CELLS_PER_SIDE;
+		/* Enlarge slightly so that the charges at the upper edge fall into the last cell */
+		cl->size[d] = fmaxf((hi[d] - cl->lo[d]) / cl->nc[d], cutoff) * 1.0001f;
+	}
+	n_cells = (long)cl->nc[0] * cl->nc[1] * cl->nc[2];
+
+	cl->n = n;
+	if (n > cl->max_n)
+	{
+		free(cl->x);
+		free(cl->y);
+		free(cl->z);
+		free(cl->q);
+		free(cl->cell);
+		cl->x = malloc(n * sizeof(float));
+		cl->y = malloc(n * sizeof(float));
+		cl->z = malloc(n * sizeof(float));
+		cl->q = malloc(n * sizeof(float));
+		cl->cell = malloc(n * sizeof(long));
+		cl->max_n = n;
+	}
+	if (n_cells > cl->max_cells)
+	{
+		free(cl->start);
+		free(cl->fill);
+		cl->start = malloc((n_cells + 1) * sizeof(long));
+		cl->fill = malloc(n_cells * sizeof(long));
+		cl->max_cells = n_cells;
+	}
+	memset(cl->start, 0, (n_cells + 1) * sizeof(long));
+	cell = cl->cell;
+	fill = cl->fill;
+
+	/* Count the charges in every cell */
+	for (i = 0; i < n; i++)
+	{
+		int ix = (int)((wrap(c->x[i], box, 0) - cl->lo[0]) / cl->size[0]);
+		int iy = (int)((wrap(c->y[i], box, 1) - cl->lo[1]) / cl->size[1]);
+		int iz = (int)((wrap(c->z[i], box, 2) - cl->lo[2]) / cl->size[2]);
+		ix = ix < cl->nc[0] ? ix : cl->nc[0] - 1;
+		iy = iy < cl->nc[1] ? iy : cl->nc[1] - 1;
+		iz = iz < cl->nc[2] ? iz : cl->nc[2] - 1;
+		cell[i] = ((long)ix * cl->nc[1] + iy) * cl->nc[2] + iz;
+		cl->start[cell[i] + 1]++;
+	}
+	/* Prefix sum gives the first charge of every cell */
+	for (i = 0; i < n_cells; i++)
+	{
+		cl->start[i + 1] += cl->start[i];
+		fill[i] = cl->start[i];
+	}
+	/* Scatter the charges into their cells */
+	for (i = 0; i < n; i++)
+	{
+		long k = fill[cell[i]]++;
+		cl->x[k] = wrap(c->x[i], box, 0);
+		cl->y[k] = wrap(c->y[i], box, 1);
+		cl->z[k] = wrap(c->z[i], box, 2);
+		cl->q[k] = c->q[i];
+	}
+	return cl;
+}
+
+void cell_list_free(cell_list *cl)
+{
+	if (!cl)
+		return;
+	free(cl->start);
+	free(cl->x);
+	free(cl->y);
+	free(cl->z);
+	free(cl->q);
+	free(cl->cell);
+	free(cl->fill);
+	free(cl);
+}
+
+/* Parameters of the cut off potential */
+typedef struct
+{
+	float rc2;	 /* cutoff^2 */
+	float shift; /* 1/rc for CUT_SHIFT, otherwise 0 */
+	int do_switch;
+	float rs2;	 /* r_switch^2 */
+	float sw_norm; /* 1/(rc^2 - rs^2)^3 */
+} cut_params;
+
+/* Interaction of charge (xi,yi,zi) with charges j0..j1-1, without the factor q[i] */
+static inline float pair_range(const cell_list *cl, const cut_params *p,
+							   float xi, float yi, float zi, long j0, long j1)
+{
+	const float *x = cl->x, *y = cl->y, *z = cl->z, *q = cl->q;
+	float rc2 = p->rc2, shift = p->shift, rs2 = p->rs2, sw_norm = p->sw_norm;
+	float e = 0.0f;
+	long j;
+
+	if (p->do_switch)
+	{
+#pragma omp simd reduction(+ : e)
+		for (j = j0; j < j1; j++)
+		{
+			float dx = xi - x[j], dy = yi - y[j], dz = zi - z[j];
+			float r2 = dx * dx + dy * dy + dz * dz;
+			float d = rc2 - r2;
+			/* CHARMM switching function, 1 below r_switch and 0 at the cutoff */
+			float s = r2 > rs2 ? d * d * (rc2 + 2 * r2 - 3 * rs2) * sw_norm : 1.0f;
+			e += r2 < rc2 ? q[j] * s / sqrtf(r2) : 0.0f;
+		}
+	}
+	else
+	{
+#pragma omp simd reduction(+ : e)
+		for (j = j0; j < j1; j++)
+		{
+			float dx = xi - x[j], dy = yi - y[j], dz = zi - z[j];
+			float r2 = dx * dx + dy * dy + dz * dz;
+			e += r2 < rc2 ? q[j] * (1.0f / sqrtf(r2) - shift) : 0.0f;
+		}
+	}
+	return e;
+}
+
+/* Sum of q[i]*q[j]*V(dist[i,j]) over all pairs closer than opts->cutoff */
+double coulomb_energy_cutoff(const charges *c, const energy_opts *opts)
+{
+	return coulomb_energy_cutoff_work(c, opts, NULL);
+}
+
+double coulomb_energy_cutoff_work(const charges *c, const energy_opts *opts, energy_workspace *w)
+{
+	cell_list *cl = cell_list_rebuild(w ? w->cells : NULL, c, opts->cutoff, NULL);
+	float rc = opts->cutoff, rs = opts->r_switch;
+	cut_params p;
+	long n_cells = (long)cl->nc[0] * cl->nc[1] * cl->nc[2], ic;
+	double Energy = 0.0;
+
+	p.rc2 = rc * rc;
+	p.shift = opts->cut_mode == CUT_SHIFT ? 1.0f / rc : 0.0f;
+	p.do_switch = opts->cut_mode == CUT_SWITCH && rs < rc;
+	p.rs2 = rs * rs;
+	p.sw_norm = p.do_switch ? 1.0f / ((p.rc2 - p.rs2) * (p.rc2 - p.rs2) * (p.rc2 - p.rs2)) : 0.0f;
+
+#pragma omp parallel for reduction(+ : Energy) schedule(dynamic)
+	for (ic = 0; ic < n_cells; ic++)
+	{
+		int ix = ic / ((long)cl->nc[1] * cl->nc[2]);
+		int iy = (ic / cl->nc[2]) % cl->nc[1];
+		int iz = ic % cl->nc[2];
+		int dx, dy, dz;
+		long i;
+
+		for (i = cl->start[ic]; i < cl->start[ic + 1]; i++)
+		{
+			float xi = cl->x[i], yi = cl->y[i], zi = cl->z[i];
+			/* Pairs inside the own cell */
+			float e = pair_range(cl, &p, xi, yi, zi, i + 1, cl->start[ic + 1]);
+			/* Half of the 26 neighbours, every pair of cells is visited once */
+			for (dx = 0; dx <= 1; dx++)
+				for (dy = dx ? -1 : 0; dy <= 1; dy++)
+					for (dz = (dx || dy) ? -1 : 1; dz <= 1; dz++)
+					{
+						int jx = ix + dx, jy = iy + dy, jz = iz + dz;
+						long jc;
+						if (jx >= cl->nc[0] || jy < 0 || jy >= cl->nc[1] || jz < 0 || jz >= cl->nc[2])
+							continue;
+						jc = ((long)jx * cl->nc[1] + jy) * cl->nc[2] + jz;
+						e += pair_range(cl, &p, xi, yi, zi, cl->start[jc], cl->start[jc + 1]);
+					}
+			Energy += cl->q[i] * e;
+		}
+	}
+	if (w)
+		w->cells = cl;
+	else
+		cell_list_free(cl);
+	return Energy;
+}
@@ -0,0 +1,349 @@
+/* --- File elect_energy_dispatch.c --- */
+/* Driver for the Coulomb energy engine. The kernel is selected at run time from the
+   instructions supported by the CPU, so one binary runs on every node.
+
+   gcc -O3 -fopenmp -o elect_energy elect_energy_dispatch.c elect_energy_lib.c \
+       elect_energy_kernels_avx2.c elect_energy_kernels_avx512.c \
+       elect_energy_cells.c elect_energy_ewald.c elect_energy_io.c \
+       elect_energy_forces.c -lm -lpthread
+
+   Do not add -march=native, the AVX kernels enable their instructions themselves.
+   Usage: elect_energy [-n atoms_per_side] [-a lattice_constant] [-k auto|scalar|simd|avx2|avx512]
+                       [-p raw|nr1|nr2|exact] [-c cutoff] [-m truncate|shift|switch] [-s r_switch]
+                       [-e] [-g grid] [-r repeats] [-b tile_i] [-t tile_j]
+                       [-d dynamic|balanced] [-f] [-i input] [-o output]
+                       [-j trajectory] [-F]
+   The kernel can also be set with the ENERGY_ISA environment variable.
+   -p sets the accuracy of distance^-1 in the AVX kernels. Relative error of the energy
+   against a double precision sum, and time, for -n 40 (64000 charges, 1 thread):
+                 AVX-512                AVX2
+       raw       3.8e-4    404 ms       1.7e-3    683 ms
+       nr1       2.8e-7    626 ms       1.9e-6    895 ms
+       nr2       2.8e-6    907 ms       3.0e-7   1227 ms
+       exact     1.4e-6   1254 ms       1.7e-6   1258 ms
+   The random charges cancel, the energy is 1e-6 of the sum of |q[i]*q[j]/r|, so beyond
+   one Newton-Raphson step the error of about 1e-6 comes from the float pair terms, not
+   from distance^-1. Only raw misses a 1e-6 budget.
+   nr1 is the default.
+   -r repeats the computation and reports the fastest run, for all pairs also in GFLOP/s.
+   -b and -t set the cache tiles of the AVX kernels in vectors: blocks of tile_i rows are
+   applied to tiles of tile_j columns. By default a tile fills half of L2.
+   -d balanced gives every thread one contiguous range of i blocks with the same number
+   of pairs instead of handing out blocks dynamically. -f also moves every thread's range
+   of the arrays to its NUMA node. The busy time of the threads is reported per run.
+   -i reads the charges from a file instead of building the n x n x n lattice: a binary
+   charge set, which is mapped and used in place, or an XYZ text file. -o writes the
+   charges as a binary charge set and exits, e.g. to convert an XYZ file once.
+   -j evaluates every frame of a binary trajectory and reports frames per second. The
+   charges stay in the mapped file; a loader thread copies the coordinates of the next
+   frame into a second buffer while the current one is computed. The cell list and the
+   SPME grids are allocated for the first frame and reused, and the OpenMP threads stay
+   alive between frames. -j with -o converts a multi-frame XYZ file into a binary
+   trajectory.
+   -F also computes the force on every charge and the virial tensor with the all-pairs
+   kernels, and checks the forces on a few charges against central differences of the
+   energy.
+   elect_energy_sweep.sh measures GFLOP/s over system sizes and thread counts.
+   With a cutoff only pairs in neighbouring cells of a cell list are evaluated.
+   With -e the lattice is periodic and the energy is computed with smooth particle mesh
+   Ewald, -c is then the real-space cutoff (default 6 lattice constants). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include "elect_energy.h"
+
+/* Floating point operations per pair in the all-pairs kernels: 3 sub, 5 for r^2,
+   4 for rsqrt and 5 for a Newton-Raphson step, 1 mul and 1 FMA for q[i]*q[j]/r */
+#define FLOPS_PER_PAIR 20
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n atoms_per_side] [-a lattice_constant] [-k auto|scalar|simd|avx2|avx512]\n"
+					"       [-p raw|nr1|nr2|exact] [-c cutoff] [-m truncate|shift|switch] [-s r_switch]\n"
+					"       [-e] [-g grid] [-r repeats] [-b tile_i] [-t tile_j]\n"
+					"       [-d dynamic|balanced] [-f] [-i input] [-o output]\n"
+					"       [-j trajectory] [-F]\n",
+			prog);
+	exit(1);
+}
+
+/* Energy of every frame of a trajectory, or with output the conversion of an XYZ file */
+static int run_trajectory(const char *path, const char *output, energy_opts *opts, float a)
+{
+	struct timespec ts_start, ts_end;
+	energy_workspace *w;
+	trajectory *t;
+	long k;
+	int frames;
+	double Energy, time_total;
+
+	if (output)
+	{
+		frames = trajectory_convert_xyz(path, output);
+		if (frames < 0)
+			return 1;
+		printf("%d frames written to %s\n", frames, output);
+		return 0;
+	}
+	t = trajectory_open(path);
+	if (!t)
+		return 1;
+	if (opts->spme)
+	{
+		if (t->box[0] <= 0 || t->box[1] <= 0 || t->box[2] <= 0)
+		{
+			fprintf(stderr, "%s has no periodic box\n", path);
+			trajectory_close(t);
+			return 1;
+		}
+		opts->box[0] = t->box[0];
+		opts->box[1] = t->box[1];
+		opts->box[2] = t->box[2];
+		if (opts->cutoff == 0)
+			opts->cutoff = fminf(6 * a, 0.5f * fminf(t->box[0], fminf(t->box[1], t->box[2])));
+	}
+	printf("%li charges, %li frames, %s\n", t->frame.n, t->frames,
+		   opts->spme ? "SPME" : opts->cutoff > 0 ? "cutoff" : energy_isa_name(opts->isa));
+
+	w = energy_workspace_create();
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	for (k = 0; k < t->frames; k++)
+	{
+		Energy = coulomb_energy_work(trajectory_frame(t, k), opts, w, NULL);
+		if (isnan(Energy))
+		{
+			fprintf(stderr, "SPME needs a cutoff of at most half the box\n");
+			energy_workspace_free(w);
+			trajectory_close(t);
+			return 1;
+		}
+		printf("%8li %14.6f\n", k, Energy * 1e-4);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	time_total = (ts_end.tv_sec - ts_start.tv_sec) + (ts_end.tv_nsec - ts_start.tv_nsec) * 1e-9;
+	printf("\n%li frames in %f s, %.2f frames/s\n", t->frames, time_total, t->frames / time_total);
+	energy_workspace_free(w);
+	trajectory_close(t);
+	return 0;
+}
+
+/* Forces and virial, checked against finite differences of the energy */
+static int run_forces(const charges *c, const energy_opts *opts, int repeats)
+{
+	struct timespec ts_start, ts_end;
+	float time_total, time_best = 0;
+	energy_forces *f = energy_forces_alloc(c->n_pad);
+	double Energy;
+	int r;
+
+	printf("%li charges, kernel %s, precision %s, forces\n", c->n, energy_isa_name(opts->isa),
+		   energy_precision_name(opts->precision));
+	for (r = 0; r < repeats; r++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		Energy = coulomb_energy_forces(c, opts, f);
+		clock_gettime(CLOCK_MONOTONIC, &ts_end);
+		time_total = (ts_end.tv_sec - ts_start.tv_sec) * 1e9 + (ts_end.tv_nsec - ts_start.tv_nsec);
+		if (r == 0 || time_total < time_best)
+			time_best = time_total;
+	}
+	printf("\nTotal time is %f ms, Energy is %.3f\n", time_best / 1e6, Energy * 1e-4);
+	printf("Virial xx %.6e yy %.6e zz %.6e xy %.6e xz %.6e yz %.6e\n", f->virial[0] * 1e-4, f->virial[1] * 1e-4,
+		   f->virial[2] * 1e-4, f->virial[3] * 1e-4, f->virial[4] * 1e-4, f->virial[5] * 1e-4);
+	printf("Force on charge 0 %.6e %.6e %.6e\n", f->fx[0] * 1e-4, f->fy[0] * 1e-4, f->fz[0] * 1e-4);
+	printf("Largest relative error against finite differences %.2e\n", energy_forces_check(c, f, 10, 1e-4));
+	energy_forces_free(f);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec ts_start, ts_end;
+	float time_total, time_best = 0;
+	int n = 60;	   /* number of atoms per side */
+	float a = 0.5; /* lattice constant a (a=b=c) */
+	energy_opts opts;
+	energy_parts parts, best;
+	double Energy;
+	charges *c;
+	int opt, repeats = 1, r, width, first_touch = 0, forces = 0;
+	const char *input = NULL, *output = NULL, *traj = NULL;
+	float box[3];
+	long tile_i, tile_j;
+
+	energy_opts_default(&opts);
+	opts.r_switch = -1.0f;
+	if (getenv("ENERGY_ISA"))
+		opts.isa = energy_isa_from_name(getenv("ENERGY_ISA"));
+	while ((opt = getopt(argc, argv, "n:a:k:p:c:m:s:eg:r:b:t:d:fi:o:j:F")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'a':
+			a = atof(optarg);
+			break;
+		case 'k':
+			opts.isa = energy_isa_from_name(optarg);
+			break;
+		case 'p':
+			opts.precision = energy_precision_from_name(optarg);
+			break;
+		case 'c':
+			opts.cutoff = atof(optarg);
+			break;
+		case 'm':
+			opts.cut_mode = energy_cut_mode_from_name(optarg);
+			break;
+		case 's':
+			opts.r_switch = atof(optarg);
+			break;
+		case 'e':
+			opts.spme = 1;
+			break;
+		case 'g':
+			opts.grid[0] = opts.grid[1] = opts.grid[2] = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		case 'b':
+			opts.tile_i = atol(optarg);
+			break;
+		case 't':
+			opts.tile_j = atol(optarg);
+			break;
+		case 'd':
+			opts.schedule = energy_schedule_from_name(optarg);
+			break;
+		case 'f':
+			first_touch = 1;
+			opts.schedule = SCHED_BALANCED;
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'j':
+			traj = optarg;
+			break;
+		case 'F':
+			forces = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (opts.isa < 0 || opts.precision < 0 || opts.cut_mode < 0 || opts.schedule < 0 || n < 1 || repeats < 1 || opts.cutoff < 0)
+		usage(argv[0]);
+	/* forces come from the all-pairs kernels only */
+	if (forces && (opts.cutoff > 0 || opts.spme || traj || output))
+		usage(argv[0]);
+	opts.isa = energy_select_isa(opts.isa);
+	if (opts.r_switch < 0)
+		opts.r_switch = 0.9f * opts.cutoff;
+
+	if (traj)
+		return run_trajectory(traj, output, &opts, a);
+	if (input)
+	{
+		c = charges_read(input, box);
+		if (!c)
+			return 1;
+	}
+	else
+	{
+		c = charges_lattice(n, a, 111);
+		box[0] = box[1] = box[2] = n * a;
+	}
+	if (output)
+	{
+		r = charges_write(c, output, box);
+		if (r == 0)
+			printf("%li charges written to %s\n", c->n, output);
+		charges_free(c);
+		return r == 0 ? 0 : 1;
+	}
+	if (opts.spme)
+	{
+		if (box[0] <= 0 || box[1] <= 0 || box[2] <= 0)
+		{
+			fprintf(stderr, "%s has no periodic box\n", input);
+			return 1;
+		}
+		opts.box[0] = box[0];
+		opts.box[1] = box[1];
+		opts.box[2] = box[2];
+		if (opts.cutoff == 0)
+			opts.cutoff = fminf(6 * a, 0.5f * fminf(box[0], fminf(box[1], box[2])));
+		clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		Energy = coulomb_energy_spme(c, &opts, &parts);
+		clock_gettime(CLOCK_MONOTONIC, &ts_end);
+		if (isnan(Energy))
+		{
+			fprintf(stderr, "SPME needs a cutoff of at most half the box\n");
+			charges_free(c);
+			return 1;
+		}
+		time_total = (ts_end.tv_sec - ts_start.tv_sec) * 1e9 + (ts_end.tv_nsec - ts_start.tv_nsec);
+		printf("%li charges, periodic box %.3fx%.3fx%.3f, SPME beta %.4f, grid %dx%dx%d, order %d, cutoff %.3f\n",
+			   c->n, opts.box[0], opts.box[1], opts.box[2], parts.beta, parts.grid[0], parts.grid[1], parts.grid[2], opts.spme_order, opts.cutoff);
+		printf("Real space        %14.6f  %10.3f ms\n", parts.real * 1e-4, parts.t_real * 1e3);
+		printf("Reciprocal space  %14.6f  %10.3f ms\n", parts.recip * 1e-4, parts.t_recip * 1e3);
+		printf("Self              %14.6f\n", parts.self * 1e-4);
+		printf("\nTotal time is %f ms, Energy is %.3f\n", time_total / 1e6, Energy * 1e-4);
+		charges_free(c);
+		return 0;
+	}
+	if (forces)
+	{
+		r = run_forces(c, &opts, repeats);
+		charges_free(c);
+		return r;
+	}
+	if (opts.cutoff > 0)
+		printf("%li charges, cutoff %.3f, %s potential\n", c->n, opts.cutoff, energy_cut_mode_name(opts.cut_mode));
+	else if (opts.isa == ISA_AVX2 || opts.isa == ISA_AVX512)
+	{
+		width = opts.isa == ISA_AVX512 ? 16 : 8;
+		energy_tile_sizes(&opts, width, c->n_pad / width, &tile_i, &tile_j);
+		printf("%li charges, kernel %s, precision %s, tiles %li x %li vectors, %s schedule%s\n", c->n,
+			   energy_isa_name(opts.isa), energy_precision_name(opts.precision), tile_i, tile_j,
+			   energy_schedule_name(opts.schedule), first_touch ? ", first touch" : "");
+		if (first_touch)
+			charges_first_touch(c, &opts);
+	}
+	else
+		printf("%li charges, kernel %s, precision %s\n", c->n, energy_isa_name(opts.isa),
+			   energy_precision_name(opts.precision));
+
+	for (r = 0; r < repeats; r++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		Energy = coulomb_energy_parts(c, &opts, &parts);
+		clock_gettime(CLOCK_MONOTONIC, &ts_end);
+		time_total = (ts_end.tv_sec - ts_start.tv_sec) * 1e9 + (ts_end.tv_nsec - ts_start.tv_nsec);
+		if (r == 0 || time_total < time_best)
+		{
+			time_best = time_total;
+			best = parts;
+		}
+	}
+	printf("\nTotal time is %f ms, Energy is %.3f\n", time_best / 1e6, Energy * 1e-4);
+	if (opts.cutoff == 0)
+		printf("%.2f GFLOP/s\n", 0.5 * c->n * (c->n - 1) * FLOPS_PER_PAIR / time_best);
+	/* utilization is the mean busy time of the threads over the longest one */
+	if (opts.cutoff == 0 && (opts.isa == ISA_AVX2 || opts.isa == ISA_AVX512))
+		printf("%d threads busy %.3f / %.3f / %.3f ms (min/mean/max), utilization %.1f%%, imbalance %.1f%%\n",
+			   best.threads, best.t_thread_min * 1e3, best.t_thread_mean * 1e3, best.t_thread_max * 1e3,
+			   100 * best.t_thread_mean / best.t_thread_max, 100 * (best.t_thread_max / best.t_thread_mean - 1));
+
+	charges_free(c);
+	return 0;
+}
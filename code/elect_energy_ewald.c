@@ -0,0 +1,431 @@
+/* --- File elect_energy_ewald.c --- */
+/* Smooth particle mesh Ewald (Essmann et al., J. Chem. Phys. 103, 8577 (1995)).
+   The periodic energy is split into
+     real space:   sum over pairs within the cutoff of q[i]*q[j]*erfc(beta*r)/r
+     reciprocal:   charges spread on a 3D grid with B-splines, FFT, sum over k-vectors
+     self:         -beta/sqrt(pi) * sum q[i]^2
+   plus a correction for a non-neutral system. Units are the same as in the direct sum */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <omp.h>
+#include "elect_energy.h"
+
+#define MAX_SPME_ORDER 8
+
+static double wall_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* exp(x) for -80 < x <= 0 with float accuracy. Unlike expf() it vectorizes: x = k*ln2 + r,
+   exp(r) is a polynomial and 2^k is written straight into the exponent bits */
+static inline float exp_neg(float x)
+{
+	int32_t k = (int32_t)(x * 1.44269504f - 0.5f); /* rounds to nearest for x <= 0 */
+	float r = x - k * 0.693147181f;
+	float p = 1.0f + r * (1.0f + r * (0.5f + r * (0.166666672f + r * (0.0416666679f + r * (0.00833333377f + r * 0.00138888892f)))));
+	union
+	{
+		int32_t i;
+		float f;
+	} scale = {(k + 127) << 23};
+	return p * scale.f;
+}
+
+/* erfc(x) for x >= 0, Abramowitz and Stegun 7.1.26, absolute error below 1.5e-7 */
+static inline float erfc_approx(float x)
+{
+	float t = 1.0f / (1.0f + 0.3275911f * x);
+	float poly = t * (0.254829592f + t * (-0.284496736f + t * (1.421413741f + t * (-1.453152027f + t * 1.061405429f))));
+	return poly * exp_neg(-x * x);
+}
+
+/* Portable version of the real-space pair loop, the AVX versions are in
+   elect_energy_kernels_avx2.c and elect_energy_kernels_avx512.c */
+float ewald_real_range_simd(const cell_list *cl, long j0, long j1, float xi, float yi, float zi,
+							const float *box, float rc2, float beta)
+{
+	const float *x = cl->x, *y = cl->y, *z = cl->z, *q = cl->q;
+	float bx = box[0], by = box[1], bz = box[2];
+	float hbx = 0.5f * bx, hby = 0.5f * by, hbz = 0.5f * bz;
+	float rc = sqrtf(rc2);
+	float e = 0.0f;
+	long j;
+
+#pragma omp simd reduction(+ : e)
+	for (j = j0; j < j1; j++)
+	{
+		/* minimum image convention, the coordinates are wrapped into the box */
+		float dx = xi - x[j], dy = yi - y[j], dz = zi - z[j];
+		dx += (dx < -hbx ? bx : 0.0f) - (dx > hbx ? bx : 0.0f);
+		dy += (dy < -hby ? by : 0.0f) - (dy > hby ? by : 0.0f);
+		dz += (dz < -hbz ? bz : 0.0f) - (dz > hbz ? bz : 0.0f);
+		float r2 = dx * dx + dy * dy + dz * dz;
+		/* r2 == 0 is the charge itself. Pairs that are not counted are evaluated at the
+		   cutoff, far away erfc() would underflow into slow denormals */
+		float r_inv = 1.0f / sqrtf(r2 + 1e-30f);
+		float r = r2 < rc2 ? r2 * r_inv : rc;
+		e += (r2 > 0.0f && r2 < rc2) ? q[j] * erfc_approx(beta * r) * r_inv : 0.0f;
+	}
+	return e;
+}
+
+/* Real-space energy, counting only pairs in neighbouring cells */
+static double real_space(const charges *c, const energy_opts *opts, float beta, energy_workspace *w)
+{
+	float (*range)(const cell_list *, long, long, float, float, float, const float *, float, float);
+	cell_list *cl = w->cells = cell_list_rebuild(w->cells, c, opts->cutoff, opts->box);
+	long n_cells = (long)cl->nc[0] * cl->nc[1] * cl->nc[2], ic;
+	float rc2 = opts->cutoff * opts->cutoff;
+	double Energy = 0.0;
+
+	switch (energy_select_isa(opts->isa))
+	{
+	case ISA_AVX512:
+		range = ewald_real_range_avx512;
+		break;
+	case ISA_AVX2:
+		range = ewald_real_range_avx2;
+		break;
+	default:
+		range = ewald_real_range_simd;
+	}
+
+#pragma omp parallel for reduction(+ : Energy) schedule(dynamic)
+	for (ic = 0; ic < n_cells; ic++)
+	{
+		int ix = ic / ((long)cl->nc[1] * cl->nc[2]);
+		int iy = (ic / cl->nc[2]) % cl->nc[1];
+		int iz = ic % cl->nc[2];
+		long nbr[27], i;
+		int n_nbr = 0, k, dx, dy, dz;
+
+		/* All 27 neighbour cells, periodically wrapped. With fewer than three cells in a
+		   dimension the same cell appears more than once, keep it only once */
+		for (dx = -1; dx <= 1; dx++)
+			for (dy = -1; dy <= 1; dy++)
+				for (dz = -1; dz <= 1; dz++)
+				{
+					int jx = (ix + dx + cl->nc[0]) % cl->nc[0];
+					int jy = (iy + dy + cl->nc[1]) % cl->nc[1];
+					int jz = (iz + dz + cl->nc[2]) % cl->nc[2];
+					long jc = ((long)jx * cl->nc[1] + jy) * cl->nc[2] + jz;
+					for (k = 0; k < n_nbr && nbr[k] != jc; k++)
+						;
+					if (k == n_nbr)
+						nbr[n_nbr++] = jc;
+				}
+
+		for (i = cl->start[ic]; i < cl->start[ic + 1]; i++)
+		{
+			float e = 0.0f;
+			for (k = 0; k < n_nbr; k++)
+				e += range(cl, cl->start[nbr[k]], cl->start[nbr[k] + 1], cl->x[i], cl->y[i], cl->z[i],
+						   opts->box, rc2, beta);
+			Energy += cl->q[i] * e;
+		}
+	}
+	/* every pair was counted twice */
+	return 0.5 * Energy;
+}
+
+/* In-place radix-2 complex FFT of n (a power of two) values with stride 1.
+   data holds interleaved real and imaginary parts */
+static void fft_1d(double *data, int n)
+{
+	int i, j, len, k;
+
+	/* bit reversal permutation */
+	for (i = 1, j = 0; i < n; i++)
+	{
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+		{
+			double tr = data[2 * i], ti = data[2 * i + 1];
+			data[2 * i] = data[2 * j];
+			data[2 * i + 1] = data[2 * j + 1];
+			data[2 * j] = tr;
+			data[2 * j + 1] = ti;
+		}
+	}
+	/* butterflies */
+	for (len = 2; len <= n; len <<= 1)
+	{
+		double ang = -2 * M_PI / len;
+		double wr = cos(ang), wi = sin(ang);
+		for (i = 0; i < n; i += len)
+		{
+			double cr = 1.0, ci = 0.0;
+			for (k = 0; k < len / 2; k++)
+			{
+				double *a = &data[2 * (i + k)], *b = &data[2 * (i + k + len / 2)];
+				double br = b[0] * cr - b[1] * ci, bi = b[0] * ci + b[1] * cr;
+				double t;
+				b[0] = a[0] - br;
+				b[1] = a[1] - bi;
+				a[0] += br;
+				a[1] += bi;
+				t = cr * wr - ci * wi;
+				ci = cr * wi + ci * wr;
+				cr = t;
+			}
+		}
+	}
+}
+
+/* 3D FFT of a K[0] x K[1] x K[2] complex grid, one dimension at a time. line_buf holds a
+   line of line_length complex values for every thread */
+static void fft_3d(double *grid, const int *K, double *line_buf, int line_length)
+{
+	long stride[3] = {(long)K[1] * K[2], K[2], 1};
+	int d;
+
+	for (d = 0; d < 3; d++)
+	{
+		int d1 = (d + 1) % 3, d2 = (d + 2) % 3;
+		long lines = (long)K[d1] * K[d2], l;
+#pragma omp parallel
+		{
+			double *line = line_buf + 2L * line_length * omp_get_thread_num();
+#pragma omp for
+			for (l = 0; l < lines; l++)
+			{
+				long base = (l / K[d2]) * stride[d1] + (l % K[d2]) * stride[d2];
+				int k;
+				for (k = 0; k < K[d]; k++)
+				{
+					line[2 * k] = grid[2 * (base + k * stride[d])];
+					line[2 * k + 1] = grid[2 * (base + k * stride[d]) + 1];
+				}
+				fft_1d(line, K[d]);
+				for (k = 0; k < K[d]; k++)
+				{
+					grid[2 * (base + k * stride[d])] = line[2 * k];
+					grid[2 * (base + k * stride[d]) + 1] = line[2 * k + 1];
+				}
+			}
+		}
+	}
+}
+
+/* Cardinal B-spline weights of the given order for fractional offset w:
+   data[j] = M_order(w + order - 1 - j) */
+static void bspline_weights(double w, int order, double *data)
+{
+	int j, k;
+	double div;
+
+	data[order - 1] = 0.0;
+	data[1] = w;
+	data[0] = 1.0 - w;
+	for (j = 3; j <= order; j++)
+	{
+		div = 1.0 / (j - 1);
+		data[j - 1] = div * w * data[j - 2];
+		for (k = 1; k <= j - 2; k++)
+			data[j - k - 1] = div * ((w + k) * data[j - k - 2] + (j - k - w) * data[j - k - 1]);
+		data[0] = div * (1.0 - w) * data[0];
+	}
+}
+
+/* |b(m)|^2 of the B-spline interpolation for m = 0..K-1 */
+static void bspline_moduli(int K, int order, double *bsp_mod)
+{
+	double M[MAX_SPME_ORDER];
+	int m, k;
+
+	bspline_weights(0.0, order, M); /* M[order-2-k] = M_order(k+1) */
+	for (m = 0; m < K; m++)
+	{
+		double sr = 0.0, si = 0.0;
+		for (k = 0; k <= order - 2; k++)
+		{
+			sr += M[order - 2 - k] * cos(2 * M_PI * m * k / K);
+			si += M[order - 2 - k] * sin(2 * M_PI * m * k / K);
+		}
+		bsp_mod[m] = sr * sr + si * si;
+	}
+	/* The interpolation fails where the sum vanishes (odd orders at K/2), use the neighbours */
+	for (m = 0; m < K; m++)
+		if (bsp_mod[m] < 1e-7)
+			bsp_mod[m] = 0.5 * (bsp_mod[(m - 1 + K) % K] + bsp_mod[(m + 1) % K]);
+}
+
+static int next_pow2(int v)
+{
+	int p = 1;
+	while (p < v)
+		p <<= 1;
+	return p;
+}
+
+/* The grid, FFT lines and B-spline moduli of w for grid K and the order, reallocated and
+   computed again only if they are too small or for another grid */
+static void spme_workspace(energy_workspace *w, const int *K, int order)
+{
+	long n_grid = (long)K[0] * K[1] * K[2];
+	int d, threads = omp_get_max_threads(), length = K[0];
+
+	if (n_grid > w->grid_points)
+	{
+		free(w->grid);
+		w->grid = malloc(2 * n_grid * sizeof(double));
+		w->grid_points = n_grid;
+	}
+	memset(w->grid, 0, 2 * n_grid * sizeof(double));
+	for (d = 1; d < 3; d++)
+		if (K[d] > length)
+			length = K[d];
+	if (threads > w->line_threads || length > w->line_length)
+	{
+		free(w->lines);
+		w->line_threads = threads > w->line_threads ? threads : w->line_threads;
+		w->line_length = length > w->line_length ? length : w->line_length;
+		w->lines = malloc(2L * w->line_threads * w->line_length * sizeof(double));
+	}
+	for (d = 0; d < 3; d++)
+		if (w->grid_size[d] != K[d] || w->order != order)
+		{
+			free(w->bsp_mod[d]);
+			w->bsp_mod[d] = malloc(K[d] * sizeof(double));
+			bspline_moduli(K[d], order, w->bsp_mod[d]);
+			w->grid_size[d] = K[d];
+		}
+	w->order = order;
+}
+
+/* Reciprocal-space energy */
+static double spme_recip(const charges *c, const float *box, float beta, const int *K, int order,
+						 energy_workspace *w)
+{
+	long n_grid = (long)K[0] * K[1] * K[2], i;
+	double *grid, **bsp_mod = w->bsp_mod;
+	double volume = (double)box[0] * box[1] * box[2];
+	double Energy = 0.0;
+
+	spme_workspace(w, K, order);
+	grid = w->grid;
+
+	/* Spread the charges on the grid */
+#pragma omp parallel for
+	for (i = 0; i < c->n; i++)
+	{
+		double w[3][MAX_SPME_ORDER];
+		int k0[3], a, b, e, dd;
+		float pos[3] = {c->x[i], c->y[i], c->z[i]};
+		for (dd = 0; dd < 3; dd++)
+		{
+			double u = pos[dd] / box[dd];
+			u = (u - floor(u)) * K[dd];
+			k0[dd] = (int)u;
+			bspline_weights(u - k0[dd], order, w[dd]);
+			k0[dd] -= order - 1;
+		}
+		for (a = 0; a < order; a++)
+		{
+			long ga = (k0[0] + a + K[0]) % K[0];
+			for (b = 0; b < order; b++)
+			{
+				long gb = (k0[1] + b + K[1]) % K[1];
+				double qab = c->q[i] * w[0][a] * w[1][b];
+				for (e = 0; e < order; e++)
+				{
+					long gc = (k0[2] + e + K[2]) % K[2];
+#pragma omp atomic
+					grid[2 * ((ga * K[1] + gb) * K[2] + gc)] += qab * w[2][e];
+				}
+			}
+		}
+	}
+
+	fft_3d(grid, K, w->lines, w->line_length);
+
+	/* Sum over k-vectors m != 0 of exp(-pi^2 m^2/beta^2)/m^2 * B(m) * |S(m)|^2 */
+#pragma omp parallel for reduction(+ : Energy)
+	for (i = 1; i < n_grid; i++)
+	{
+		int k1 = i / ((long)K[1] * K[2]), k2 = (i / K[2]) % K[1], k3 = i % K[2];
+		double mx = (k1 <= K[0] / 2 ? k1 : k1 - K[0]) / box[0];
+		double my = (k2 <= K[1] / 2 ? k2 : k2 - K[1]) / box[1];
+		double mz = (k3 <= K[2] / 2 ? k3 : k3 - K[2]) / box[2];
+		double m2 = mx * mx + my * my + mz * mz;
+		double s2 = grid[2 * i] * grid[2 * i] + grid[2 * i + 1] * grid[2 * i + 1];
+		Energy += exp(-M_PI * M_PI * m2 / (beta * beta)) / m2 * s2 /
+				  (bsp_mod[0][k1] * bsp_mod[1][k2] * bsp_mod[2][k3]);
+	}
+	return Energy / (2 * M_PI * volume);
+}
+
+double coulomb_energy_spme(const charges *c, const energy_opts *opts, energy_parts *parts)
+{
+	return coulomb_energy_spme_work(c, opts, NULL, parts);
+}
+
+double coulomb_energy_spme_work(const charges *c, const energy_opts *opts, energy_workspace *w, energy_parts *parts)
+{
+	energy_workspace *own = NULL;
+	energy_parts p = {0};
+	float rc = opts->cutoff, beta = opts->ewald_beta;
+	int order = opts->spme_order, d;
+	double q_sum = 0.0, q2_sum = 0.0, t;
+	long i;
+
+	for (d = 0; d < 3; d++)
+		if (opts->box[d] <= 0 || rc <= 0 || rc > 0.5f * opts->box[d])
+			return NAN;
+	if (order < 2 || order > MAX_SPME_ORDER)
+		order = 4;
+	if (!w)
+		w = own = energy_workspace_create();
+	/* beta so that erfc(beta*rc) equals the tolerance, by bisection */
+	if (beta <= 0)
+	{
+		float lo = 0.0f, hi = 10.0f / rc;
+		for (i = 0; i < 60; i++)
+		{
+			beta = 0.5f * (lo + hi);
+			if (erfc(beta * rc) > opts->ewald_tol)
+				lo = beta;
+			else
+				hi = beta;
+		}
+	}
+	/* Grid spacing of about 0.375/beta, as with the usual 0.12 nm for beta = 3.12 nm^-1 */
+	for (d = 0; d < 3; d++)
+		p.grid[d] = opts->grid[d] > 0 ? next_pow2(opts->grid[d]) : next_pow2((int)ceilf(opts->box[d] * beta / 0.375f));
+	p.beta = beta;
+
+	/* Real space */
+	t = wall_time();
+	p.real = real_space(c, opts, beta, w);
+	p.t_real = wall_time() - t;
+
+	/* Reciprocal space */
+	t = wall_time();
+	p.recip = spme_recip(c, opts->box, beta, p.grid, order, w);
+	p.t_recip = wall_time() - t;
+
+	/* Self energy, and the energy of the neutralizing background for a net charge */
+	for (i = 0; i < c->n; i++)
+	{
+		q_sum += c->q[i];
+		q2_sum += (double)c->q[i] * c->q[i];
+	}
+	p.self = -beta / sqrt(M_PI) * q2_sum -
+			 M_PI * q_sum * q_sum / (2.0 * beta * beta * opts->box[0] * opts->box[1] * opts->box[2]);
+
+	p.total = p.real + p.recip + p.self;
+	energy_workspace_free(own);
+	if (parts)
+		*parts = p;
+	return p.total;
+}
@@ -0,0 +1,191 @@
+/* --- File elect_energy_forces.c --- */
+/* Forces and virial from the all-pairs kernels. The force on charge i is
+     F[i] = sum_j q[i]*q[j]*(r[i] - r[j])/dist[i,j]^3
+   and every pair is visited once: the kernels add the contribution to i and subtract it
+   from j (Newton's third law). Each thread accumulates into its own SoA buffer, the
+   buffers are summed with a tree reduction. Without periodic images the virial tensor is
+   sum_i r[i] (x) F[i], it is computed from the reduced forces */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "elect_energy.h"
+
+energy_forces *energy_forces_alloc(long n_pad)
+{
+	energy_forces *f = malloc(sizeof(energy_forces));
+
+	f->n_pad = n_pad;
+	f->threads = omp_get_max_threads();
+	f->buf = aligned_alloc(CHARGES_ALIGN, (size_t)f->threads * 3 * n_pad * sizeof(float));
+	if (!f->buf)
+	{
+		fprintf(stderr, "energy_forces_alloc: out of memory (%li charges, %d threads)\n", n_pad, f->threads);
+		exit(1);
+	}
+	/* the total ends up in the buffer of thread 0 */
+	f->fx = f->buf;
+	f->fy = f->buf + n_pad;
+	f->fz = f->buf + 2 * n_pad;
+	memset(f->virial, 0, sizeof(f->virial));
+	return f;
+}
+
+void energy_forces_free(energy_forces *f)
+{
+	if (!f)
+		return;
+	free(f->buf);
+	free(f);
+}
+
+/* The buffer of thread t, cleared by the thread itself so that its pages are local */
+float *energy_forces_thread(energy_forces *f, int t)
+{
+	float *b = f->buf + (size_t)t * 3 * f->n_pad;
+
+	memset(b, 0, 3 * f->n_pad * sizeof(float));
+	return b;
+}
+
+/* Pairwise tree reduction of the thread buffers into buffer 0: at level s buffer t
+   receives buffer t+s for every t that is a multiple of 2s, log2(threads) levels in all.
+   Buffers of threads that did not take part are cleared first. Then the virial */
+void energy_forces_reduce(energy_forces *f, const charges *c, int used)
+{
+	long k, len = 3 * f->n_pad;
+	int s, t;
+	double vxx = 0, vyy = 0, vzz = 0, vxy = 0, vxz = 0, vyz = 0;
+
+	for (t = used; t < f->threads; t++)
+		energy_forces_thread(f, t);
+#pragma omp parallel private(s, t)
+	for (s = 1; s < f->threads; s *= 2)
+	{
+#pragma omp for
+		for (k = 0; k < len; k++)
+			for (t = 0; t + s < f->threads; t += 2 * s)
+				f->buf[t * len + k] += f->buf[(t + s) * len + k];
+	}
+
+#pragma omp parallel for reduction(+ : vxx, vyy, vzz, vxy, vxz, vyz)
+	for (k = 0; k < c->n; k++)
+	{
+		vxx += (double)c->x[k] * f->fx[k];
+		vyy += (double)c->y[k] * f->fy[k];
+		vzz += (double)c->z[k] * f->fz[k];
+		vxy += (double)c->x[k] * f->fy[k];
+		vxz += (double)c->x[k] * f->fz[k];
+		vyz += (double)c->y[k] * f->fz[k];
+	}
+	f->virial[0] = vxx;
+	f->virial[1] = vyy;
+	f->virial[2] = vzz;
+	f->virial[3] = vxy;
+	f->virial[4] = vxz;
+	f->virial[5] = vyz;
+}
+
+/* Reference kernel with forces, the loop of coulomb_energy_scalar */
+double coulomb_energy_forces_scalar(const charges *c, energy_forces *f)
+{
+	const float *x = c->x, *y = c->y, *z = c->z, *q = c->q;
+	long n = c->n, n_pad = c->n_pad, i, j;
+	float dx, dy, dz, dist, e, s, *fx, *fy, *fz;
+	double Energy = 0.0;
+	int used = 1;
+
+#pragma omp parallel private(i, j, dx, dy, dz, dist, e, s, fx, fy, fz) reduction(+ : Energy) num_threads(f->threads)
+	{
+		fx = energy_forces_thread(f, omp_get_thread_num());
+		fy = fx + n_pad;
+		fz = fy + n_pad;
+#pragma omp single
+		used = omp_get_num_threads();
+#pragma omp for schedule(dynamic)
+		for (i = 0; i < n; i++)
+		{
+			for (j = i + 1; j < n; j++)
+			{
+				dx = x[i] - x[j];
+				dy = y[i] - y[j];
+				dz = z[i] - z[j];
+				dist = sqrt(dx * dx + dy * dy + dz * dz);
+				e = q[i] * q[j] / dist;
+				Energy += e;
+				/* |F| = e/dist along the unit vector (dx,dy,dz)/dist */
+				s = e / (dist * dist);
+				fx[i] += s * dx;
+				fy[i] += s * dy;
+				fz[i] += s * dz;
+				fx[j] -= s * dx;
+				fy[j] -= s * dy;
+				fz[j] -= s * dz;
+			}
+		}
+	}
+	energy_forces_reduce(f, c, used);
+	return Energy;
+}
+
+double coulomb_energy_forces(const charges *c, const energy_opts *opts, energy_forces *f)
+{
+	energy_opts defaults;
+
+	if (!opts)
+	{
+		energy_opts_default(&defaults);
+		opts = &defaults;
+	}
+	switch (energy_select_isa(opts->isa))
+	{
+	case ISA_AVX2:
+		return coulomb_energy_avx2(c, opts, NULL, f);
+	case ISA_AVX512:
+		return coulomb_energy_avx512(c, opts, NULL, f);
+	default:
+		return coulomb_energy_forces_scalar(c, f);
+	}
+}
+
+/* Largest relative difference between the x, y and z forces on 'samples' charges and
+   central differences of the energy with step h. Only the terms of charge i change when
+   it moves, they are summed in double precision */
+double energy_forces_check(const charges *c, const energy_forces *f, int samples, double h)
+{
+	long i, j, k;
+	int d, s;
+	double err = 0.0, r[3], e[2], fd, fk, scale;
+	const float *force[3] = {f->fx, f->fy, f->fz};
+
+	for (s = 0; s < samples; s++)
+	{
+		i = (long)s * c->n / samples;
+		/* errors relative to the largest force component on i */
+		scale = fmax(fabs(f->fx[i]), fmax(fabs(f->fy[i]), fabs(f->fz[i])));
+		for (d = 0; d < 3; d++)
+		{
+			for (k = 0; k < 2; k++)
+			{
+				e[k] = 0.0;
+				for (j = 0; j < c->n; j++)
+				{
+					if (j == i)
+						continue;
+					r[0] = (double)c->x[i] - c->x[j];
+					r[1] = (double)c->y[i] - c->y[j];
+					r[2] = (double)c->z[i] - c->z[j];
+					r[d] += k ? -h : h;
+					e[k] += (double)c->q[i] * c->q[j] / sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+				}
+			}
+			/* F = -dE/dr */
+			fd = -(e[0] - e[1]) / (2 * h);
+			fk = force[d][i];
+			if (scale > 0)
+				err = fmax(err, fabs(fk - fd) / scale);
+		}
+	}
+	return err;
+}
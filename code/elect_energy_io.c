@@ -0,0 +1,370 @@
+/* --- File elect_energy_io.c --- */
+/* Charge sets on disk. The binary format is the padded SoA container itself:
+
+     bytes 0..63    header: magic "ELECHRG1", int64 n, int64 n_pad, float box[3], zeros
+     then           float x[n_pad], y[n_pad], z[n_pad], q[n_pad]
+
+   n_pad is a multiple of CHARGES_PAD and the padding is already filled by charges_pad,
+   so every array starts on a 64-byte boundary of the file. The file is mapped read-only
+   and the kernels work on the mapped pages directly, loading a file costs only the page
+   faults. XYZ text files are read once and written in the binary format with -o.
+
+   A trajectory keeps the charges fixed and stores the coordinates of every frame:
+
+     bytes 0..63    header: magic "ELECTRJ1", int64 n, int64 n_pad, int64 frames, float box[3]
+     then           float q[n_pad]
+     then per frame float x[n_pad], y[n_pad], z[n_pad] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "elect_energy.h"
+
+#define CHARGES_MAGIC "ELECHRG1"
+#define TRAJECTORY_MAGIC "ELECTRJ1"
+#define CHARGES_HEADER 64
+
+typedef struct
+{
+	char magic[8];
+	int64_t n, n_pad;
+	float box[3];
+	char unused[CHARGES_HEADER - 8 - 2 * sizeof(int64_t) - 3 * sizeof(float)];
+} charges_header;
+
+typedef struct
+{
+	char magic[8];
+	int64_t n, n_pad, frames;
+	float box[3];
+	char unused[CHARGES_HEADER - 8 - 3 * sizeof(int64_t) - 3 * sizeof(float)];
+} trajectory_header;
+
+int charges_write(const charges *c, const char *path, const float *box)
+{
+	charges_header h;
+	FILE *f = fopen(path, "wb");
+	size_t n_pad = c->n_pad;
+
+	if (!f)
+	{
+		perror(path);
+		return -1;
+	}
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CHARGES_MAGIC, 8);
+	h.n = c->n;
+	h.n_pad = c->n_pad;
+	if (box)
+		memcpy(h.box, box, sizeof(h.box));
+	if (fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(c->x, sizeof(float), n_pad, f) != n_pad ||
+		fwrite(c->y, sizeof(float), n_pad, f) != n_pad || fwrite(c->z, sizeof(float), n_pad, f) != n_pad ||
+		fwrite(c->q, sizeof(float), n_pad, f) != n_pad)
+	{
+		perror(path);
+		fclose(f);
+		return -1;
+	}
+	return fclose(f);
+}
+
+charges *charges_map(const char *path, float *box)
+{
+	charges_header h;
+	struct stat st;
+	charges *c;
+	char *p;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+	{
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || read(fd, &h, sizeof(h)) != sizeof(h))
+	{
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+	if (memcmp(h.magic, CHARGES_MAGIC, 8) != 0 || h.n < 0 || h.n_pad < h.n || h.n_pad % CHARGES_PAD != 0 ||
+		st.st_size != (off_t)(CHARGES_HEADER + 4 * h.n_pad * sizeof(float)))
+	{
+		fprintf(stderr, "%s: not a charge set file\n", path);
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		perror(path);
+		return NULL;
+	}
+
+	c = malloc(sizeof(charges));
+	c->n = h.n;
+	c->n_pad = h.n_pad;
+	c->x = (float *)(p + CHARGES_HEADER);
+	c->y = c->x + h.n_pad;
+	c->z = c->y + h.n_pad;
+	c->q = c->z + h.n_pad;
+	c->map = p;
+	c->map_bytes = st.st_size;
+	if (box)
+		memcpy(box, h.box, sizeof(h.box));
+	return c;
+}
+
+/* One frame of an XYZ text file: the number of charges, a comment line, then one
+   "name x y z q" line per charge. If the comment line starts with three numbers they are
+   the periodic box. *c is allocated with the first frame, later frames must have the same
+   number of charges. Returns 1 for a frame, 0 at the end of the file and -1 on errors */
+static int read_xyz_frame(FILE *f, const char *path, charges **c, float *box)
+{
+	char line[1024];
+	long n, i;
+
+	if (!fgets(line, sizeof(line), f))
+		return 0;
+	if (sscanf(line, "%li", &n) != 1 || n < 1 || (*c && n != (*c)->n) || !fgets(line, sizeof(line), f))
+	{
+		fprintf(stderr, "%s: not an XYZ file, or the frames differ in size\n", path);
+		return -1;
+	}
+	if (sscanf(line, "%f %f %f", &box[0], &box[1], &box[2]) != 3)
+		box[0] = box[1] = box[2] = 0.0f;
+
+	if (!*c)
+		*c = charges_alloc(n);
+	for (i = 0; i < n; i++)
+	{
+		if (!fgets(line, sizeof(line), f) ||
+			sscanf(line, "%*s %f %f %f %f", &(*c)->x[i], &(*c)->y[i], &(*c)->z[i], &(*c)->q[i]) != 4)
+		{
+			fprintf(stderr, "%s: charge %li is not \"name x y z q\"\n", path, i + 1);
+			return -1;
+		}
+	}
+	charges_pad(*c);
+	return 1;
+}
+
+charges *charges_read_xyz(const char *path, float *box)
+{
+	FILE *f = fopen(path, "r");
+	charges *c = NULL;
+	float b[3];
+
+	if (!f)
+	{
+		perror(path);
+		return NULL;
+	}
+	if (read_xyz_frame(f, path, &c, b) != 1)
+	{
+		if (c)
+			charges_free(c);
+		c = NULL;
+	}
+	fclose(f);
+	if (c && box)
+		memcpy(box, b, sizeof(b));
+	return c;
+}
+
+/* The binary format is recognised by its magic, everything else is read as XYZ */
+charges *charges_read(const char *path, float *box)
+{
+	char magic[8];
+	FILE *f = fopen(path, "rb");
+	int binary;
+
+	if (!f)
+	{
+		perror(path);
+		return NULL;
+	}
+	binary = fread(magic, 1, 8, f) == 8 && memcmp(magic, CHARGES_MAGIC, 8) == 0;
+	fclose(f);
+	return binary ? charges_map(path, box) : charges_read_xyz(path, box);
+}
+
+/* Every frame of a multi-frame XYZ file into a binary trajectory, one frame in memory at a
+   time. The charges are those of the first frame, the box that of the last one */
+int trajectory_convert_xyz(const char *xyz, const char *path)
+{
+	FILE *in = fopen(xyz, "r"), *out;
+	trajectory_header h;
+	charges *c = NULL;
+	size_t n_pad;
+	int status;
+
+	if (!in)
+	{
+		perror(xyz);
+		return -1;
+	}
+	out = fopen(path, "wb");
+	if (!out)
+	{
+		perror(path);
+		fclose(in);
+		return -1;
+	}
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TRAJECTORY_MAGIC, 8);
+	while ((status = read_xyz_frame(in, xyz, &c, h.box)) == 1)
+	{
+		n_pad = c->n_pad;
+		/* the header is rewritten at the end, when the number of frames is known */
+		if (h.frames == 0 && (fwrite(&h, sizeof(h), 1, out) != 1 || fwrite(c->q, sizeof(float), n_pad, out) != n_pad))
+			status = -1;
+		if (fwrite(c->x, sizeof(float), n_pad, out) != n_pad || fwrite(c->y, sizeof(float), n_pad, out) != n_pad ||
+			fwrite(c->z, sizeof(float), n_pad, out) != n_pad)
+			status = -1;
+		if (status < 0)
+		{
+			perror(path);
+			break;
+		}
+		h.frames++;
+	}
+	fclose(in);
+	if (status == 0 && h.frames == 0)
+	{
+		fprintf(stderr, "%s: no frames\n", xyz);
+		status = -1;
+	}
+	if (status == 0)
+	{
+		h.n = c->n;
+		h.n_pad = c->n_pad;
+		if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, out) != 1)
+		{
+			perror(path);
+			status = -1;
+		}
+	}
+	if (fclose(out) != 0)
+		status = -1;
+	charges_free(c);
+	return status == 0 ? (int)h.frames : -1;
+}
+
+trajectory *trajectory_open(const char *path)
+{
+	trajectory_header h;
+	struct stat st;
+	trajectory *t;
+	char *p;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+	{
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || read(fd, &h, sizeof(h)) != sizeof(h))
+	{
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+	if (memcmp(h.magic, TRAJECTORY_MAGIC, 8) != 0 || h.n < 0 || h.n_pad < h.n || h.n_pad % CHARGES_PAD != 0 ||
+		h.frames < 1 || st.st_size != (off_t)(CHARGES_HEADER + (1 + 3 * h.frames) * h.n_pad * sizeof(float)))
+	{
+		fprintf(stderr, "%s: not a trajectory file\n", path);
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		perror(path);
+		return NULL;
+	}
+
+	t = malloc(sizeof(trajectory));
+	t->frames = h.frames;
+	memcpy(t->box, h.box, sizeof(h.box));
+	t->map = p;
+	t->map_bytes = st.st_size;
+	t->frame.n = h.n;
+	t->frame.n_pad = h.n_pad;
+	t->frame.q = (float *)(p + CHARGES_HEADER);
+	t->frame.map = NULL;
+	t->frame.map_bytes = 0;
+	t->buf[0] = aligned_alloc(CHARGES_ALIGN, 3 * h.n_pad * sizeof(float));
+	t->buf[1] = aligned_alloc(CHARGES_ALIGN, 3 * h.n_pad * sizeof(float));
+	t->loaded[0] = t->loaded[1] = -1;
+	t->loading = 0;
+	if (!t->buf[0] || !t->buf[1])
+	{
+		fprintf(stderr, "%s: out of memory\n", path);
+		trajectory_close(t);
+		return NULL;
+	}
+	trajectory_frame(t, 0);
+	return t;
+}
+
+/* x, y and z of frame k into buffer b; the copy reads the pages of the frame from the file */
+static void load_frame(trajectory *t, long k, int b)
+{
+	memcpy(t->buf[b], t->frame.q + (1 + 3 * k) * t->frame.n_pad, 3 * t->frame.n_pad * sizeof(float));
+	t->loaded[b] = k;
+}
+
+static void *loader_thread(void *arg)
+{
+	trajectory *t = arg;
+
+	load_frame(t, t->next, t->next_buf);
+	return NULL;
+}
+
+/* Wait for the loader thread, then take frame k from its buffer, or copy it here if the
+   frames are not read in order. Frame k+1 goes into the other buffer in the background */
+const charges *trajectory_frame(trajectory *t, long k)
+{
+	long n_pad = t->frame.n_pad;
+	int b;
+
+	if (t->loading)
+	{
+		pthread_join(t->loader, NULL);
+		t->loading = 0;
+	}
+	b = t->loaded[1] == k;
+	if (t->loaded[b] != k)
+		load_frame(t, k, b);
+	t->frame.x = t->buf[b];
+	t->frame.y = t->frame.x + n_pad;
+	t->frame.z = t->frame.y + n_pad;
+	if (k + 1 < t->frames)
+	{
+		t->next = k + 1;
+		t->next_buf = !b;
+		/* without a thread frame k+1 is copied when it is asked for */
+		t->loading = pthread_create(&t->loader, NULL, loader_thread, t) == 0;
+	}
+	return &t->frame;
+}
+
+void trajectory_close(trajectory *t)
+{
+	if (!t)
+		return;
+	if (t->loading)
+		pthread_join(t->loader, NULL);
+	munmap(t->map, t->map_bytes);
+	free(t->buf[0]);
+	free(t->buf[1]);
+	free(t);
+}
@@ -0,0 +1,390 @@
+/* --- File elect_energy_kernels_avx2.c --- */
+/* AVX2 kernel of elect_energy_avx2.c working on the shared SoA charge container.
+   The target attribute lets this file be compiled without -march, the dispatcher
+   only calls it on CPUs with AVX2 and FMA */
+#include <math.h>
+#include <omp.h>
+#include "elect_energy.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2,fma")))
+#define AVX2_INLINE __attribute__((target("avx2,fma"), always_inline)) static inline
+
+/* distance^-1 with the requested precision. _mm256_rsqrt_ps has about 12 correct bits,
+   every Newton-Raphson step y = y*(3 - r2*y*y)/2 doubles them */
+AVX2_INLINE __m256 rsqrt_avx2(__m256 r2, const int precision)
+{
+	__m256 y;
+
+	if (precision == PREC_EXACT)
+		return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(r2));
+	y = _mm256_rsqrt_ps(r2);
+	if (precision >= PREC_NR1)
+		y = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y),
+						  _mm256_fnmadd_ps(_mm256_mul_ps(r2, y), y, _mm256_set1_ps(3.0f)));
+	if (precision >= PREC_NR2)
+		y = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y),
+						  _mm256_fnmadd_ps(_mm256_mul_ps(r2, y), y, _mm256_set1_ps(3.0f)));
+	return y;
+}
+
+/* Add the 8 floats of v to the 4 double precision lanes of acc */
+AVX2_INLINE __m256d add_ps_to_pd(__m256d acc, __m256 v)
+{
+	acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+	return _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+}
+
+/* Sum of the 8 floats of v */
+AVX2_INLINE float hsum_avx2(__m256 v)
+{
+	__m128 h = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+	h = _mm_add_ss(h, _mm_movehdup_ps(h));
+	return _mm_cvtss_f32(h);
+}
+
+/* Rows i_first..i_end-1 against their part of the triangle, one j tile at a time. All
+   rows of the block are applied to a tile while it is in cache. The diagonal tiles are
+   done with the first j tile. Tiles are summed in float and added to the double lanes of acc.
+   With forces every pair adds q[i]*q[j]*(r[i]-r[j])/r^3 to i and subtracts it from j in the
+   thread's buffer F: the j side per tile, the i side in fi, reduced once per row and tile */
+AVX2_INLINE void block_avx2(const charges *c, const long i_first, const long i_end, const long tile_j,
+							const __m256 *mask, __m256d *acc, const int precision, const int forces, float *F)
+{
+	const float *X = c->x, *Y = c->y, *Z = c->z, *Q = c->q;
+	long v_count = c->n_pad / 8; /* number of 8-float vectors */
+	long i, j, jt, j_start, j_end;
+	int m;
+
+	__m256 tmpQ[8], tmpX[8], tmpY[8], tmpZ[8];
+	__m256 xi, yi, zi, qi, xj, yj, zj, qj;
+	__m256 r_vec, result, vcps, diff[3];
+	__m256 fi[3][8], fj[3], fd;
+	__m256d acc0 = acc[0], acc1 = acc[1], sum;
+	float *Fx = F, *Fy = F + c->n_pad, *Fz = F + 2 * c->n_pad;
+	int d;
+
+	for (jt = i_first; jt < v_count; jt += tile_j)
+	{
+		j_end = jt + tile_j < v_count ? jt + tile_j : v_count;
+		for (i = i_first; i < i_end; i++)
+		{
+			j_start = jt > i ? jt : i + 1;
+			if (j_start >= j_end && jt != i_first)
+				continue;
+			for (m = 0; m < 8; m++)
+			{
+				tmpX[m] = _mm256_broadcast_ss(&X[8 * i + m]);
+				tmpY[m] = _mm256_broadcast_ss(&Y[8 * i + m]);
+				tmpZ[m] = _mm256_broadcast_ss(&Z[8 * i + m]);
+				tmpQ[m] = _mm256_broadcast_ss(&Q[8 * i + m]);
+				if (forces)
+					fi[0][m] = fi[1][m] = fi[2][m] = _mm256_setzero_ps();
+			}
+
+			/* Accumulate coupling between all lower triangular elements of the diagonal 8x8 blocks */
+			if (jt == i_first)
+			{
+				xi = _mm256_load_ps(&X[8 * i]);
+				yi = _mm256_load_ps(&Y[8 * i]);
+				zi = _mm256_load_ps(&Z[8 * i]);
+				qi = _mm256_load_ps(&Q[8 * i]);
+				vcps = _mm256_setzero_ps();
+				fj[0] = fj[1] = fj[2] = _mm256_setzero_ps();
+				for (m = 0; m < 8; m++)
+				{
+					/* dx,dy,dz */
+					diff[0] = _mm256_sub_ps(tmpX[m], xi);
+					diff[1] = _mm256_sub_ps(tmpY[m], yi);
+					diff[2] = _mm256_sub_ps(tmpZ[m], zi);
+					/* dx*dx + dy*dy + dz*dz */
+					r_vec = _mm256_mul_ps(diff[0], diff[0]);
+					r_vec = _mm256_fmadd_ps(diff[1], diff[1], r_vec);
+					r_vec = _mm256_fmadd_ps(diff[2], diff[2], r_vec);
+					/* distance^-1 */
+					r_vec = rsqrt_avx2(r_vec, precision);
+					/* Q[m]*Q[i]*distance^-1 */
+					result = _mm256_mul_ps(tmpQ[m], qi);
+					result = _mm256_mul_ps(result, r_vec);
+					result = _mm256_and_ps(mask[m], result);
+					vcps = _mm256_add_ps(vcps, result);
+					if (forces)
+					{
+						/* result*distance^-2 along (dx,dy,dz), masked again as r=0 gives 0*inf */
+						result = _mm256_and_ps(mask[m], _mm256_mul_ps(result, _mm256_mul_ps(r_vec, r_vec)));
+						for (d = 0; d < 3; d++)
+						{
+							fd = _mm256_mul_ps(result, diff[d]);
+							fi[d][m] = _mm256_add_ps(fi[d][m], fd);
+							fj[d] = _mm256_sub_ps(fj[d], fd);
+						}
+					}
+				}
+				acc0 = add_ps_to_pd(acc0, vcps);
+				if (forces)
+				{
+					_mm256_store_ps(&Fx[8 * i], _mm256_add_ps(_mm256_load_ps(&Fx[8 * i]), fj[0]));
+					_mm256_store_ps(&Fy[8 * i], _mm256_add_ps(_mm256_load_ps(&Fy[8 * i]), fj[1]));
+					_mm256_store_ps(&Fz[8 * i], _mm256_add_ps(_mm256_load_ps(&Fz[8 * i]), fj[2]));
+				}
+			}
+
+			/* Accumulate coupling between all elements of lower triangular 8x8 blocks */
+			for (j = j_start; j < j_end; j++)
+			{
+				xj = _mm256_load_ps(&X[8 * j]);
+				yj = _mm256_load_ps(&Y[8 * j]);
+				zj = _mm256_load_ps(&Z[8 * j]);
+				qj = _mm256_load_ps(&Q[8 * j]);
+				vcps = _mm256_setzero_ps();
+				fj[0] = fj[1] = fj[2] = _mm256_setzero_ps();
+				for (m = 0; m < 8; m++)
+				{
+					diff[0] = _mm256_sub_ps(tmpX[m], xj);
+					diff[1] = _mm256_sub_ps(tmpY[m], yj);
+					diff[2] = _mm256_sub_ps(tmpZ[m], zj);
+
+					r_vec = _mm256_mul_ps(diff[0], diff[0]);
+					r_vec = _mm256_fmadd_ps(diff[1], diff[1], r_vec);
+					r_vec = _mm256_fmadd_ps(diff[2], diff[2], r_vec);
+					r_vec = rsqrt_avx2(r_vec, precision);
+					result = _mm256_mul_ps(tmpQ[m], qj);
+					if (forces)
+					{
+						result = _mm256_mul_ps(result, r_vec);
+						vcps = _mm256_add_ps(vcps, result);
+						result = _mm256_mul_ps(result, _mm256_mul_ps(r_vec, r_vec));
+						for (d = 0; d < 3; d++)
+						{
+							fd = _mm256_mul_ps(result, diff[d]);
+							fi[d][m] = _mm256_add_ps(fi[d][m], fd);
+							fj[d] = _mm256_sub_ps(fj[d], fd);
+						}
+					}
+					else
+						vcps = _mm256_fmadd_ps(result, r_vec, vcps);
+				}
+				if (forces)
+				{
+					_mm256_store_ps(&Fx[8 * j], _mm256_add_ps(_mm256_load_ps(&Fx[8 * j]), fj[0]));
+					_mm256_store_ps(&Fy[8 * j], _mm256_add_ps(_mm256_load_ps(&Fy[8 * j]), fj[1]));
+					_mm256_store_ps(&Fz[8 * j], _mm256_add_ps(_mm256_load_ps(&Fz[8 * j]), fj[2]));
+				}
+				/* two independent accumulators in turn, consecutive tiles do not wait for
+				   each other */
+				sum = add_ps_to_pd(acc1, vcps);
+				acc1 = acc0;
+				acc0 = sum;
+			}
+			if (forces)
+				for (m = 0; m < 8; m++)
+				{
+					Fx[8 * i + m] += hsum_avx2(fi[0][m]);
+					Fy[8 * i + m] += hsum_avx2(fi[1][m]);
+					Fz[8 * i + m] += hsum_avx2(fi[2][m]);
+				}
+		}
+	}
+	acc[0] = acc0;
+	acc[1] = acc1;
+}
+
+AVX2_INLINE double energy_avx2(const charges *c, const int precision, const long tile_i, const long tile_j,
+							   const int schedule, energy_parts *parts, const int forces, energy_forces *f)
+{
+	long v_count = c->n_pad / 8; /* number of 8-float vectors */
+	long n_blocks = (v_count + tile_i - 1) / tile_i;
+	long b, i, i_first, i_end;
+	double Energy = 0.0, t_start, t;
+	float *F = NULL;
+	int used = 1;
+
+	__m256 mask[8];
+	__m256d acc[2];
+	double tmp_add[4] __attribute__((aligned(32)));
+
+	/* mask upper triangular elements */
+	mask[0] = (__m256)_mm256_set_epi32(-1, -1, -1, -1, -1, -1, -1, 0);
+	mask[1] = (__m256)_mm256_set_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+	mask[2] = (__m256)_mm256_set_epi32(-1, -1, -1, -1, -1, 0, 0, 0);
+	mask[3] = (__m256)_mm256_set_epi32(-1, -1, -1, -1, 0, 0, 0, 0);
+	mask[4] = (__m256)_mm256_set_epi32(-1, -1, -1, 0, 0, 0, 0, 0);
+	mask[5] = (__m256)_mm256_set_epi32(-1, -1, 0, 0, 0, 0, 0, 0);
+	mask[6] = (__m256)_mm256_set_epi32(-1, 0, 0, 0, 0, 0, 0, 0);
+	mask[7] = (__m256)_mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, 0);
+
+#pragma omp parallel private(b, i, i_first, i_end, acc, tmp_add, t_start, t) firstprivate(F) reduction(+ : Energy) \
+	num_threads(forces ? f->threads : omp_get_max_threads())
+	{
+		t_start = omp_get_wtime();
+		if (forces)
+			F = energy_forces_thread(f, omp_get_thread_num());
+#pragma omp single nowait
+		used = omp_get_num_threads();
+		/* all rows of a thread are summed in the same accumulators */
+		acc[0] = _mm256_setzero_pd();
+		acc[1] = _mm256_setzero_pd();
+
+		if (schedule == SCHED_BALANCED)
+		{
+			energy_partition(v_count, omp_get_num_threads(), omp_get_thread_num(), &i_first, &i_end);
+			for (i = i_first; i < i_end; i += tile_i)
+				block_avx2(c, i, i + tile_i < i_end ? i + tile_i : i_end, tile_j, mask, acc, precision, forces, F);
+		}
+		else
+		{
+#pragma omp for schedule(dynamic) nowait
+			for (b = 0; b < n_blocks; b++)
+			{
+				i_first = b * tile_i;
+				i_end = i_first + tile_i < v_count ? i_first + tile_i : v_count;
+				block_avx2(c, i_first, i_end, tile_j, mask, acc, precision, forces, F);
+			}
+		}
+		/* one horizontal sum per thread */
+		_mm256_store_pd(tmp_add, _mm256_add_pd(acc[0], acc[1]));
+		Energy += tmp_add[0] + tmp_add[1] + tmp_add[2] + tmp_add[3];
+		t = omp_get_wtime() - t_start;
+		if (parts)
+		{
+#pragma omp critical
+			energy_parts_add_thread(parts, t);
+		}
+	}
+	if (forces)
+		energy_forces_reduce(f, c, used);
+	return Energy;
+}
+
+/* One copy of the kernel per precision and with and without forces, so that the inner
+   loop has no branches */
+AVX2 double coulomb_energy_avx2(const charges *c, const energy_opts *opts, energy_parts *parts, energy_forces *f)
+{
+	long tile_i, tile_j;
+
+	energy_tile_sizes(opts, 8, c->n_pad / 8, &tile_i, &tile_j);
+	if (parts)
+		energy_parts_clear_threads(parts);
+	if (f)
+		switch (opts->precision)
+		{
+		case PREC_RAW:
+			return energy_avx2(c, PREC_RAW, tile_i, tile_j, opts->schedule, parts, 1, f);
+		case PREC_NR2:
+			return energy_avx2(c, PREC_NR2, tile_i, tile_j, opts->schedule, parts, 1, f);
+		case PREC_EXACT:
+			return energy_avx2(c, PREC_EXACT, tile_i, tile_j, opts->schedule, parts, 1, f);
+		default:
+			return energy_avx2(c, PREC_NR1, tile_i, tile_j, opts->schedule, parts, 1, f);
+		}
+	switch (opts->precision)
+	{
+	case PREC_RAW:
+		return energy_avx2(c, PREC_RAW, tile_i, tile_j, opts->schedule, parts, 0, NULL);
+	case PREC_NR2:
+		return energy_avx2(c, PREC_NR2, tile_i, tile_j, opts->schedule, parts, 0, NULL);
+	case PREC_EXACT:
+		return energy_avx2(c, PREC_EXACT, tile_i, tile_j, opts->schedule, parts, 0, NULL);
+	default:
+		return energy_avx2(c, PREC_NR1, tile_i, tile_j, opts->schedule, parts, 0, NULL);
+	}
+}
+
+/* exp(x) for -80 < x <= 0: x = k*ln2 + r, polynomial for exp(r), 2^k put into the exponent */
+AVX2_INLINE __m256 exp_neg_avx2(__m256 x)
+{
+	__m256i k = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)));
+	__m256 r = _mm256_fnmadd_ps(_mm256_cvtepi32_ps(k), _mm256_set1_ps(0.693147181f), x);
+	__m256 p = _mm256_set1_ps(0.00138888892f);
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(0.00833333377f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(0.0416666679f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(0.166666672f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(0.5f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+	k = _mm256_slli_epi32(_mm256_add_epi32(k, _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(k));
+}
+
+/* Real-space Ewald sum of one charge with a range of the cell list, 8 charges at a time.
+   The last vector is loaded with a mask */
+AVX2 float ewald_real_range_avx2(const cell_list *cl, long j0, long j1, float xi, float yi, float zi,
+								   const float *box, float rc2, float beta)
+{
+	__m256 vxi = _mm256_set1_ps(xi), vyi = _mm256_set1_ps(yi), vzi = _mm256_set1_ps(zi);
+	__m256 bx = _mm256_set1_ps(box[0]), by = _mm256_set1_ps(box[1]), bz = _mm256_set1_ps(box[2]);
+	__m256 hbx = _mm256_set1_ps(0.5f * box[0]), hby = _mm256_set1_ps(0.5f * box[1]), hbz = _mm256_set1_ps(0.5f * box[2]);
+	__m256 nhbx = _mm256_set1_ps(-0.5f * box[0]), nhby = _mm256_set1_ps(-0.5f * box[1]), nhbz = _mm256_set1_ps(-0.5f * box[2]);
+	__m256 vrc2 = _mm256_set1_ps(rc2), vbeta = _mm256_set1_ps(beta), zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f), three = _mm256_set1_ps(3.0f);
+	__m256 two = _mm256_set1_ps(2.0f);
+	__m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256 acc = zero, dx, dy, dz, r2, rr, r_inv, br, a, t, poly, e, inside;
+	float tmp_add[8] __attribute__((aligned(32)));
+	long j;
+
+	for (j = j0; j < j1; j += 8)
+	{
+		__m256i load = _mm256_cmpgt_epi32(_mm256_set1_epi32(j1 - j < 8 ? j1 - j : 8), lane);
+		/* minimum image convention, the coordinates are wrapped into the box */
+		dx = _mm256_sub_ps(vxi, _mm256_maskload_ps(&cl->x[j], load));
+		dy = _mm256_sub_ps(vyi, _mm256_maskload_ps(&cl->y[j], load));
+		dz = _mm256_sub_ps(vzi, _mm256_maskload_ps(&cl->z[j], load));
+		dx = _mm256_add_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, nhbx, _CMP_LT_OQ), bx));
+		dx = _mm256_sub_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, hbx, _CMP_GT_OQ), bx));
+		dy = _mm256_add_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, nhby, _CMP_LT_OQ), by));
+		dy = _mm256_sub_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, hby, _CMP_GT_OQ), by));
+		dz = _mm256_add_ps(dz, _mm256_and_ps(_mm256_cmp_ps(dz, nhbz, _CMP_LT_OQ), bz));
+		dz = _mm256_sub_ps(dz, _mm256_and_ps(_mm256_cmp_ps(dz, hbz, _CMP_GT_OQ), bz));
+		r2 = _mm256_mul_ps(dx, dx);
+		r2 = _mm256_fmadd_ps(dy, dy, r2);
+		r2 = _mm256_fmadd_ps(dz, dz, r2);
+		/* pairs that count: loaded, not the charge itself, and within the cutoff */
+		inside = _mm256_and_ps(_mm256_castsi256_ps(load), _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(r2, vrc2, _CMP_LT_OQ));
+		/* the others are evaluated at the cutoff, so that nothing overflows or underflows */
+		rr = _mm256_blendv_ps(vrc2, r2, inside);
+		/* distance^-1 with one Newton-Raphson step: y = y*(3 - r2*y*y)/2 */
+		r_inv = _mm256_rsqrt_ps(rr);
+		r_inv = _mm256_mul_ps(_mm256_mul_ps(half, r_inv), _mm256_fnmadd_ps(_mm256_mul_ps(rr, r_inv), r_inv, three));
+		/* erfc(beta*r), Abramowitz and Stegun 7.1.26 */
+		br = _mm256_mul_ps(vbeta, _mm256_mul_ps(rr, r_inv));
+		/* t = 1/(1 + p*beta*r), reciprocal with one Newton-Raphson step: t = t*(2 - a*t) */
+		a = _mm256_fmadd_ps(_mm256_set1_ps(0.3275911f), br, one);
+		t = _mm256_rcp_ps(a);
+		t = _mm256_mul_ps(t, _mm256_fnmadd_ps(a, t, two));
+		poly = _mm256_set1_ps(1.061405429f);
+		poly = _mm256_fmadd_ps(poly, t, _mm256_set1_ps(-1.453152027f));
+		poly = _mm256_fmadd_ps(poly, t, _mm256_set1_ps(1.421413741f));
+		poly = _mm256_fmadd_ps(poly, t, _mm256_set1_ps(-0.284496736f));
+		poly = _mm256_fmadd_ps(poly, t, _mm256_set1_ps(0.254829592f));
+		poly = _mm256_mul_ps(poly, t);
+		e = _mm256_mul_ps(poly, exp_neg_avx2(_mm256_sub_ps(zero, _mm256_mul_ps(br, br))));
+		/* Q[j]*erfc(beta*r)/r */
+		e = _mm256_mul_ps(_mm256_mul_ps(e, r_inv), _mm256_maskload_ps(&cl->q[j], load));
+		acc = _mm256_add_ps(acc, _mm256_and_ps(inside, e));
+	}
+	_mm256_store_ps(tmp_add, acc);
+	return tmp_add[0] + tmp_add[1] + tmp_add[2] + tmp_add[3] + tmp_add[4] + tmp_add[5] + tmp_add[6] + tmp_add[7];
+}
+
+#else
+
+/* Never selected on other architectures */
+double coulomb_energy_avx2(const charges *c, const energy_opts *opts, energy_parts *parts, energy_forces *f)
+{
+	if (f)
+		return coulomb_energy_forces_scalar(c, f);
+	return coulomb_energy_omp_simd(c);
+}
+
+float ewald_real_range_avx2(const cell_list *cl, long j0, long j1, float xi, float yi, float zi,
+							const float *box, float rc2, float beta)
+{
+	return ewald_real_range_simd(cl, j0, j1, xi, yi, zi, box, rc2, beta);
+}
+
+#endif
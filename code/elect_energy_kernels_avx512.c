@@ -0,0 +1,372 @@
+/* --- File elect_energy_kernels_avx512.c --- */
+/* AVX-512 kernel of elect_energy_avx512.c working on the shared SoA charge container.
+   Only AVX-512F instructions are used; the diagonal tiles are masked with mask registers */
+#include <math.h>
+#include <omp.h>
+#include "elect_energy.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define AVX512 __attribute__((target("avx512f")))
+#define AVX512_INLINE __attribute__((target("avx512f"), always_inline)) static inline
+
+/* distance^-1 with the requested precision. _mm512_rsqrt14_ps has 14 correct bits,
+   one Newton-Raphson step y = y*(3 - r2*y*y)/2 reaches float precision */
+AVX512_INLINE __m512 rsqrt_avx512(__m512 r2, const int precision)
+{
+	__m512 y;
+
+	if (precision == PREC_EXACT)
+		return _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_sqrt_ps(r2));
+	y = _mm512_rsqrt14_ps(r2);
+	if (precision >= PREC_NR1)
+		y = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), y),
+						  _mm512_fnmadd_ps(_mm512_mul_ps(r2, y), y, _mm512_set1_ps(3.0f)));
+	if (precision >= PREC_NR2)
+		y = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), y),
+						  _mm512_fnmadd_ps(_mm512_mul_ps(r2, y), y, _mm512_set1_ps(3.0f)));
+	return y;
+}
+
+/* Add the 16 floats of v to the 8 double precision lanes of acc */
+AVX512_INLINE __m512d add_ps_to_pd(__m512d acc, __m512 v)
+{
+	__m256 hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+	acc = _mm512_add_pd(acc, _mm512_cvtps_pd(_mm512_castps512_ps256(v)));
+	return _mm512_add_pd(acc, _mm512_cvtps_pd(hi));
+}
+
+/* Rows i_first..i_end-1 against their part of the triangle, one j tile at a time. All
+   rows of the block are applied to a tile while it is in cache. The diagonal tiles are
+   done with the first j tile. Tiles are summed in float and added to the double lanes of acc.
+   With forces every pair adds q[i]*q[j]*(r[i]-r[j])/r^3 to i and subtracts it from j in the
+   thread's buffer F: the j side per tile, the i side in fi, reduced once per row and tile */
+AVX512_INLINE void block_avx512(const charges *c, const long i_first, const long i_end, const long tile_j,
+								const __mmask16 *mask, __m512d *acc, const int precision, const int forces, float *F)
+{
+	const float *X = c->x, *Y = c->y, *Z = c->z, *Q = c->q;
+	long v_count = c->n_pad / 16; /* number of 16-float vectors */
+	long i, j, jt, j_start, j_end;
+	int m;
+
+	__m512 tmpQ[16], tmpX[16], tmpY[16], tmpZ[16];
+	__m512 xi, yi, zi, qi, xj, yj, zj, qj;
+	__m512 r_vec, result, vcps, diff[3];
+	__m512 fi[3][16], fj[3], fd;
+	__m512d acc0 = acc[0], acc1 = acc[1], sum;
+	float *Fx = F, *Fy = F + c->n_pad, *Fz = F + 2 * c->n_pad;
+	int d;
+
+	for (jt = i_first; jt < v_count; jt += tile_j)
+	{
+		j_end = jt + tile_j < v_count ? jt + tile_j : v_count;
+		for (i = i_first; i < i_end; i++)
+		{
+			j_start = jt > i ? jt : i + 1;
+			if (j_start >= j_end && jt != i_first)
+				continue;
+			/* For each i prepare 16 - element X, Y, Z, and Q vectors */
+			for (m = 0; m < 16; m++)
+			{
+				tmpX[m] = _mm512_set1_ps(X[16 * i + m]);
+				tmpY[m] = _mm512_set1_ps(Y[16 * i + m]);
+				tmpZ[m] = _mm512_set1_ps(Z[16 * i + m]);
+				tmpQ[m] = _mm512_set1_ps(Q[16 * i + m]);
+				if (forces)
+					fi[0][m] = fi[1][m] = fi[2][m] = _mm512_setzero_ps();
+			}
+
+			/* Accumulate interactions within 16x16 blocks [i,i] in the vector 'vcps' */
+			if (jt == i_first)
+			{
+				xi = _mm512_load_ps(&X[16 * i]);
+				yi = _mm512_load_ps(&Y[16 * i]);
+				zi = _mm512_load_ps(&Z[16 * i]);
+				qi = _mm512_load_ps(&Q[16 * i]);
+				vcps = _mm512_setzero_ps();
+				fj[0] = fj[1] = fj[2] = _mm512_setzero_ps();
+				for (m = 0; m < 16; m++)
+				{
+					/* compute dx, dy, dz */
+					diff[0] = _mm512_sub_ps(tmpX[m], xi);
+					diff[1] = _mm512_sub_ps(tmpY[m], yi);
+					diff[2] = _mm512_sub_ps(tmpZ[m], zi);
+					/* compute dx*dx + dy*dy + dz*dz */
+					r_vec = _mm512_mul_ps(diff[0], diff[0]);
+					r_vec = _mm512_fmadd_ps(diff[1], diff[1], r_vec);
+					r_vec = _mm512_fmadd_ps(diff[2], diff[2], r_vec);
+					/* compute reciprocal distance [m][i]. Masked lanes include r=0, they are
+					   never added */
+					r_vec = rsqrt_avx512(r_vec, precision);
+					/* compute Q[m]*Q[i]/distance[m][i] */
+					result = _mm512_mul_ps(tmpQ[m], qi);
+					result = _mm512_mul_ps(result, r_vec);
+					vcps = _mm512_mask_add_ps(vcps, mask[m], vcps, result); /* Apply mask */
+					if (forces)
+					{
+						/* result*distance^-2 along (dx,dy,dz), zero in the masked lanes */
+						result = _mm512_maskz_mul_ps(mask[m], result, _mm512_mul_ps(r_vec, r_vec));
+						for (d = 0; d < 3; d++)
+						{
+							fd = _mm512_mul_ps(result, diff[d]);
+							fi[d][m] = _mm512_add_ps(fi[d][m], fd);
+							fj[d] = _mm512_sub_ps(fj[d], fd);
+						}
+					}
+				}
+				acc0 = add_ps_to_pd(acc0, vcps);
+				if (forces)
+				{
+					_mm512_store_ps(&Fx[16 * i], _mm512_add_ps(_mm512_load_ps(&Fx[16 * i]), fj[0]));
+					_mm512_store_ps(&Fy[16 * i], _mm512_add_ps(_mm512_load_ps(&Fy[16 * i]), fj[1]));
+					_mm512_store_ps(&Fz[16 * i], _mm512_add_ps(_mm512_load_ps(&Fz[16 * i]), fj[2]));
+				}
+			}
+
+			/* Accumulate interactions between different 16x16 blocks [i,j] */
+			for (j = j_start; j < j_end; j++)
+			{
+				xj = _mm512_load_ps(&X[16 * j]);
+				yj = _mm512_load_ps(&Y[16 * j]);
+				zj = _mm512_load_ps(&Z[16 * j]);
+				qj = _mm512_load_ps(&Q[16 * j]);
+				vcps = _mm512_setzero_ps();
+				fj[0] = fj[1] = fj[2] = _mm512_setzero_ps();
+				for (m = 0; m < 16; m++)
+				{
+					diff[0] = _mm512_sub_ps(tmpX[m], xj);
+					diff[1] = _mm512_sub_ps(tmpY[m], yj);
+					diff[2] = _mm512_sub_ps(tmpZ[m], zj);
+
+					r_vec = _mm512_mul_ps(diff[0], diff[0]);
+					r_vec = _mm512_fmadd_ps(diff[1], diff[1], r_vec);
+					r_vec = _mm512_fmadd_ps(diff[2], diff[2], r_vec);
+					r_vec = rsqrt_avx512(r_vec, precision);
+					result = _mm512_mul_ps(tmpQ[m], qj);
+					if (forces)
+					{
+						result = _mm512_mul_ps(result, r_vec);
+						vcps = _mm512_add_ps(vcps, result);
+						result = _mm512_mul_ps(result, _mm512_mul_ps(r_vec, r_vec));
+						for (d = 0; d < 3; d++)
+						{
+							fd = _mm512_mul_ps(result, diff[d]);
+							fi[d][m] = _mm512_add_ps(fi[d][m], fd);
+							fj[d] = _mm512_sub_ps(fj[d], fd);
+						}
+					}
+					else
+						vcps = _mm512_fmadd_ps(result, r_vec, vcps);
+				}
+				if (forces)
+				{
+					_mm512_store_ps(&Fx[16 * j], _mm512_add_ps(_mm512_load_ps(&Fx[16 * j]), fj[0]));
+					_mm512_store_ps(&Fy[16 * j], _mm512_add_ps(_mm512_load_ps(&Fy[16 * j]), fj[1]));
+					_mm512_store_ps(&Fz[16 * j], _mm512_add_ps(_mm512_load_ps(&Fz[16 * j]), fj[2]));
+				}
+				/* two independent accumulators in turn, consecutive tiles do not wait for
+				   each other */
+				sum = add_ps_to_pd(acc1, vcps);
+				acc1 = acc0;
+				acc0 = sum;
+			}
+			if (forces)
+				for (m = 0; m < 16; m++)
+				{
+					Fx[16 * i + m] += _mm512_reduce_add_ps(fi[0][m]);
+					Fy[16 * i + m] += _mm512_reduce_add_ps(fi[1][m]);
+					Fz[16 * i + m] += _mm512_reduce_add_ps(fi[2][m]);
+				}
+		}
+	}
+	acc[0] = acc0;
+	acc[1] = acc1;
+}
+
+AVX512_INLINE double energy_avx512(const charges *c, const int precision, const long tile_i, const long tile_j,
+								   const int schedule, energy_parts *parts, const int forces, energy_forces *f)
+{
+	long v_count = c->n_pad / 16; /* number of 16-float vectors */
+	long n_blocks = (v_count + tile_i - 1) / tile_i;
+	long b, i, i_first, i_end;
+	int m;
+	double Energy = 0.0, t_start, t;
+	float *F = NULL;
+	int used = 1;
+
+	__m512d acc[2];
+	__mmask16 mask[16];
+
+	/* mask upper triangular matrix elements: lanes m+1..15 of row m */
+	for (m = 0; m < 16; m++)
+		mask[m] = (__mmask16)(0xFFFF << (m + 1));
+
+#pragma omp parallel private(b, i, i_first, i_end, acc, t_start, t) firstprivate(F) reduction(+ : Energy) \
+	num_threads(forces ? f->threads : omp_get_max_threads())
+	{
+		t_start = omp_get_wtime();
+		if (forces)
+			F = energy_forces_thread(f, omp_get_thread_num());
+#pragma omp single nowait
+		used = omp_get_num_threads();
+		/* all rows of a thread are summed in the same accumulators */
+		acc[0] = _mm512_setzero_pd();
+		acc[1] = _mm512_setzero_pd();
+
+		if (schedule == SCHED_BALANCED)
+		{
+			energy_partition(v_count, omp_get_num_threads(), omp_get_thread_num(), &i_first, &i_end);
+			for (i = i_first; i < i_end; i += tile_i)
+				block_avx512(c, i, i + tile_i < i_end ? i + tile_i : i_end, tile_j, mask, acc, precision, forces, F);
+		}
+		else
+		{
+#pragma omp for schedule(dynamic) nowait
+			for (b = 0; b < n_blocks; b++)
+			{
+				i_first = b * tile_i;
+				i_end = i_first + tile_i < v_count ? i_first + tile_i : v_count;
+				block_avx512(c, i_first, i_end, tile_j, mask, acc, precision, forces, F);
+			}
+		}
+		/* one horizontal sum per thread */
+		Energy += _mm512_reduce_add_pd(_mm512_add_pd(acc[0], acc[1]));
+		t = omp_get_wtime() - t_start;
+		if (parts)
+		{
+#pragma omp critical
+			energy_parts_add_thread(parts, t);
+		}
+	}
+	if (forces)
+		energy_forces_reduce(f, c, used);
+	return Energy;
+}
+
+/* One copy of the kernel per precision and with and without forces, so that the inner
+   loop has no branches */
+AVX512 double coulomb_energy_avx512(const charges *c, const energy_opts *opts, energy_parts *parts, energy_forces *f)
+{
+	long tile_i, tile_j;
+
+	energy_tile_sizes(opts, 16, c->n_pad / 16, &tile_i, &tile_j);
+	if (parts)
+		energy_parts_clear_threads(parts);
+	if (f)
+		switch (opts->precision)
+		{
+		case PREC_RAW:
+			return energy_avx512(c, PREC_RAW, tile_i, tile_j, opts->schedule, parts, 1, f);
+		case PREC_NR2:
+			return energy_avx512(c, PREC_NR2, tile_i, tile_j, opts->schedule, parts, 1, f);
+		case PREC_EXACT:
+			return energy_avx512(c, PREC_EXACT, tile_i, tile_j, opts->schedule, parts, 1, f);
+		default:
+			return energy_avx512(c, PREC_NR1, tile_i, tile_j, opts->schedule, parts, 1, f);
+		}
+	switch (opts->precision)
+	{
+	case PREC_RAW:
+		return energy_avx512(c, PREC_RAW, tile_i, tile_j, opts->schedule, parts, 0, NULL);
+	case PREC_NR2:
+		return energy_avx512(c, PREC_NR2, tile_i, tile_j, opts->schedule, parts, 0, NULL);
+	case PREC_EXACT:
+		return energy_avx512(c, PREC_EXACT, tile_i, tile_j, opts->schedule, parts, 0, NULL);
+	default:
+		return energy_avx512(c, PREC_NR1, tile_i, tile_j, opts->schedule, parts, 0, NULL);
+	}
+}
+
+/* exp(x) for -80 < x <= 0: x = k*ln2 + r, polynomial for exp(r), 2^k put into the exponent */
+AVX512_INLINE __m512 exp_neg_avx512(__m512 x)
+{
+	__m512i k = _mm512_cvtps_epi32(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504f)));
+	__m512 r = _mm512_fnmadd_ps(_mm512_cvtepi32_ps(k), _mm512_set1_ps(0.693147181f), x);
+	__m512 p = _mm512_set1_ps(0.00138888892f);
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(0.00833333377f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(0.0416666679f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(0.166666672f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(0.5f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f));
+	k = _mm512_slli_epi32(_mm512_add_epi32(k, _mm512_set1_epi32(127)), 23);
+	return _mm512_mul_ps(p, _mm512_castsi512_ps(k));
+}
+
+/* Real-space Ewald sum of one charge with a range of the cell list, 16 charges at a time.
+   The last vector is loaded with a mask */
+AVX512 float ewald_real_range_avx512(const cell_list *cl, long j0, long j1, float xi, float yi, float zi,
+									 const float *box, float rc2, float beta)
+{
+	__m512 vxi = _mm512_set1_ps(xi), vyi = _mm512_set1_ps(yi), vzi = _mm512_set1_ps(zi);
+	__m512 bx = _mm512_set1_ps(box[0]), by = _mm512_set1_ps(box[1]), bz = _mm512_set1_ps(box[2]);
+	__m512 hbx = _mm512_set1_ps(0.5f * box[0]), hby = _mm512_set1_ps(0.5f * box[1]), hbz = _mm512_set1_ps(0.5f * box[2]);
+	__m512 nhbx = _mm512_set1_ps(-0.5f * box[0]), nhby = _mm512_set1_ps(-0.5f * box[1]), nhbz = _mm512_set1_ps(-0.5f * box[2]);
+	__m512 vrc2 = _mm512_set1_ps(rc2), vbeta = _mm512_set1_ps(beta), zero = _mm512_setzero_ps();
+	__m512 one = _mm512_set1_ps(1.0f), half = _mm512_set1_ps(0.5f), three = _mm512_set1_ps(3.0f);
+	__m512 two = _mm512_set1_ps(2.0f);
+	__m512 acc = zero, dx, dy, dz, r2, rr, r_inv, br, a, t, poly, e;
+	__mmask16 load, inside;
+	long j;
+
+	for (j = j0; j < j1; j += 16)
+	{
+		load = j1 - j < 16 ? (__mmask16)((1 << (j1 - j)) - 1) : (__mmask16)0xFFFF;
+		/* minimum image convention, the coordinates are wrapped into the box */
+		dx = _mm512_sub_ps(vxi, _mm512_maskz_loadu_ps(load, &cl->x[j]));
+		dy = _mm512_sub_ps(vyi, _mm512_maskz_loadu_ps(load, &cl->y[j]));
+		dz = _mm512_sub_ps(vzi, _mm512_maskz_loadu_ps(load, &cl->z[j]));
+		dx = _mm512_mask_add_ps(dx, _mm512_cmp_ps_mask(dx, nhbx, _CMP_LT_OQ), dx, bx);
+		dx = _mm512_mask_sub_ps(dx, _mm512_cmp_ps_mask(dx, hbx, _CMP_GT_OQ), dx, bx);
+		dy = _mm512_mask_add_ps(dy, _mm512_cmp_ps_mask(dy, nhby, _CMP_LT_OQ), dy, by);
+		dy = _mm512_mask_sub_ps(dy, _mm512_cmp_ps_mask(dy, hby, _CMP_GT_OQ), dy, by);
+		dz = _mm512_mask_add_ps(dz, _mm512_cmp_ps_mask(dz, nhbz, _CMP_LT_OQ), dz, bz);
+		dz = _mm512_mask_sub_ps(dz, _mm512_cmp_ps_mask(dz, hbz, _CMP_GT_OQ), dz, bz);
+		r2 = _mm512_mul_ps(dx, dx);
+		r2 = _mm512_fmadd_ps(dy, dy, r2);
+		r2 = _mm512_fmadd_ps(dz, dz, r2);
+		/* pairs that count: loaded, not the charge itself, and within the cutoff */
+		inside = load & _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(r2, vrc2, _CMP_LT_OQ);
+		/* the others are evaluated at the cutoff, so that nothing overflows or underflows */
+		rr = _mm512_mask_blend_ps(inside, vrc2, r2);
+		/* distance^-1 with one Newton-Raphson step: y = y*(3 - r2*y*y)/2 */
+		r_inv = _mm512_rsqrt14_ps(rr);
+		r_inv = _mm512_mul_ps(_mm512_mul_ps(half, r_inv), _mm512_fnmadd_ps(_mm512_mul_ps(rr, r_inv), r_inv, three));
+		/* erfc(beta*r), Abramowitz and Stegun 7.1.26 */
+		br = _mm512_mul_ps(vbeta, _mm512_mul_ps(rr, r_inv));
+		/* t = 1/(1 + p*beta*r), reciprocal with one Newton-Raphson step: t = t*(2 - a*t) */
+		a = _mm512_fmadd_ps(_mm512_set1_ps(0.3275911f), br, one);
+		t = _mm512_rcp14_ps(a);
+		t = _mm512_mul_ps(t, _mm512_fnmadd_ps(a, t, two));
+		poly = _mm512_set1_ps(1.061405429f);
+		poly = _mm512_fmadd_ps(poly, t, _mm512_set1_ps(-1.453152027f));
+		poly = _mm512_fmadd_ps(poly, t, _mm512_set1_ps(1.421413741f));
+		poly = _mm512_fmadd_ps(poly, t, _mm512_set1_ps(-0.284496736f));
+		poly = _mm512_fmadd_ps(poly, t, _mm512_set1_ps(0.254829592f));
+		poly = _mm512_mul_ps(poly, t);
+		e = _mm512_mul_ps(poly, exp_neg_avx512(_mm512_sub_ps(zero, _mm512_mul_ps(br, br))));
+		/* Q[j]*erfc(beta*r)/r */
+		e = _mm512_mul_ps(_mm512_mul_ps(e, r_inv), _mm512_maskz_loadu_ps(load, &cl->q[j]));
+		acc = _mm512_mask_add_ps(acc, inside, acc, e);
+	}
+	return _mm512_reduce_add_ps(acc);
+}
+
+#else
+
+/* Never selected on other architectures */
+double coulomb_energy_avx512(const charges *c, const energy_opts *opts, energy_parts *parts, energy_forces *f)
+{
+	if (f)
+		return coulomb_energy_forces_scalar(c, f);
+	return coulomb_energy_omp_simd(c);
+}
+
+float ewald_real_range_avx512(const cell_list *cl, long j0, long j1, float xi, float yi, float zi,
+							  const float *box, float rc2, float beta)
+{
+	return ewald_real_range_simd(cl, j0, j1, xi, yi, zi, box, rc2, beta);
+}
+
+#endif
@@ -0,0 +1,417 @@
+/* --- File elect_energy_lib.c --- */
+/* Charge container, CPU dispatch and the portable (scalar and omp simd) kernels */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <omp.h>
+#include "elect_energy.h"
+
+void energy_opts_default(energy_opts *opts)
+{
+	memset(opts, 0, sizeof(energy_opts));
+	opts->isa = ISA_AUTO;
+	opts->precision = PREC_NR1;
+	opts->cut_mode = CUT_TRUNCATE;
+	opts->ewald_tol = 1e-5f;
+	opts->spme_order = 4;
+}
+
+charges *charges_alloc(long n)
+{
+	charges *c = malloc(sizeof(charges));
+	size_t bytes;
+
+	c->n = n;
+	c->map = NULL;
+	c->map_bytes = 0;
+	c->n_pad = (n + CHARGES_PAD - 1) / CHARGES_PAD * CHARGES_PAD;
+	if (c->n_pad == 0)
+		c->n_pad = CHARGES_PAD;
+	/* aligned_alloc needs the size to be a multiple of the alignment */
+	bytes = c->n_pad * sizeof(float);
+	c->x = aligned_alloc(CHARGES_ALIGN, bytes);
+	c->y = aligned_alloc(CHARGES_ALIGN, bytes);
+	c->z = aligned_alloc(CHARGES_ALIGN, bytes);
+	c->q = aligned_alloc(CHARGES_ALIGN, bytes);
+	if (!c->x || !c->y || !c->z || !c->q)
+	{
+		fprintf(stderr, "charges_alloc: out of memory (%li charges)\n", n);
+		exit(1);
+	}
+	return c;
+}
+
+void charges_free(charges *c)
+{
+	if (!c)
+		return;
+	if (c->map)
+		munmap(c->map, c->map_bytes);
+	else
+	{
+		free(c->x);
+		free(c->y);
+		free(c->z);
+		free(c->q);
+	}
+	free(c);
+}
+
+/* Fill the padding with zero charges. Their x coordinates are placed outside of the
+   system and are all different, so no pairwise distance involving them is zero */
+void charges_pad(charges *c)
+{
+	long i;
+	float extent = 0.0f;
+
+	for (i = 0; i < c->n; i++)
+	{
+		extent = fmaxf(extent, fabsf(c->x[i]));
+		extent = fmaxf(extent, fabsf(c->y[i]));
+		extent = fmaxf(extent, fabsf(c->z[i]));
+	}
+	for (i = c->n; i < c->n_pad; i++)
+	{
+		c->x[i] = 2 * extent + 1 + (i - c->n);
+		c->y[i] = 0.0f;
+		c->z[i] = 0.0f;
+		c->q[i] = 0.0f;
+	}
+}
+
+/* n x n x n cubic lattice with lattice constant a and random charges between -5 and 5 */
+charges *charges_lattice(int n, float a, unsigned int seed)
+{
+	charges *c = charges_alloc((long)n * n * n);
+	int i, j, k;
+	long l = 0;
+
+	srandom(seed);
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			for (k = 0; k < n; k++)
+			{
+				c->x[l] = i * a;
+				c->y[l] = j * a;
+				c->z[l] = k * a;
+				c->q[l] = 10 * ((double)random() / (double)RAND_MAX - 0.5);
+				l++;
+			}
+	charges_pad(c);
+	return c;
+}
+
+/* Move the arrays to the memory of the threads that work on them. Pages are placed on
+   the NUMA node of the thread that writes them first, so every thread copies the rows
+   of its SCHED_BALANCED range into fresh arrays. The j tiles are still read from all
+   nodes, but the i rows, and the start of every thread's j sweep, are local */
+void charges_first_touch(charges *c, const energy_opts *opts)
+{
+	int isa = energy_select_isa(opts->isa);
+	int width = isa == ISA_AVX512 ? 16 : 8;
+	long v_count = c->n_pad / width;
+	size_t bytes = c->n_pad * sizeof(float);
+	float *x = aligned_alloc(CHARGES_ALIGN, bytes);
+	float *y = aligned_alloc(CHARGES_ALIGN, bytes);
+	float *z = aligned_alloc(CHARGES_ALIGN, bytes);
+	float *q = aligned_alloc(CHARGES_ALIGN, bytes);
+
+	if (!x || !y || !z || !q)
+	{
+		fprintf(stderr, "charges_first_touch: out of memory (%li charges)\n", c->n);
+		exit(1);
+	}
+#pragma omp parallel
+	{
+		long i_first, i_end, k;
+
+		energy_partition(v_count, omp_get_num_threads(), omp_get_thread_num(), &i_first, &i_end);
+		for (k = i_first * width; k < i_end * width; k++)
+		{
+			x[k] = c->x[k];
+			y[k] = c->y[k];
+			z[k] = c->z[k];
+			q[k] = c->q[k];
+		}
+	}
+	if (c->map)
+		munmap(c->map, c->map_bytes);
+	else
+	{
+		free(c->x);
+		free(c->y);
+		free(c->z);
+		free(c->q);
+	}
+	c->map = NULL;
+	c->x = x;
+	c->y = y;
+	c->z = z;
+	c->q = q;
+}
+
+/* __builtin_cpu_supports reads CPUID and checks that the OS saves the vector registers */
+int energy_isa_supported(int isa)
+{
+	switch (isa)
+	{
+	case ISA_SCALAR:
+	case ISA_OMP_SIMD:
+		return 1;
+#if defined(__x86_64__) || defined(__i386__)
+	case ISA_AVX2:
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case ISA_AVX512:
+		return __builtin_cpu_supports("avx512f");
+#endif
+	default:
+		return 0;
+	}
+}
+
+/* Resolve ISA_AUTO to the fastest supported kernel, and fall back if the requested
+   one cannot run on this CPU instead of crashing with SIGILL */
+int energy_select_isa(int isa)
+{
+	if (isa != ISA_AUTO && energy_isa_supported(isa))
+		return isa;
+	if (isa != ISA_AUTO)
+		fprintf(stderr, "Kernel %s is not supported by this CPU, selecting automatically\n",
+				energy_isa_name(isa));
+	if (energy_isa_supported(ISA_AVX512))
+		return ISA_AVX512;
+	if (energy_isa_supported(ISA_AVX2))
+		return ISA_AVX2;
+	return ISA_OMP_SIMD;
+}
+
+static const char *isa_names[] = {"auto", "scalar", "simd", "avx2", "avx512"};
+
+int energy_isa_from_name(const char *name)
+{
+	int i;
+	for (i = 0; i < (int)(sizeof(isa_names) / sizeof(isa_names[0])); i++)
+		if (strcasecmp(name, isa_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char *energy_isa_name(int isa)
+{
+	if (isa < 0 || isa >= (int)(sizeof(isa_names) / sizeof(isa_names[0])))
+		return "unknown";
+	return isa_names[isa];
+}
+
+static const char *cut_names[] = {"truncate", "shift", "switch"};
+
+int energy_cut_mode_from_name(const char *name)
+{
+	int i;
+	for (i = 0; i < (int)(sizeof(cut_names) / sizeof(cut_names[0])); i++)
+		if (strcasecmp(name, cut_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char *energy_cut_mode_name(int mode)
+{
+	if (mode < 0 || mode >= (int)(sizeof(cut_names) / sizeof(cut_names[0])))
+		return "unknown";
+	return cut_names[mode];
+}
+
+static const char *precision_names[] = {"raw", "nr1", "nr2", "exact"};
+
+int energy_precision_from_name(const char *name)
+{
+	int i;
+	for (i = 0; i < (int)(sizeof(precision_names) / sizeof(precision_names[0])); i++)
+		if (strcasecmp(name, precision_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char *energy_precision_name(int precision)
+{
+	if (precision < 0 || precision >= (int)(sizeof(precision_names) / sizeof(precision_names[0])))
+		return "unknown";
+	return precision_names[precision];
+}
+
+void energy_tile_sizes(const energy_opts *opts, int width, long v_count, long *tile_i, long *tile_j)
+{
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+	if (l2 <= 0)
+		l2 = 256 * 1024;
+	/* one vector of X, Y, Z and Q takes 16*width bytes */
+	*tile_j = opts->tile_j > 0 ? opts->tile_j : l2 / 2 / (16 * width);
+	*tile_i = opts->tile_i > 0 ? opts->tile_i : v_count / (4 * omp_get_max_threads());
+	if (opts->tile_i <= 0 && *tile_i > 16)
+		*tile_i = 16;
+	if (*tile_i < 1)
+		*tile_i = 1;
+	if (*tile_j < 1)
+		*tile_j = 1;
+}
+
+static const char *schedule_names[] = {"dynamic", "balanced"};
+
+int energy_schedule_from_name(const char *name)
+{
+	int i;
+	for (i = 0; i < (int)(sizeof(schedule_names) / sizeof(schedule_names[0])); i++)
+		if (strcasecmp(name, schedule_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char *energy_schedule_name(int schedule)
+{
+	if (schedule < 0 || schedule >= (int)(sizeof(schedule_names) / sizeof(schedule_names[0])))
+		return "unknown";
+	return schedule_names[schedule];
+}
+
+/* Row i of the triangle has v_count - i tiles, the rows before row i have
+   W(i) = i*v_count - i*(i-1)/2. Part p starts where W(i) = p/parts * W(v_count),
+   the smaller root of the quadratic, rounded to the nearest row */
+static long partition_start(long v_count, int parts, int p)
+{
+	double v = v_count, total = 0.5 * v * (v + 1), row;
+
+	if (p >= parts)
+		return v_count;
+	row = 0.5 * ((2 * v + 1) - sqrt((2 * v + 1) * (2 * v + 1) - 8 * total * p / parts));
+	return fmin(floor(row + 0.5), v_count);
+}
+
+void energy_partition(long v_count, int parts, int part, long *i_first, long *i_end)
+{
+	*i_first = partition_start(v_count, parts, part);
+	*i_end = partition_start(v_count, parts, part + 1);
+}
+
+void energy_parts_clear_threads(energy_parts *parts)
+{
+	parts->threads = 0;
+	parts->t_thread_min = parts->t_thread_mean = parts->t_thread_max = 0.0;
+}
+
+void energy_parts_add_thread(energy_parts *parts, double t)
+{
+	parts->threads++;
+	if (parts->threads == 1 || t < parts->t_thread_min)
+		parts->t_thread_min = t;
+	if (t > parts->t_thread_max)
+		parts->t_thread_max = t;
+	parts->t_thread_mean += (t - parts->t_thread_mean) / parts->threads;
+}
+
+double coulomb_energy(const charges *c, const energy_opts *opts)
+{
+	return coulomb_energy_parts(c, opts, NULL);
+}
+
+double coulomb_energy_parts(const charges *c, const energy_opts *opts, energy_parts *parts)
+{
+	return coulomb_energy_work(c, opts, NULL, parts);
+}
+
+double coulomb_energy_work(const charges *c, const energy_opts *opts, energy_workspace *w, energy_parts *parts)
+{
+	energy_opts defaults;
+
+	if (!opts)
+	{
+		energy_opts_default(&defaults);
+		opts = &defaults;
+	}
+	if (opts->spme)
+		return coulomb_energy_spme_work(c, opts, w, parts);
+	if (opts->cutoff > 0)
+		return coulomb_energy_cutoff_work(c, opts, w);
+	switch (energy_select_isa(opts->isa))
+	{
+	case ISA_SCALAR:
+		return coulomb_energy_scalar(c);
+	case ISA_AVX2:
+		return coulomb_energy_avx2(c, opts, parts, NULL);
+	case ISA_AVX512:
+		return coulomb_energy_avx512(c, opts, parts, NULL);
+	default:
+		return coulomb_energy_omp_simd(c);
+	}
+}
+
+/* Reference kernel, the same loop as in elect_energy_template.c */
+double coulomb_energy_scalar(const charges *c)
+{
+	const float *x = c->x, *y = c->y, *z = c->z, *q = c->q;
+	long n = c->n, i, j;
+	float dx, dy, dz, dist;
+	double Energy = 0.0;
+
+#pragma omp parallel for private(j, dx, dy, dz, dist) reduction(+ : Energy) schedule(dynamic)
+	for (i = 0; i < n; i++)
+	{
+		for (j = i + 1; j < n; j++)
+		{
+			dx = x[i] - x[j];
+			dy = y[i] - y[j];
+			dz = z[i] - z[j];
+			dist = sqrt(dx * dx + dy * dy + dz * dz);
+			Energy += q[i] * q[j] / dist;
+		}
+	}
+	return Energy;
+}
+
+/* Portable kernel: the compiler vectorizes the inner loop for whatever ISA it targets */
+double coulomb_energy_omp_simd(const charges *c)
+{
+	const float *x = c->x, *y = c->y, *z = c->z, *q = c->q;
+	long n = c->n, i, j;
+	double Energy = 0.0;
+
+#pragma omp parallel for private(j) reduction(+ : Energy) schedule(dynamic)
+	for (i = 0; i < n; i++)
+	{
+		float xi = x[i], yi = y[i], zi = z[i], qi = q[i];
+		float e = 0.0f;
+#pragma omp simd reduction(+ : e) aligned(x, y, z, q : CHARGES_ALIGN)
+		for (j = i + 1; j < n; j++)
+		{
+			float dx = xi - x[j];
+			float dy = yi - y[j];
+			float dz = zi - z[j];
+			e += q[j] / sqrtf(dx * dx + dy * dy + dz * dz);
+		}
+		Energy += qi * e;
+	}
+	return Energy;
+}
+
+energy_workspace *energy_workspace_create(void)
+{
+	return calloc(1, sizeof(energy_workspace));
+}
+
+void energy_workspace_free(energy_workspace *w)
+{
+	int d;
+
+	if (!w)
+		return;
+	cell_list_free(w->cells);
+	free(w->grid);
+	for (d = 0; d < 3; d++)
+		free(w->bsp_mod[d]);
+	free(w->lines);
+	free(w);
+}
@@ -0,0 +1,32 @@
+#!/bin/bash
+# --- File elect_energy_sweep.sh ---
+# GFLOP/s of the all-pairs Coulomb kernel over system sizes and thread counts.
+# Usage: elect_energy_sweep.sh [elect_energy binary] [extra options, e.g. -k avx2 -b 8 -t 1024]
+# The thread counts run from 1 up to the number of cores in powers of two; MAX_THREADS
+# overrides the top, e.g. MAX_THREADS=64 for a node the script does not run on, and more
+# threads than cores share them and do not measure scaling.
+# Threads are pinned with OMP_PROC_BIND=close, OMP_PLACES=cores. SIZES overrides the list of n.
+prog=${1:-./elect_energy}
+shift
+max_threads=${MAX_THREADS:-$(nproc)}
+
+threads=""
+for ((t = 1; t < max_threads; t *= 2)); do
+	threads="$threads $t"
+done
+threads="$threads $max_threads"
+
+export OMP_PROC_BIND=close OMP_PLACES=cores
+printf "%6s" "n"
+for t in $threads; do
+	printf "%9s" "${t}T"
+done
+printf "\n"
+for n in ${SIZES:-20 40 60 80 100 120}; do
+	printf "%6d" $n
+	for t in $threads; do
+		gflops=$(OMP_NUM_THREADS=$t $prog -n $n -r 3 "$@" | awk '/GFLOP/ {print $1}')
+		printf "%9s" "$gflops"
+	done
+	printf "\n"
+done
@@ -0,0 +1,191 @@
+/* --- File laplace2d.h --- */
+/* Jacobi relaxation engine for the heat equation of laplace2d_template.c */
+#ifndef LAPLACE2D_H
+#define LAPLACE2D_H
+
+/* Rows are padded to 16 floats (64 bytes, one AVX-512 vector) and aligned to 64 bytes */
+#define GRID_PAD 16
+#define GRID_ALIGN 64
+
+/* An n x m mesh in one allocation, boundary rows and columns included. Element (j, i)
+   is data[j * pitch + i] */
+typedef struct
+{
+	int n;		 /* number of rows */
+	int m;		 /* number of columns */
+	long pitch;	 /* floats per row, a multiple of GRID_PAD */
+	float *data; /* n * pitch floats */
+} grid;
+
+#define GRID_ROW(g, j) ((g)->data + (long)(j) * (g)->pitch)
+
+/* Jacobi kernels */
+enum laplace_kernel
+{
+	KERNEL_ROWS = 0,  /* one sweep at a time, the rows shared by the threads */
+	KERNEL_TILED,	  /* one sweep at a time, tile by tile */
+	KERNEL_WAVEFRONT  /* 'steps' sweeps per tile with a wavefront through the rows */
+};
+
+/* Solvers. All of them stop when the largest change a Jacobi sweep would make, the
+   residual (sum of the neighbours)/4 + f - u, is below tol */
+enum laplace_solver
+{
+	SOLVER_JACOBI = 0, /* Jacobi sweeps with the kernel of opts */
+	SOLVER_GS,		   /* red-black Gauss-Seidel */
+	SOLVER_SOR,		   /* red-black successive over-relaxation */
+	SOLVER_MG,		   /* geometric multigrid V-cycles */
+	SOLVER_FMG		   /* full multigrid, followed by V-cycles */
+};
+
+typedef struct
+{
+	int solver;	  /* one of enum laplace_solver */
+	int kernel;	  /* one of enum laplace_kernel */
+	int tile_j;	  /* rows per tile */
+	int tile_i;	  /* columns per tile */
+	int steps;	  /* sweeps fused per tile by KERNEL_WAVEFRONT */
+	int check;	  /* test for convergence every 'check' sweeps */
+	float omega;  /* over-relaxation factor of SOLVER_SOR, 0 means the optimum for the mesh */
+	int pre;	  /* multigrid smoothing sweeps before the coarse grid correction */
+	int post;	  /* and after it */
+	int iter_max; /* maximum number of sweeps, or cycles of the multigrid solvers */
+	float tol;	  /* stop when no residual is above tol */
+} laplace_opts;
+
+/* Rows or columns of a multigrid level against those of the finer one. Fine point j lies
+   between coarse points below[j] and below[j] + 1, at frac[j] of the way; coarse point J
+   gets the residual of fine points first[J] to last[J] */
+typedef struct
+{
+	int *below;
+	float *frac;
+	int *first, *last;
+} mg_axis;
+
+/* Levels of the geometric multigrid solver. Every level halves the number of intervals
+   of the one above, rounded up, down to two or three interior rows and columns */
+typedef struct
+{
+	int levels;		  /* number of levels, the finest included */
+	int pre, post;	  /* smoothing sweeps */
+	grid **u, **g, **r; /* correction, right-hand side and residual of every level; u[0] and
+						   g[0] are not used, the finest level is the caller's u and f */
+	grid **t;			/* level l transferred in one direction only: its rows, the columns
+						   of level l - 1 */
+	mg_axis *rows, *cols; /* of level l against level l - 1, l >= 1 */
+} multigrid;
+
+typedef struct laplace_comm laplace_comm;
+
+/* Block of a mesh decomposed over pr x pc ranks. The local grids have a ring of halo
+   points around the owned ones, filled from the neighbours or holding the boundary */
+typedef struct
+{
+	laplace_comm *comm;
+	int pr, pc;			 /* process grid, rank = row * pc + column */
+	int j0, i0;			 /* global row and column of local point (1, 1) */
+	int ln, lm;			 /* owned rows and columns */
+	int peer[4];		 /* ranks above, below, left and right, -1 at the boundary */
+	grid *u, *u_new, *f; /* (ln + 2) x (lm + 2) */
+	float *send[4], *recv[4];
+	int count[4];
+} domain;
+
+void laplace_opts_default(laplace_opts *opts);
+int laplace_kernel_from_name(const char *name);
+const char *laplace_kernel_name(int kernel);
+int laplace_solver_from_name(const char *name);
+const char *laplace_solver_name(int solver);
+
+/* Zeroed grid, first touched by the threads that sweep its rows with schedule(static).
+   Exits when out of memory */
+grid *grid_alloc(int n, int m);
+void grid_free(grid *g);
+
+/* 'sweeps' Jacobi sweeps u_new = (sum of the four neighbours in u)/4 + f starting from *u.
+   The grids are swapped after every sweep, or every batch of up to opts->steps sweeps
+   fused by KERNEL_WAVEFRONT, so that on return *u holds the result. Boundaries are never
+   written, both grids must have the same. Returns the largest change of a point in the
+   last sweep, computed in the same pass; the other sweeps do not compute it */
+float laplace_jacobi(grid **u, grid **u_new, const grid *f, const laplace_opts *opts, int sweeps);
+/* Columns [i0, i1) of row j of a Jacobi sweep, for callers that schedule the rows
+   themselves. Returns the largest change if check is set */
+float laplace_jacobi_row(const grid *u, grid *u_new, const grid *f, int j, int i0, int i1, int check);
+
+/* 'sweeps' red-black sweeps in place, every point moves by omega times its residual: red
+   points (i + j even) first, then black ones with the new red values. omega = 1 is
+   Gauss-Seidel. With check set returns the largest residual met in the last sweep,
+   otherwise 0 */
+float laplace_sor(grid *u, const grid *f, float omega, int sweeps, int check);
+/* Optimal omega for an n x m mesh, from the convergence rate of Jacobi */
+float laplace_sor_omega(int n, int m);
+/* Jacobi, Gauss-Seidel or SOR sweeps according to opts->solver, like laplace_jacobi */
+float laplace_relax(grid **u, grid **u_new, const grid *f, const laplace_opts *opts, int sweeps);
+
+/* Geometric multigrid, see laplace2d_multigrid.c */
+multigrid *mg_alloc(int n, int m, const laplace_opts *opts);
+void mg_free(multigrid *mg);
+/* One V-cycle on u. Returns the largest residual after it */
+float mg_vcycle(multigrid *mg, grid *u, const grid *f);
+/* Full multigrid: u from the solution of the coarsest level, interpolated to every finer
+   level and improved there by one V-cycle. Returns the largest residual */
+float mg_fmg(multigrid *mg, grid *u, const grid *f);
+/* Largest residual of u, written into r if it is not NULL */
+float laplace_residual(const grid *u, const grid *f, grid *r);
+
+/* Fields on disk, see laplace2d_io.c */
+enum laplace_codec
+{
+	CODEC_NONE = 0, /* raw floats behind the header */
+	CODEC_DEFLATE	/* chunks filtered and compressed with zlib */
+};
+
+typedef struct checkpointer checkpointer;
+
+int laplace_codec_from_name(const char *name);
+/* u with its iteration and error. The chunks are encoded and written by all threads if
+   parallel is set, by the calling thread otherwise. Returns 0, or -1 on errors */
+int field_write(const char *path, const grid *u, long iteration, float error, int codec, int parallel);
+/* The field of a file written by field_write, NULL on errors */
+grid *field_read(const char *path, long *iteration, float *error);
+/* Checkpoints of an n x m field written in the background. checkpoint_start copies u,
+   then returns while a writer thread writes the copy; it first waits for the write
+   before, if that is still going on. Both return the status of the previous write,
+   checkpoint_finish after waiting for the last one */
+checkpointer *checkpoint_create(const char *path, int n, int m, int codec);
+int checkpoint_start(checkpointer *cp, const grid *u, long iteration, float error);
+int checkpoint_finish(checkpointer *cp);
+void checkpoint_free(checkpointer *cp);
+
+/* Ranks of a decomposed mesh (laplace2d_comm.c). comm_init starts MPI, or without MPI
+   forks 'ranks' processes that share halo mailboxes of halo_max floats; it must come
+   before the first OpenMP parallel region. comm_finish ends every rank but rank 0, which
+   gets the exit status. comm_set_active is called by all ranks and limits the collective
+   operations that follow to ranks 0..active-1, it returns whether this rank is one of them */
+laplace_comm *comm_init(int *argc, char ***argv, int ranks, int halo_max);
+int comm_finish(laplace_comm *c, int status);
+int comm_rank(const laplace_comm *c);
+int comm_size(const laplace_comm *c);
+int comm_active(const laplace_comm *c);
+int comm_set_active(laplace_comm *c, int active);
+/* Non-blocking exchange with the peers in the four directions (up, down, left, right),
+   send[d] goes to peer[d] and recv[d] comes from it. Peers below 0 are skipped. Only the
+   master thread may call these */
+void comm_exchange_start(laplace_comm *c, const int *peer, float *const *send, float *const *recv, const int *count);
+void comm_exchange_wait(laplace_comm *c);
+double comm_max(laplace_comm *c, double x);
+void comm_barrier(laplace_comm *c);
+
+/* The n x m mesh cut into blocks of rows and columns, one per active rank
+   (laplace2d_domain.c). The grids of the block are zero */
+domain *domain_create(laplace_comm *comm, int n, int m);
+/* pr x pc ranks with the smallest halo per rank for n x m interior points */
+void domain_process_grid(int ranks, int n, int m, int *pr, int *pc);
+void domain_free(domain *d);
+/* 'sweeps' Jacobi sweeps of the whole mesh. The halos are exchanged while the points
+   that do not need them are computed. Returns the largest change of the last sweep over
+   all ranks */
+float domain_jacobi(domain *d, int sweeps);
+
+#endif
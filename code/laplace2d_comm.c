@@ -0,0 +1,316 @@
+/* --- File laplace2d_comm.c --- */
+/* Communication between the ranks of a decomposed laplace2d mesh. Built with mpicc and
+   -DLAPLACE_MPI the ranks are MPI processes. Otherwise comm_init forks the ranks on this
+   node and they exchange their halos through shared memory: every rank has a mailbox per
+   direction with two slots, used by alternate exchanges. The sender copies its halo into
+   the slot and then publishes the exchange number, the receiver waits for the number.
+   A sender can only be one exchange ahead of its receiver, so two slots are enough */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "laplace2d.h"
+#ifdef LAPLACE_MPI
+#include <mpi.h>
+#endif
+
+#ifdef LAPLACE_MPI
+
+struct laplace_comm
+{
+	int rank, size, active;
+	MPI_Comm comm; /* the active ranks */
+	MPI_Request req[8];
+	int requests;
+};
+
+laplace_comm *comm_init(int *argc, char ***argv, int ranks, int halo_max)
+{
+	laplace_comm *c = malloc(sizeof(laplace_comm));
+	int provided;
+
+	/* the ranks come from mpirun and MPI buffers the halos itself */
+	(void)ranks;
+	(void)halo_max;
+	/* only the master thread of a rank communicates */
+	MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_rank(MPI_COMM_WORLD, &c->rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &c->size);
+	c->active = c->size;
+	MPI_Comm_dup(MPI_COMM_WORLD, &c->comm);
+	c->requests = 0;
+	return c;
+}
+
+int comm_finish(laplace_comm *c, int status)
+{
+	if (c->comm != MPI_COMM_NULL)
+		MPI_Comm_free(&c->comm);
+	MPI_Finalize();
+	free(c);
+	return status;
+}
+
+int comm_set_active(laplace_comm *c, int active)
+{
+	if (c->comm != MPI_COMM_NULL)
+		MPI_Comm_free(&c->comm);
+	MPI_Comm_split(MPI_COMM_WORLD, c->rank < active ? 0 : MPI_UNDEFINED, c->rank, &c->comm);
+	c->active = active;
+	return c->rank < active;
+}
+
+void comm_exchange_start(laplace_comm *c, const int *peer, float *const *send, float *const *recv, const int *count)
+{
+	int d;
+
+	c->requests = 0;
+	for (d = 0; d < 4; d++)
+		if (peer[d] >= 0)
+		{
+			MPI_Irecv(recv[d], count[d], MPI_FLOAT, peer[d], d, c->comm, &c->req[c->requests++]);
+			/* what leaves in direction d arrives from direction d ^ 1 */
+			MPI_Isend(send[d], count[d], MPI_FLOAT, peer[d], d ^ 1, c->comm, &c->req[c->requests++]);
+		}
+}
+
+void comm_exchange_wait(laplace_comm *c)
+{
+	MPI_Waitall(c->requests, c->req, MPI_STATUSES_IGNORE);
+	c->requests = 0;
+}
+
+double comm_max(laplace_comm *c, double x)
+{
+	double y;
+
+	MPI_Allreduce(&x, &y, 1, MPI_DOUBLE, MPI_MAX, c->comm);
+	return y;
+}
+
+void comm_barrier(laplace_comm *c)
+{
+	MPI_Barrier(c->comm);
+}
+
+#else
+
+#define LINE 64
+
+/* Barrier without state in the ranks, so that a subset of the ranks can use it */
+typedef struct
+{
+	int count;
+	int generation;
+	char pad[LINE - 2 * sizeof(int)];
+} shm_barrier;
+
+typedef struct
+{
+	long seq; /* exchange that filled the slot */
+	char pad[LINE - sizeof(long)];
+} mailbox_head;
+
+/* The shared mapping holds the header, two rows of comm->size values for comm_max and
+   the mailboxes */
+typedef struct
+{
+	shm_barrier all, active;
+} shm_header;
+
+struct laplace_comm
+{
+	int rank, size, active;
+	int halo_max;	 /* floats per mailbox slot */
+	char *shared;	 /* the shared mapping */
+	size_t bytes;	 /* its length */
+	long epoch;		 /* comm_set_active calls, keeps the exchange numbers of phases apart */
+	long exchanges;	 /* exchanges in this phase */
+	long reductions; /* comm_max calls */
+	/* receives of the exchange in progress */
+	int pending[4];
+	float *recv[4];
+	int count[4];
+};
+
+static shm_header *header(const laplace_comm *c)
+{
+	return (shm_header *)c->shared;
+}
+
+static double *reduce_row(const laplace_comm *c, int row)
+{
+	return (double *)(c->shared + sizeof(shm_header)) + row * c->size;
+}
+
+static size_t mailbox_bytes(const laplace_comm *c)
+{
+	return sizeof(mailbox_head) + ((size_t)c->halo_max * sizeof(float) + LINE - 1) / LINE * LINE;
+}
+
+/* Offset of slot 'slot' of the mailbox of rank 'rank' for direction d */
+static size_t mailbox_offset(const laplace_comm *c, int rank, int d, int slot)
+{
+	size_t start = (sizeof(shm_header) + 2 * c->size * sizeof(double) + LINE - 1) / LINE * LINE;
+
+	return start + ((size_t)(rank * 4 + d) * 2 + slot) * mailbox_bytes(c);
+}
+
+static mailbox_head *mailbox(const laplace_comm *c, int rank, int d, int slot)
+{
+	return (mailbox_head *)(c->shared + mailbox_offset(c, rank, d, slot));
+}
+
+/* Spin for a short while, then give the core to the other ranks */
+static void backoff(int *spins)
+{
+	if (++*spins > 100)
+		sched_yield();
+}
+
+static void barrier_wait(shm_barrier *b, int parties)
+{
+	int generation = __atomic_load_n(&b->generation, __ATOMIC_ACQUIRE), spins = 0;
+
+	if (__atomic_add_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == parties)
+	{
+		__atomic_store_n(&b->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&b->generation, generation + 1, __ATOMIC_RELEASE);
+		return;
+	}
+	while (__atomic_load_n(&b->generation, __ATOMIC_ACQUIRE) == generation)
+		backoff(&spins);
+}
+
+/* Must be called before the first OpenMP parallel region, the thread pool of a process
+   does not survive fork */
+laplace_comm *comm_init(int *argc, char ***argv, int ranks, int halo_max)
+{
+	laplace_comm *c = malloc(sizeof(laplace_comm));
+	int r;
+
+	/* MPI's arguments, no use for forked ranks */
+	(void)argc;
+	(void)argv;
+	memset(c, 0, sizeof(laplace_comm));
+	c->size = c->active = ranks;
+	c->halo_max = halo_max;
+	c->bytes = mailbox_offset(c, ranks, 0, 0);
+	c->shared = mmap(NULL, c->bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (c->shared == MAP_FAILED)
+	{
+		perror("comm_init");
+		exit(1);
+	}
+	fflush(stdout);
+	for (r = 1; r < ranks; r++)
+		if (fork() == 0)
+		{
+			c->rank = r;
+			break;
+		}
+	return c;
+}
+
+/* The other ranks exit, rank 0 returns the first nonzero exit status of all of them */
+int comm_finish(laplace_comm *c, int status)
+{
+	int r, child;
+
+	fflush(stdout);
+	if (c->rank != 0)
+		_exit(status);
+	for (r = 1; r < c->size; r++)
+		if (wait(&child) > 0 && status == 0)
+			status = WIFEXITED(child) ? WEXITSTATUS(child) : 1;
+	munmap(c->shared, c->bytes);
+	free(c);
+	return status;
+}
+
+int comm_set_active(laplace_comm *c, int active)
+{
+	barrier_wait(&header(c)->all, c->size);
+	c->active = active;
+	c->epoch++;
+	c->exchanges = 0;
+	c->reductions = 0;
+	return c->rank < active;
+}
+
+void comm_exchange_start(laplace_comm *c, const int *peer, float *const *send, float *const *recv, const int *count)
+{
+	long seq = (c->epoch << 32) | ++c->exchanges;
+	int d, slot = c->exchanges % 2;
+	mailbox_head *box;
+
+	for (d = 0; d < 4; d++)
+	{
+		c->pending[d] = peer[d] >= 0;
+		if (peer[d] < 0)
+			continue;
+		c->recv[d] = recv[d];
+		c->count[d] = count[d];
+		box = mailbox(c, peer[d], d ^ 1, slot);
+		memcpy(box + 1, send[d], count[d] * sizeof(float));
+		__atomic_store_n(&box->seq, seq, __ATOMIC_RELEASE);
+	}
+}
+
+void comm_exchange_wait(laplace_comm *c)
+{
+	long seq = (c->epoch << 32) | c->exchanges;
+	int d, spins = 0, slot = c->exchanges % 2;
+	mailbox_head *box;
+
+	for (d = 0; d < 4; d++)
+	{
+		if (!c->pending[d])
+			continue;
+		box = mailbox(c, c->rank, d, slot);
+		while (__atomic_load_n(&box->seq, __ATOMIC_ACQUIRE) != seq)
+			backoff(&spins);
+		memcpy(c->recv[d], box + 1, c->count[d] * sizeof(float));
+		c->pending[d] = 0;
+	}
+}
+
+/* Every rank writes its value, the barrier makes them visible. The next call uses the
+   other row, which no rank still reads: they have all passed the barrier of that call */
+double comm_max(laplace_comm *c, double x)
+{
+	double *slot = reduce_row(c, c->reductions++ % 2);
+	int r;
+
+	slot[c->rank] = x;
+	barrier_wait(&header(c)->active, c->active);
+	for (r = 0; r < c->active; r++)
+		if (slot[r] > x)
+			x = slot[r];
+	return x;
+}
+
+void comm_barrier(laplace_comm *c)
+{
+	barrier_wait(&header(c)->active, c->active);
+}
+
+#endif
+
+int comm_rank(const laplace_comm *c)
+{
+	return c->rank;
+}
+
+int comm_size(const laplace_comm *c)
+{
+	return c->size;
+}
+
+int comm_active(const laplace_comm *c)
+{
+	return c->active;
+}
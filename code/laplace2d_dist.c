@@ -0,0 +1,202 @@
+/* --- File laplace2d_dist.c --- */
+/* Driver for the decomposed laplace2d solver: the Jacobi relaxation of laplace2d_main.c
+   with the mesh cut into one block per rank and the threads of every rank working on its
+   block.
+
+   With MPI:
+   mpicc -O3 -fopenmp -DLAPLACE_MPI -o laplace2d_dist laplace2d_dist.c laplace2d_domain.c \
+       laplace2d_comm.c laplace2d_lib.c laplace2d_multigrid.c -lm
+   mpirun -np 4 -x OMP_NUM_THREADS=8 ./laplace2d_dist
+   On one node without MPI, the ranks are processes forked by the program:
+   gcc -O3 -fopenmp -o laplace2d_dist laplace2d_dist.c laplace2d_domain.c laplace2d_comm.c \
+       laplace2d_lib.c laplace2d_multigrid.c -lm
+   OMP_NUM_THREADS=8 ./laplace2d_dist -P 4
+
+   Usage: laplace2d_dist [-n rows] [-m columns] [-i iter_max] [-e tol] [-c check]
+                         [-P ranks] [-B strong|weak]
+   The ranks form the process grid with the least halo per rank. The error log and the
+   number of sweeps are those of laplace2d_main.c -S jacobi.
+   -B strong runs -i sweeps (default 100) of the n x m mesh on 1, 2, 4, ... ranks up to all
+   of them and reports the efficiency T(1) / (p T(p)). -B weak gives every rank an n x m
+   block instead, the mesh grows with the ranks, and reports T(1) / T(p). The ranks that
+   are not used wait. For a 32768 x 32768 mesh use -B strong -n 32768 -m 32768, or
+   -B weak -n 4098 -m 4098 on 64 ranks; it takes 12 GB for the three grids. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <omp.h>
+#include "laplace2d.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n rows] [-m columns] [-i iter_max] [-e tol] [-c check]\n"
+					"       [-P ranks] [-B strong|weak]\n",
+			prog);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The point heat source of laplace2d_main.c, in the block that owns it */
+static void set_source(domain *d, int j, int i, float h)
+{
+	if (j >= d->j0 && j < d->j0 + d->ln && i >= d->i0 && i < d->i0 + d->lm)
+		GRID_ROW(d->f, j - d->j0 + 1)[i - d->i0 + 1] = h;
+}
+
+static void solve(laplace_comm *comm, int n, int m, const laplace_opts *opts, float h)
+{
+	domain *d = domain_create(comm, n, m);
+	int iter = 0, sweeps, next_check, rank = comm_rank(comm);
+	float error = 1.0f;
+	double t_start, t;
+
+	set_source(d, n / 2, m / 2, h);
+	if (rank == 0)
+		printf("%d x %d mesh on %d ranks (%d x %d) of %d threads, convergence test every %d sweeps\n", n, m,
+			   comm_active(comm), d->pr, d->pc, omp_get_max_threads(), opts->check);
+	comm_barrier(comm);
+	t_start = now();
+	while (error > opts->tol && iter < opts->iter_max)
+	{
+		next_check = (iter + opts->check - 1) / opts->check * opts->check;
+		if (next_check > (iter + 199) / 200 * 200)
+			next_check = (iter + 199) / 200 * 200;
+		sweeps = next_check - iter + 1;
+		if (sweeps > opts->iter_max - iter)
+			sweeps = opts->iter_max - iter;
+		error = domain_jacobi(d, sweeps);
+		iter += sweeps;
+		if ((iter - 1) % 200 == 0 && rank == 0)
+			printf("%5d, %0.6e, %10.4f s\n", iter - 1, error, now() - t_start);
+	}
+	t = comm_max(comm, now() - t_start);
+	if (rank == 0)
+	{
+		printf("\nTotal relaxation time is %f sec, %d iterations, %s\n", t, iter,
+			   error > opts->tol ? "not converged" : "converged");
+		printf("%.1f MLUP/s\n", (double)(n - 2) * (m - 2) * iter / t * 1e-6);
+	}
+	domain_free(d);
+}
+
+/* Time of 'sweeps' sweeps of the mesh on the active ranks, the slowest rank counts */
+static double time_sweeps(laplace_comm *comm, int n, int m, int sweeps, int *pr, int *pc)
+{
+	domain *d = domain_create(comm, n, m);
+	double t;
+
+	*pr = d->pr;
+	*pc = d->pc;
+	set_source(d, n / 2, m / 2, 0.05f);
+	/* one sweep to start the threads and fault in the pages */
+	domain_jacobi(d, 1);
+	comm_barrier(comm);
+	t = now();
+	domain_jacobi(d, sweeps);
+	t = comm_max(comm, now() - t);
+	domain_free(d);
+	return t;
+}
+
+static void scaling(laplace_comm *comm, int n, int m, int sweeps, int weak)
+{
+	int p, pr, pc, ng, mg, size = comm_size(comm), rank = comm_rank(comm);
+	double t, t1 = 0;
+
+	if (rank == 0)
+		printf("%s scaling, %d sweeps, %d threads per rank, %s %d x %d\n\n%6s %9s %13s %10s %10s %8s\n",
+			   weak ? "Weak" : "Strong", sweeps, omp_get_max_threads(), weak ? "blocks of" : "mesh", n, m, "ranks",
+			   "grid", "mesh", "time (s)", "MLUP/s", "eff.");
+	for (p = 1; p <= size; p = p < size && 2 * p > size ? size : 2 * p)
+	{
+		ng = n;
+		mg = m;
+		if (weak)
+		{
+			/* p blocks of n x m points, as square a mesh as possible */
+			for (pr = 1; pr * pr * (n - 2) < p * (m - 2) && p % (2 * pr) == 0; pr *= 2)
+				;
+			pc = p / pr;
+			ng = pr * (n - 2) + 2;
+			mg = pc * (m - 2) + 2;
+		}
+		if (comm_set_active(comm, p))
+		{
+			t = time_sweeps(comm, ng, mg, sweeps, &pr, &pc);
+			if (p == 1)
+				t1 = t;
+			if (rank == 0)
+				printf("%6d %4d x %-4d %6d x %-6d %10.4f %10.1f %7.1f%%\n", p, pr, pc, ng, mg, t,
+					   (double)(ng - 2) * (mg - 2) * sweeps / t * 1e-6, 100 * (weak ? t1 / t : t1 / (p * t)));
+		}
+		if (p == size)
+			break;
+	}
+	comm_set_active(comm, size);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, n = 2048, m = 2048, ranks = 1, bench = 0, sweeps_given = 0;
+	float h = 0.05; /* Instantaneous heat */
+	laplace_opts opts;
+	laplace_comm *comm;
+
+	laplace_opts_default(&opts);
+	while ((opt = getopt(argc, argv, "n:m:i:e:c:P:B:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'm':
+			m = atoi(optarg);
+			break;
+		case 'i':
+			opts.iter_max = atoi(optarg);
+			sweeps_given = 1;
+			break;
+		case 'e':
+			opts.tol = atof(optarg);
+			break;
+		case 'c':
+			opts.check = atoi(optarg);
+			break;
+		case 'P':
+			ranks = atoi(optarg);
+			break;
+		case 'B':
+			bench = strcmp(optarg, "strong") == 0 ? 1 : strcmp(optarg, "weak") == 0 ? 2 : -1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (n < 3 || m < 3 || opts.check < 1 || opts.iter_max < 0 || ranks < 1 || bench < 0)
+		usage(argv[0]);
+	if (bench && !sweeps_given)
+		opts.iter_max = 100;
+
+	comm = comm_init(&argc, &argv, ranks, n > m ? n : m);
+	if (comm_size(comm) > (n - 2) * (m - 2))
+	{
+		if (comm_rank(comm) == 0)
+			fprintf(stderr, "%d ranks for %d points\n", comm_size(comm), (n - 2) * (m - 2));
+		return comm_finish(comm, 1);
+	}
+	if (bench)
+		scaling(comm, n, m, opts.iter_max, bench == 2);
+	else
+		solve(comm, n, m, &opts, h);
+	return comm_finish(comm, 0);
+}
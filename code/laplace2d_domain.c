@@ -0,0 +1,166 @@
+/* --- File laplace2d_domain.c --- */
+/* Jacobi relaxation of a mesh decomposed into blocks over the ranks of a laplace_comm.
+   Every sweep sends the outer rows and columns of the block to the neighbours and, while
+   they are on their way, computes the points that do not need the halo. The master thread
+   of the rank waits for the halos and then joins the other threads on the remaining
+   interior rows; the rows and columns next to the halo follow after a barrier */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "laplace2d.h"
+
+/* pr x pc ranks with the smallest halo per rank for n x m interior points */
+void domain_process_grid(int ranks, int n, int m, int *pr, int *pc)
+{
+	int r, best = -1, cost;
+
+	*pr = 1;
+	*pc = ranks;
+	for (r = 1; r <= ranks; r++)
+	{
+		if (ranks % r != 0 || r > n || ranks / r > m)
+			continue;
+		cost = (n + r - 1) / r + (m + ranks / r - 1) / (ranks / r);
+		if (best < 0 || cost < best)
+		{
+			best = cost;
+			*pr = r;
+			*pc = ranks / r;
+		}
+	}
+}
+
+/* Points [*first, *first + *count) of 'total' for part p of 'parts' */
+static void split(int total, int parts, int p, int *first, int *count)
+{
+	*count = total / parts + (p < total % parts);
+	*first = p * (total / parts) + (p < total % parts ? p : total % parts);
+}
+
+domain *domain_create(laplace_comm *comm, int n, int m)
+{
+	domain *d = malloc(sizeof(domain));
+	int rank = comm_rank(comm), r, c, dir, len;
+
+	d->comm = comm;
+	domain_process_grid(comm_active(comm), n - 2, m - 2, &d->pr, &d->pc);
+	r = rank / d->pc;
+	c = rank % d->pc;
+	split(n - 2, d->pr, r, &d->j0, &d->ln);
+	split(m - 2, d->pc, c, &d->i0, &d->lm);
+	d->j0++;
+	d->i0++;
+	d->peer[0] = r > 0 ? rank - d->pc : -1;
+	d->peer[1] = r < d->pr - 1 ? rank + d->pc : -1;
+	d->peer[2] = c > 0 ? rank - 1 : -1;
+	d->peer[3] = c < d->pc - 1 ? rank + 1 : -1;
+	d->count[0] = d->count[1] = d->lm;
+	d->count[2] = d->count[3] = d->ln;
+
+	/* each rank allocates and first touches its own block */
+	d->u = grid_alloc(d->ln + 2, d->lm + 2);
+	d->u_new = grid_alloc(d->ln + 2, d->lm + 2);
+	d->f = grid_alloc(d->ln + 2, d->lm + 2);
+	len = d->ln > d->lm ? d->ln : d->lm;
+	for (dir = 0; dir < 4; dir++)
+	{
+		d->send[dir] = malloc(len * sizeof(float));
+		d->recv[dir] = malloc(len * sizeof(float));
+	}
+	return d;
+}
+
+void domain_free(domain *d)
+{
+	int dir;
+
+	if (!d)
+		return;
+	grid_free(d->u);
+	grid_free(d->u_new);
+	grid_free(d->f);
+	for (dir = 0; dir < 4; dir++)
+	{
+		free(d->send[dir]);
+		free(d->recv[dir]);
+	}
+	free(d);
+}
+
+/* The outer rows and columns of u into the send buffers */
+static void pack(domain *d)
+{
+	int j;
+
+	if (d->peer[0] >= 0)
+		memcpy(d->send[0], GRID_ROW(d->u, 1) + 1, d->lm * sizeof(float));
+	if (d->peer[1] >= 0)
+		memcpy(d->send[1], GRID_ROW(d->u, d->ln) + 1, d->lm * sizeof(float));
+	for (j = 0; j < d->ln; j++)
+	{
+		d->send[2][j] = GRID_ROW(d->u, j + 1)[1];
+		d->send[3][j] = GRID_ROW(d->u, j + 1)[d->lm];
+	}
+}
+
+/* The received halos into the ring of u. At the boundary the ring is not written */
+static void unpack(domain *d)
+{
+	int j;
+
+	if (d->peer[0] >= 0)
+		memcpy(GRID_ROW(d->u, 0) + 1, d->recv[0], d->lm * sizeof(float));
+	if (d->peer[1] >= 0)
+		memcpy(GRID_ROW(d->u, d->ln + 1) + 1, d->recv[1], d->lm * sizeof(float));
+	for (j = 0; j < d->ln; j++)
+	{
+		if (d->peer[2] >= 0)
+			GRID_ROW(d->u, j + 1)[0] = d->recv[2][j];
+		if (d->peer[3] >= 0)
+			GRID_ROW(d->u, j + 1)[d->lm + 1] = d->recv[3][j];
+	}
+}
+
+float domain_jacobi(domain *d, int sweeps)
+{
+	int k, j, check, ln = d->ln, lm = d->lm;
+	float error = 0.f;
+	grid *tmp;
+
+	for (k = 0; k < sweeps; k++)
+	{
+		check = k == sweeps - 1;
+		pack(d);
+		comm_exchange_start(d->comm, d->peer, d->send, d->recv, d->count);
+		error = 0.f;
+#pragma omp parallel private(j) reduction(max : error)
+		{
+#pragma omp master
+			{
+				comm_exchange_wait(d->comm);
+				unpack(d);
+			}
+			/* the points two or more away from the halo */
+#pragma omp for schedule(dynamic, 8) nowait
+			for (j = 2; j < ln; j++)
+				error = fmaxf(error, laplace_jacobi_row(d->u, d->u_new, d->f, j, 2, lm, check));
+#pragma omp barrier
+			/* the first and last row and column */
+#pragma omp for schedule(static)
+			for (j = 1; j <= ln; j++)
+				if (j == 1 || j == ln)
+					error = fmaxf(error, laplace_jacobi_row(d->u, d->u_new, d->f, j, 1, lm + 1, check));
+				else
+				{
+					error = fmaxf(error, laplace_jacobi_row(d->u, d->u_new, d->f, j, 1, 2, check));
+					if (lm > 1)
+						error = fmaxf(error, laplace_jacobi_row(d->u, d->u_new, d->f, j, lm, lm + 1, check));
+				}
+		}
+		tmp = d->u;
+		d->u = d->u_new;
+		d->u_new = tmp;
+	}
+	return comm_max(d->comm, error);
+}
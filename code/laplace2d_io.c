@@ -0,0 +1,410 @@
+/* --- File laplace2d_io.c --- */
+/* Result fields and checkpoints of the laplace2d engine on disk. The format is
+
+     bytes 0..63    header: magic "LAPFIELD", int32 n, int32 m, int32 dtype, int32 codec,
+                    int32 chunk_rows, int32 chunks, int64 iteration, double error, zeros
+     codec none     float u[n][m], little endian, boundary included
+     codec deflate  int64 offset[chunks], int64 bytes[chunks], then the chunks
+
+   A chunk is chunk_rows rows of the mesh (the last one fewer). Every point of a deflate
+   chunk is XORed with the point above it in the chunk, which leaves mostly zero high bits
+   in a smooth field, then the bytes are grouped by significance and compressed with zlib.
+   The chunks are encoded and written by all threads at once, each one at the next free
+   offset of the file, so they are in no particular order. An uncompressed field is the
+   raw array of laplace2d_template.c behind the header: ParaView reads it as raw binary
+   with a header size of 64 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "laplace2d.h"
+
+#define FIELD_MAGIC "LAPFIELD"
+#define FIELD_HEADER 64
+#define FIELD_FLOAT32 1
+/* Rows per chunk, chosen so that a chunk holds about 1 MB */
+#define CHUNK_FLOATS (1 << 18)
+
+typedef struct
+{
+	char magic[8];
+	int32_t n, m, dtype, codec, chunk_rows, chunks;
+	int64_t iteration;
+	double error;
+	char unused[FIELD_HEADER - 8 - 6 * sizeof(int32_t) - sizeof(int64_t) - sizeof(double)];
+} field_header;
+
+static const char *codec_names[] = {"none", "deflate"};
+
+int laplace_codec_from_name(const char *name)
+{
+	int c;
+
+	for (c = 0; c < 2; c++)
+		if (strcmp(name, codec_names[c]) == 0)
+			return c;
+	return -1;
+}
+
+/* Rows [r0, r1) of u, XORed with the row above and split into byte planes, into out.
+   Returns the compressed length, 0 if zlib fails */
+static size_t encode_chunk(const grid *u, int r0, int r1, uint8_t *plane, uint8_t *out, size_t out_max)
+{
+	size_t count = (size_t)(r1 - r0) * u->m, k = 0, b;
+	uLongf len = out_max;
+	uint32_t x, above;
+	int j, i;
+
+	for (j = r0; j < r1; j++)
+		for (i = 0; i < u->m; i++, k++)
+		{
+			memcpy(&x, GRID_ROW(u, j) + i, 4);
+			above = 0;
+			if (j > r0)
+				memcpy(&above, GRID_ROW(u, j - 1) + i, 4);
+			x ^= above;
+			for (b = 0; b < 4; b++)
+				plane[b * count + k] = x >> (8 * b);
+		}
+	if (compress2(out, &len, plane, 4 * count, 1) != Z_OK)
+		return 0;
+	return len;
+}
+
+/* The inverse of encode_chunk. Returns 0, or -1 if the chunk is damaged */
+static int decode_chunk(grid *u, int r0, int r1, uint8_t *plane, const uint8_t *in, size_t in_len)
+{
+	size_t count = (size_t)(r1 - r0) * u->m, k = 0, b;
+	uLongf len = 4 * count;
+	uint32_t x, above;
+	int j, i;
+
+	if (uncompress(plane, &len, in, in_len) != Z_OK || len != 4 * count)
+		return -1;
+	for (j = r0; j < r1; j++)
+		for (i = 0; i < u->m; i++, k++)
+		{
+			x = 0;
+			for (b = 0; b < 4; b++)
+				x |= (uint32_t)plane[b * count + k] << (8 * b);
+			above = 0;
+			if (j > r0)
+				memcpy(&above, GRID_ROW(u, j - 1) + i, 4);
+			x ^= above;
+			memcpy(GRID_ROW(u, j) + i, &x, 4);
+		}
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t offset)
+{
+	ssize_t done;
+
+	while (len > 0)
+	{
+		done = pwrite(fd, buf, len, offset);
+		if (done <= 0)
+			return -1;
+		buf = (const char *)buf + done;
+		len -= done;
+		offset += done;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t done;
+
+	while (len > 0)
+	{
+		done = pread(fd, buf, len, offset);
+		if (done <= 0)
+			return -1;
+		buf = (char *)buf + done;
+		len -= done;
+		offset += done;
+	}
+	return 0;
+}
+
+int field_write(const char *path, const grid *u, long iteration, float error, int codec, int parallel)
+{
+	field_header h;
+	int fd, c, r0, r1, failed = 0;
+	int chunk_rows = u->m >= CHUNK_FLOATS ? 1 : CHUNK_FLOATS / u->m;
+	int chunks = (u->n + chunk_rows - 1) / chunk_rows;
+	int64_t *table = NULL;
+	off_t next;
+	size_t raw_max = (size_t)chunk_rows * u->m * sizeof(float);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, FIELD_MAGIC, 8);
+	h.n = u->n;
+	h.m = u->m;
+	h.dtype = FIELD_FLOAT32;
+	h.codec = codec;
+	h.chunk_rows = chunk_rows;
+	h.chunks = chunks;
+	h.iteration = iteration;
+	h.error = error;
+	next = FIELD_HEADER;
+	if (codec == CODEC_DEFLATE)
+	{
+		table = calloc(2 * chunks, sizeof(int64_t));
+		next += 2 * chunks * sizeof(int64_t);
+	}
+
+#pragma omp parallel private(c, r0, r1) if (parallel)
+	{
+		uint8_t *raw = malloc(raw_max), *out = NULL;
+		size_t out_max = compressBound(raw_max), len;
+		off_t offset;
+		int j;
+
+		if (codec == CODEC_DEFLATE)
+			out = malloc(out_max);
+#pragma omp for schedule(dynamic)
+		for (c = 0; c < chunks; c++)
+		{
+			r0 = c * chunk_rows;
+			r1 = r0 + chunk_rows < u->n ? r0 + chunk_rows : u->n;
+			if (codec == CODEC_NONE)
+			{
+				/* the rows without their padding */
+				for (j = r0; j < r1; j++)
+					memcpy(raw + (size_t)(j - r0) * u->m * sizeof(float), GRID_ROW(u, j), u->m * sizeof(float));
+				len = (size_t)(r1 - r0) * u->m * sizeof(float);
+				if (write_all(fd, raw, len, FIELD_HEADER + (off_t)r0 * u->m * sizeof(float)) < 0)
+				{
+#pragma omp atomic write
+					failed = 1;
+				}
+				continue;
+			}
+			len = encode_chunk(u, r0, r1, raw, out, out_max);
+#pragma omp atomic capture
+			{
+				offset = next;
+				next += len;
+			}
+			table[c] = offset;
+			table[chunks + c] = len;
+			if (len == 0 || write_all(fd, out, len, offset) < 0)
+			{
+#pragma omp atomic write
+				failed = 1;
+			}
+		}
+		free(raw);
+		free(out);
+	}
+
+	if (!failed && table)
+		failed = write_all(fd, table, 2 * chunks * sizeof(int64_t), FIELD_HEADER) < 0;
+	if (!failed)
+		failed = write_all(fd, &h, sizeof(h), 0) < 0;
+	free(table);
+	if (close(fd) < 0 || failed)
+	{
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+grid *field_read(const char *path, long *iteration, float *error)
+{
+	field_header h;
+	struct stat st;
+	grid *u;
+	int fd, c, failed = 0;
+	int64_t *table = NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || read_all(fd, &h, sizeof(h), 0) < 0)
+	{
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+	if (memcmp(h.magic, FIELD_MAGIC, 8) != 0 || h.dtype != FIELD_FLOAT32 || h.n < 3 || h.m < 3 ||
+		h.chunk_rows < 1 || h.chunks != (h.n + h.chunk_rows - 1) / h.chunk_rows ||
+		(h.codec == CODEC_NONE && st.st_size != (off_t)(FIELD_HEADER + (off_t)h.n * h.m * sizeof(float))) ||
+		(h.codec != CODEC_NONE && h.codec != CODEC_DEFLATE))
+	{
+		fprintf(stderr, "%s: not a laplace2d field\n", path);
+		close(fd);
+		return NULL;
+	}
+	if (h.codec == CODEC_DEFLATE)
+	{
+		table = malloc(2 * h.chunks * sizeof(int64_t));
+		if (read_all(fd, table, 2 * h.chunks * sizeof(int64_t), FIELD_HEADER) < 0)
+			failed = 1;
+		for (c = 0; c < h.chunks && !failed; c++)
+			if (table[c] < FIELD_HEADER || table[h.chunks + c] <= 0 || table[c] + table[h.chunks + c] > st.st_size)
+				failed = 1;
+		if (failed)
+		{
+			fprintf(stderr, "%s: damaged laplace2d field\n", path);
+			free(table);
+			close(fd);
+			return NULL;
+		}
+	}
+	u = grid_alloc(h.n, h.m);
+
+#pragma omp parallel private(c)
+	{
+		size_t raw_max = (size_t)h.chunk_rows * h.m * sizeof(float);
+		uint8_t *raw = malloc(raw_max), *in = NULL;
+		size_t in_max = 0;
+		int j, r0, r1;
+
+#pragma omp for schedule(dynamic)
+		for (c = 0; c < h.chunks; c++)
+		{
+			r0 = c * h.chunk_rows;
+			r1 = r0 + h.chunk_rows < h.n ? r0 + h.chunk_rows : h.n;
+			if (h.codec == CODEC_NONE)
+			{
+				if (read_all(fd, raw, (size_t)(r1 - r0) * h.m * sizeof(float),
+							 FIELD_HEADER + (off_t)r0 * h.m * sizeof(float)) < 0)
+				{
+#pragma omp atomic write
+					failed = 1;
+					continue;
+				}
+				for (j = r0; j < r1; j++)
+					memcpy(GRID_ROW(u, j), raw + (size_t)(j - r0) * h.m * sizeof(float), h.m * sizeof(float));
+				continue;
+			}
+			if ((size_t)table[h.chunks + c] > in_max)
+			{
+				in_max = table[h.chunks + c];
+				in = realloc(in, in_max);
+			}
+			if (read_all(fd, in, table[h.chunks + c], table[c]) < 0 ||
+				decode_chunk(u, r0, r1, raw, in, table[h.chunks + c]) < 0)
+			{
+#pragma omp atomic write
+				failed = 1;
+			}
+		}
+		free(raw);
+		free(in);
+	}
+
+	free(table);
+	close(fd);
+	if (failed)
+	{
+		fprintf(stderr, "%s: damaged laplace2d field\n", path);
+		grid_free(u);
+		return NULL;
+	}
+	if (iteration)
+		*iteration = h.iteration;
+	if (error)
+		*error = h.error;
+	return u;
+}
+
+/* Asynchronous checkpoints. The field is copied into a snapshot on the calling threads,
+   a writer thread then writes the copy to a temporary file and renames it over the
+   checkpoint, so that a crash during the write leaves the previous checkpoint intact */
+struct checkpointer
+{
+	char *path, *tmp_path;
+	int codec;
+	grid *snap;
+	long iteration;
+	float error;
+	pthread_t thread;
+	int busy;	/* the writer thread is running */
+	int status; /* of the last write */
+};
+
+checkpointer *checkpoint_create(const char *path, int n, int m, int codec)
+{
+	checkpointer *cp = malloc(sizeof(checkpointer));
+
+	cp->path = strdup(path);
+	cp->tmp_path = malloc(strlen(path) + 5);
+	sprintf(cp->tmp_path, "%s.tmp", path);
+	cp->codec = codec;
+	cp->snap = grid_alloc(n, m);
+	cp->busy = 0;
+	cp->status = 0;
+	return cp;
+}
+
+static void *checkpoint_thread(void *arg)
+{
+	checkpointer *cp = arg;
+
+	cp->status = field_write(cp->tmp_path, cp->snap, cp->iteration, cp->error, cp->codec, 0);
+	if (cp->status == 0 && rename(cp->tmp_path, cp->path) < 0)
+	{
+		perror(cp->path);
+		cp->status = -1;
+	}
+	return NULL;
+}
+
+int checkpoint_finish(checkpointer *cp)
+{
+	if (cp->busy)
+	{
+		pthread_join(cp->thread, NULL);
+		cp->busy = 0;
+	}
+	return cp->status;
+}
+
+int checkpoint_start(checkpointer *cp, const grid *u, long iteration, float error)
+{
+	int j, status = checkpoint_finish(cp);
+
+#pragma omp parallel for schedule(static)
+	for (j = 0; j < u->n; j++)
+		memcpy(GRID_ROW(cp->snap, j), GRID_ROW(u, j), u->m * sizeof(float));
+	cp->iteration = iteration;
+	cp->error = error;
+	if (pthread_create(&cp->thread, NULL, checkpoint_thread, cp) != 0)
+	{
+		/* no thread, write it here */
+		checkpoint_thread(cp);
+		return status ? status : cp->status;
+	}
+	cp->busy = 1;
+	return status;
+}
+
+void checkpoint_free(checkpointer *cp)
+{
+	if (!cp)
+		return;
+	checkpoint_finish(cp);
+	grid_free(cp->snap);
+	free(cp->path);
+	free(cp->tmp_path);
+	free(cp);
+}
@@ -0,0 +1,382 @@
+/* --- File laplace2d_lib.c --- */
+/* Grid and Jacobi kernels of the laplace2d engine. All kernels compute every point the
+   same way as laplace2d_template.c, the results are identical to the last bit */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "laplace2d.h"
+
+static const char *kernel_names[] = {"rows", "tiled", "wavefront"};
+static const char *solver_names[] = {"jacobi", "gs", "sor", "mg", "fmg"};
+
+void laplace_opts_default(laplace_opts *opts)
+{
+	memset(opts, 0, sizeof(laplace_opts));
+	opts->kernel = KERNEL_WAVEFRONT;
+	opts->tile_j = 128;
+	opts->tile_i = 512;
+	opts->steps = 8;
+	opts->check = 16;
+	opts->pre = 2;
+	opts->post = 2;
+	opts->iter_max = 10000;
+	opts->tol = 1e-6f;
+}
+
+int laplace_kernel_from_name(const char *name)
+{
+	int k;
+
+	for (k = 0; k < 3; k++)
+		if (strcmp(name, kernel_names[k]) == 0)
+			return k;
+	return -1;
+}
+
+const char *laplace_kernel_name(int kernel)
+{
+	return kernel >= 0 && kernel < 3 ? kernel_names[kernel] : "unknown";
+}
+
+int laplace_solver_from_name(const char *name)
+{
+	int s;
+
+	for (s = 0; s < 5; s++)
+		if (strcmp(name, solver_names[s]) == 0)
+			return s;
+	return -1;
+}
+
+const char *laplace_solver_name(int solver)
+{
+	return solver >= 0 && solver < 5 ? solver_names[solver] : "unknown";
+}
+
+grid *grid_alloc(int n, int m)
+{
+	grid *g = malloc(sizeof(grid));
+	int j;
+
+	g->n = n;
+	g->m = m;
+	g->pitch = (m + GRID_PAD - 1) / GRID_PAD * GRID_PAD;
+	/* rows a multiple of 4 KB apart fall into the same cache sets, the rows above and
+	   below a point would evict each other */
+	if (g->pitch % 1024 == 0)
+		g->pitch += GRID_PAD;
+	g->data = aligned_alloc(GRID_ALIGN, n * g->pitch * sizeof(float));
+	if (!g->data)
+	{
+		fprintf(stderr, "grid_alloc: out of memory (%d x %d)\n", n, m);
+		exit(1);
+	}
+	/* the first touch places the pages: every row on the NUMA node of the thread that
+	   sweeps it with schedule(static) */
+#pragma omp parallel for schedule(static)
+	for (j = 0; j < n; j++)
+		memset(GRID_ROW(g, j), 0, g->pitch * sizeof(float));
+	return g;
+}
+
+void grid_free(grid *g)
+{
+	if (!g)
+		return;
+	free(g->data);
+	free(g);
+}
+
+/* The size of a change or residual d for the max reductions. fmaxf drops a NaN, and a
+   field that has blown up would look converged; a NaN counts as infinite instead */
+static inline float change(float d)
+{
+	return d == d ? fabsf(d) : INFINITY;
+}
+
+/* len points of one row of a sweep: out from the rows up, mid and dn of the previous one.
+   Returns the largest change */
+static inline float jacobi_row(float *restrict out, const float *restrict up, const float *restrict mid,
+							   const float *restrict dn, const float *restrict f, int len)
+{
+	float error = 0.f;
+	int i;
+
+#pragma omp simd reduction(max : error)
+	for (i = 0; i < len; i++)
+	{
+		out[i] = 0.25f * (mid[i + 1] + mid[i - 1] + up[i] + dn[i]) + f[i];
+		error = fmaxf(error, change(out[i] - mid[i]));
+	}
+	return error;
+}
+
+/* The same for the sweeps without a convergence test */
+static inline void jacobi_row_update(float *restrict out, const float *restrict up, const float *restrict mid,
+									 const float *restrict dn, const float *restrict f, int len)
+{
+	int i;
+
+#pragma omp simd
+	for (i = 0; i < len; i++)
+		out[i] = 0.25f * (mid[i + 1] + mid[i - 1] + up[i] + dn[i]) + f[i];
+}
+
+float laplace_jacobi_row(const grid *u, grid *u_new, const grid *f, int j, int i0, int i1, int check)
+{
+	if (check)
+		return jacobi_row(GRID_ROW(u_new, j) + i0, GRID_ROW(u, j - 1) + i0, GRID_ROW(u, j) + i0, GRID_ROW(u, j + 1) + i0,
+						  GRID_ROW(f, j) + i0, i1 - i0);
+	jacobi_row_update(GRID_ROW(u_new, j) + i0, GRID_ROW(u, j - 1) + i0, GRID_ROW(u, j) + i0, GRID_ROW(u, j + 1) + i0,
+					  GRID_ROW(f, j) + i0, i1 - i0);
+	return 0.f;
+}
+
+/* The kernels compute the largest change only if check is set, and return 0 otherwise */
+static float sweep_rows(const grid *u, grid *u_new, const grid *f, int check)
+{
+	int j, len = u->m - 2;
+	float error = 0.f;
+
+#pragma omp parallel for reduction(max : error) schedule(static)
+	for (j = 1; j < u->n - 1; j++)
+		if (check)
+			error = fmaxf(error, jacobi_row(GRID_ROW(u_new, j) + 1, GRID_ROW(u, j - 1) + 1, GRID_ROW(u, j) + 1,
+											GRID_ROW(u, j + 1) + 1, GRID_ROW(f, j) + 1, len));
+		else
+			jacobi_row_update(GRID_ROW(u_new, j) + 1, GRID_ROW(u, j - 1) + 1, GRID_ROW(u, j) + 1, GRID_ROW(u, j + 1) + 1,
+							  GRID_ROW(f, j) + 1, len);
+	return error;
+}
+
+/* The interior cut into tiles of tile_j rows and tile_i columns, handed out statically */
+static float sweep_tiled(const grid *u, grid *u_new, const grid *f, int tile_j, int tile_i, int check)
+{
+	int bj, bi, j, j_end, i_end;
+	float error = 0.f;
+
+#pragma omp parallel for collapse(2) private(j, j_end, i_end) reduction(max : error) schedule(static)
+	for (bj = 1; bj < u->n - 1; bj += tile_j)
+		for (bi = 1; bi < u->m - 1; bi += tile_i)
+		{
+			j_end = bj + tile_j < u->n - 1 ? bj + tile_j : u->n - 1;
+			i_end = bi + tile_i < u->m - 1 ? bi + tile_i : u->m - 1;
+			for (j = bj; j < j_end; j++)
+				if (check)
+					error = fmaxf(error, jacobi_row(GRID_ROW(u_new, j) + bi, GRID_ROW(u, j - 1) + bi, GRID_ROW(u, j) + bi,
+													GRID_ROW(u, j + 1) + bi, GRID_ROW(f, j) + bi, i_end - bi));
+				else
+					jacobi_row_update(GRID_ROW(u_new, j) + bi, GRID_ROW(u, j - 1) + bi, GRID_ROW(u, j) + bi,
+									  GRID_ROW(u, j + 1) + bi, GRID_ROW(f, j) + bi, i_end - bi);
+		}
+	return error;
+}
+
+/* Row r of level t of a wavefront tile, at column col. Level 0 and the boundary rows are
+   those of u, levels 1..steps-1 are rings of three rows in buf, which starts at column off */
+static inline float *level_row(const grid *u, float *buf, long width, long off, int t, int r, int col)
+{
+	if (t == 0 || r == 0 || r == u->n - 1)
+		return GRID_ROW(u, r) + col;
+	return buf + ((t - 1) * 3 + r % 3) * width + (col - off);
+}
+
+/* 'steps' sweeps of the tile of rows [r0, r1) and columns [c0, c1), the last one into
+   u_new. Level t is computed on the tile grown by steps - t points on every side, so that
+   each tile needs only u: the overlap is computed by both neighbours. Row r of level t is
+   computed at step r + t - 1, right after row r + 1 of level t - 1, while the three rows
+   it needs are in cache. u and f are read once for all steps. Only the last level can
+   compute the largest change */
+static float wavefront_tile(const grid *u, grid *u_new, const grid *f, int steps, int r0, int r1, int c0, int c1,
+							float *buf, long width, int check)
+{
+	int n = u->n, m = u->m, t, r, s, lo, hi, clo, chi;
+	long off = c0 - steps;
+	float *out, error = 0.f;
+
+	for (s = r0 - steps + 1 > 1 ? r0 - steps + 1 : 1; s < r1 + steps - 1; s++)
+		for (t = 1; t <= steps; t++)
+		{
+			r = s - (t - 1);
+			lo = r0 - (steps - t) > 1 ? r0 - (steps - t) : 1;
+			hi = r1 + (steps - t) < n - 1 ? r1 + (steps - t) : n - 1;
+			if (r < lo || r >= hi)
+				continue;
+			clo = c0 - (steps - t) > 1 ? c0 - (steps - t) : 1;
+			chi = c1 + (steps - t) < m - 1 ? c1 + (steps - t) : m - 1;
+			if (t == steps && check)
+			{
+				error = fmaxf(error, jacobi_row(GRID_ROW(u_new, r) + clo, level_row(u, buf, width, off, t - 1, r - 1, clo),
+												level_row(u, buf, width, off, t - 1, r, clo),
+												level_row(u, buf, width, off, t - 1, r + 1, clo), GRID_ROW(f, r) + clo, chi - clo));
+				continue;
+			}
+			out = t == steps ? GRID_ROW(u_new, r) + clo : level_row(u, buf, width, off, t, r, clo);
+			jacobi_row_update(out, level_row(u, buf, width, off, t - 1, r - 1, clo), level_row(u, buf, width, off, t - 1, r, clo),
+					   level_row(u, buf, width, off, t - 1, r + 1, clo), GRID_ROW(f, r) + clo, chi - clo);
+			if (t == steps)
+				continue;
+			/* the next level reads the boundary columns next to the row */
+			if (clo == 1)
+				out[-1] = GRID_ROW(u, r)[0];
+			if (chi == m - 1)
+				out[chi - clo] = GRID_ROW(u, r)[m - 1];
+		}
+	return error;
+}
+
+static float sweep_wavefront(const grid *u, grid *u_new, const grid *f, int tile_j, int tile_i, int steps, int check)
+{
+	int bj, bi, j_end, i_end;
+	long width = (tile_i + 2 * steps + GRID_PAD - 1) / GRID_PAD * GRID_PAD;
+	/* aligned_alloc needs the size to be a multiple of the alignment */
+	size_t bytes = ((steps > 1 ? steps - 1 : 1) * 3 * width * sizeof(float) + GRID_ALIGN - 1) / GRID_ALIGN * GRID_ALIGN;
+	float *buf, error = 0.f;
+
+#pragma omp parallel private(buf)
+	{
+		buf = aligned_alloc(GRID_ALIGN, bytes);
+		if (!buf)
+		{
+			fprintf(stderr, "sweep_wavefront: out of memory (%zu bytes per thread)\n", bytes);
+			exit(1);
+		}
+#pragma omp for collapse(2) private(j_end, i_end) reduction(max : error) schedule(static)
+		for (bj = 1; bj < u->n - 1; bj += tile_j)
+			for (bi = 1; bi < u->m - 1; bi += tile_i)
+			{
+				j_end = bj + tile_j < u->n - 1 ? bj + tile_j : u->n - 1;
+				i_end = bi + tile_i < u->m - 1 ? bi + tile_i : u->m - 1;
+				error = fmaxf(error, wavefront_tile(u, u_new, f, steps, bj, j_end, bi, i_end, buf, width, check));
+			}
+		free(buf);
+	}
+	return error;
+}
+
+float laplace_jacobi(grid **u, grid **u_new, const grid *f, const laplace_opts *opts, int sweeps)
+{
+	int k, steps, batches, last;
+	float error = 0.f;
+	grid *tmp;
+
+	/* the wavefront does the sweeps in batches of at most opts->steps, as even as possible */
+	batches = opts->kernel == KERNEL_WAVEFRONT ? (sweeps + opts->steps - 1) / opts->steps : sweeps;
+	for (k = 0; k < batches; k++)
+	{
+		steps = sweeps / batches + (k < sweeps % batches);
+		last = k == batches - 1;
+		switch (opts->kernel)
+		{
+		case KERNEL_ROWS:
+			error = sweep_rows(*u, *u_new, f, last);
+			break;
+		case KERNEL_TILED:
+			error = sweep_tiled(*u, *u_new, f, opts->tile_j, opts->tile_i, last);
+			break;
+		default:
+			error = sweep_wavefront(*u, *u_new, f, opts->tile_j, opts->tile_i, steps, last);
+		}
+		tmp = *u;
+		*u = *u_new;
+		*u_new = tmp;
+	}
+	return error;
+}
+
+/* One colour of a red-black sweep, the points with (i + j) % 2 == colour. Small grids of
+   the multigrid solver are done by one thread */
+static float sor_colour(grid *u, const grid *f, float omega, int colour, int check)
+{
+	int j, i, m = u->m;
+	float *row, d, error = 0.f;
+	const float *up, *dn, *fr;
+
+#pragma omp parallel for private(i, row, up, dn, fr, d) reduction(max : error) schedule(static) if (u->n > 64)
+	for (j = 1; j < u->n - 1; j++)
+	{
+		row = GRID_ROW(u, j);
+		up = GRID_ROW(u, j - 1);
+		dn = GRID_ROW(u, j + 1);
+		fr = GRID_ROW(f, j);
+		if (check)
+		{
+#pragma omp simd reduction(max : error)
+			for (i = 1 + (j + 1 + colour) % 2; i < m - 1; i += 2)
+			{
+				d = 0.25f * (row[i + 1] + row[i - 1] + up[i] + dn[i]) + fr[i] - row[i];
+				row[i] += omega * d;
+				error = fmaxf(error, change(d));
+			}
+		}
+		else
+		{
+#pragma omp simd
+			for (i = 1 + (j + 1 + colour) % 2; i < m - 1; i += 2)
+				row[i] += omega * (0.25f * (row[i + 1] + row[i - 1] + up[i] + dn[i]) + fr[i] - row[i]);
+		}
+	}
+	return error;
+}
+
+float laplace_sor(grid *u, const grid *f, float omega, int sweeps, int check)
+{
+	int k;
+	float error = 0.f;
+
+	for (k = 0; k < sweeps; k++)
+	{
+		error = sor_colour(u, f, omega, 0, check && k == sweeps - 1);
+		error = fmaxf(error, sor_colour(u, f, omega, 1, check && k == sweeps - 1));
+	}
+	return error;
+}
+
+/* rho is the spectral radius of the Jacobi iteration for a mesh spacing of 1/(n-1) by
+   1/(m-1) */
+float laplace_sor_omega(int n, int m)
+{
+	double rho = 0.5 * (cos(M_PI / (n - 1)) + cos(M_PI / (m - 1)));
+
+	return 2.0 / (1.0 + sqrt(1.0 - rho * rho));
+}
+
+float laplace_relax(grid **u, grid **u_new, const grid *f, const laplace_opts *opts, int sweeps)
+{
+	switch (opts->solver)
+	{
+	case SOLVER_GS:
+		return laplace_sor(*u, f, 1.0f, sweeps, 1);
+	case SOLVER_SOR:
+		return laplace_sor(*u, f, opts->omega > 0 ? opts->omega : laplace_sor_omega((*u)->n, (*u)->m), sweeps, 1);
+	default:
+		return laplace_jacobi(u, u_new, f, opts, sweeps);
+	}
+}
+
+float laplace_residual(const grid *u, const grid *f, grid *r)
+{
+	int j, i, m = u->m;
+	const float *row, *up, *dn, *fr;
+	float *rr, d, error = 0.f;
+
+#pragma omp parallel for private(i, row, up, dn, fr, rr, d) reduction(max : error) schedule(static) if (u->n > 64)
+	for (j = 1; j < u->n - 1; j++)
+	{
+		row = GRID_ROW(u, j);
+		up = GRID_ROW(u, j - 1);
+		dn = GRID_ROW(u, j + 1);
+		fr = GRID_ROW(f, j);
+		rr = r ? GRID_ROW(r, j) : NULL;
+#pragma omp simd reduction(max : error)
+		for (i = 1; i < m - 1; i++)
+		{
+			d = 0.25f * (row[i + 1] + row[i - 1] + up[i] + dn[i]) + fr[i] - row[i];
+			if (rr)
+				rr[i] = d;
+			error = fmaxf(error, change(d));
+		}
+	}
+	return error;
+}
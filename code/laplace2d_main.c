@@ -0,0 +1,268 @@
+/* --- File laplace2d_main.c --- */
+/* Driver for the laplace2d engine: the Jacobi relaxation of laplace2d_template.c on
+   contiguous grids with cache-blocked kernels, and faster solvers of the same equation.
+
+   gcc -O3 -fopenmp -o laplace2d laplace2d_main.c laplace2d_lib.c laplace2d_multigrid.c \
+       laplace2d_io.c -lm -lz -lpthread
+
+   Usage: laplace2d [-n rows] [-m columns] [-i iter_max] [-e tol] [-S jacobi|gs|sor|mg|fmg]
+                    [-k rows|tiled|wavefront] [-b tile_rows] [-t tile_columns] [-s steps]
+                    [-c check] [-w omega] [-v smoothing_sweeps] [-o output] [-z none|deflate]
+                    [-K checkpoint_every] [-C checkpoint] [-r restart]
+   -k rows shares the rows of every sweep among the threads, like laplace2d_omp_acc.c.
+   -k tiled sweeps the mesh in tiles of -b rows and -t columns. -k wavefront (the default)
+   does -s sweeps per tile: every tile grows by -s points on each side, and the sweeps
+   follow each other through its rows, so the tile is read from memory once for -s sweeps
+   instead of once per sweep. The points next to the tile edges are computed by both
+   tiles, a fraction of about s/b + s/t of the work. On a 2048 x 2048 mesh the three
+   grids take 48 MB and one sweep at a time is bound by memory bandwidth. On one core,
+   400 sweeps of it run at 180 MLUP/s with -k rows and at 700 MLUP/s with the default
+   128 x 512 tiles and 8 steps.
+   The two grids swap roles after every sweep, nothing is copied back.
+   -c tests for convergence every c sweeps (default 16), in the same pass as the sweep;
+   the other sweeps only update the points. The errors printed every 200 sweeps, the
+   result and the output file are the same for all kernels and values of -c as long as
+   the relaxation does not converge. Once it does, up to c-1 more sweeps are done than
+   with a test after every sweep (-c 1, the behaviour of laplace2d_template.c).
+   Throughput is reported in million lattice updates per second (MLUP/s).
+   -S selects the solver, Jacobi by default. gs and sor are red-black Gauss-Seidel and
+   over-relaxation, in place; -w sets omega, by default the optimum for the mesh. mg does
+   multigrid V-cycles with -v red-black Gauss-Seidel sweeps before and after the coarse
+   grid correction (default 2), fmg starts them from a full multigrid solution. -i then
+   counts cycles and the residual is computed after every cycle. Every solver stops when
+   the largest residual, the change a Jacobi sweep would make, is below -e; the error log
+   shows it against the elapsed time, every 200 sweeps or every cycle. A residual that
+   is not finite ends the run as diverged, with exit status 1. For -n 1025
+   -m 1025 on one core:
+       jacobi   not converged, residual 3.2e-6 after 10000 sweeps   18.8 s
+       gs       not converged, residual 1.6e-6 after 10000 sweeps   26.7 s
+       sor      1201 sweeps    2.2 s
+       mg       3 cycles       0.08 s
+       fmg      2 cycles       0.06 s
+   Multigrid coarsens meshes of any size (see laplace2d_multigrid.c); without an odd
+   number of interior points the coarse spacing is a little less than twice the fine one
+   and it takes a cycle more: -n 1024 -m 1024 -S mg converges in 4 cycles, 0.13 s, the
+   default 2048 x 2048 with 10 levels in 4 cycles, 0.50 s, fmg in 3 cycles, 0.39 s.
+   A float residual does not go much below 1e-8.
+   The result is written to -o, by default poisson_<n>x<m>_float32.l2d, in the format of
+   laplace2d_io.c with the number of sweeps or cycles and the last error in the header.
+   -z deflate compresses it without loss, the 2048 x 2048 field 10 times at 70 MB/s per
+   thread.
+   -K writes a checkpoint in the same format to -C (default laplace2d_checkpoint.l2d)
+   after every K sweeps or cycles. The field is copied and a separate thread writes the
+   copy while the sweeps go on; the next checkpoint waits if it has not finished. The
+   convergence test is also done at every checkpoint. -r restarts from a checkpoint or
+   result file: the mesh size comes from the file, the sweeps continue from its count up
+   to -i in total and, with the same -K, give the same errors and result as a run without
+   the restart. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <omp.h>
+#include "laplace2d.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n rows] [-m columns] [-i iter_max] [-e tol] [-S jacobi|gs|sor|mg|fmg]\n"
+					"       [-k rows|tiled|wavefront] [-b tile_rows] [-t tile_columns] [-s steps]\n"
+					"       [-c check] [-w omega] [-v smoothing_sweeps] [-o output] [-z none|deflate]\n"
+					"       [-K checkpoint_every] [-C checkpoint] [-r restart]\n",
+			prog);
+	exit(1);
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int n = 2048;
+	int m = 2048;	/* Size of the mesh */
+	float h = 0.05; /* Instantaneous heat */
+	laplace_opts opts;
+	struct timespec ts_start, ts_end;
+	float time_total;
+	grid *U, *U_new, *F;
+	multigrid *mg = NULL;
+	int iter = 0, sweeps, next_check, print_every;
+	float error = 1.0f;
+	char output_name[64];
+	const char *output_filename = NULL, *checkpoint_name = "laplace2d_checkpoint.l2d", *restart = NULL;
+	int codec = CODEC_NONE, checkpoint_every = 0, status = 0;
+	long restart_iter = 0;
+	checkpointer *cp = NULL;
+	struct timespec ts_write;
+
+	laplace_opts_default(&opts);
+	while ((opt = getopt(argc, argv, "n:m:i:e:S:k:b:t:s:c:w:v:o:z:K:C:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'm':
+			m = atoi(optarg);
+			break;
+		case 'i':
+			opts.iter_max = atoi(optarg);
+			break;
+		case 'e':
+			opts.tol = atof(optarg);
+			break;
+		case 'S':
+			opts.solver = laplace_solver_from_name(optarg);
+			break;
+		case 'k':
+			opts.kernel = laplace_kernel_from_name(optarg);
+			break;
+		case 'b':
+			opts.tile_j = atoi(optarg);
+			break;
+		case 't':
+			opts.tile_i = atoi(optarg);
+			break;
+		case 's':
+			opts.steps = atoi(optarg);
+			break;
+		case 'c':
+			opts.check = atoi(optarg);
+			break;
+		case 'w':
+			opts.omega = atof(optarg);
+			break;
+		case 'v':
+			opts.pre = opts.post = atoi(optarg);
+			break;
+		case 'o':
+			output_filename = optarg;
+			break;
+		case 'z':
+			codec = laplace_codec_from_name(optarg);
+			break;
+		case 'K':
+			checkpoint_every = atoi(optarg);
+			break;
+		case 'C':
+			checkpoint_name = optarg;
+			break;
+		case 'r':
+			restart = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (n < 3 || m < 3 || opts.solver < 0 || opts.kernel < 0 || opts.pre < 0 || opts.omega < 0 || opts.tile_j < 1 || opts.tile_i < 1 || opts.steps < 1 || opts.check < 1 ||
+		opts.iter_max < 0 || codec < 0 || checkpoint_every < 0)
+		usage(argv[0]);
+
+	if (restart)
+	{
+		U = field_read(restart, &restart_iter, &error);
+		if (!U)
+			return 1;
+		n = U->n;
+		m = U->m;
+		iter = restart_iter;
+		printf("Restart from %s after %d iterations, error %0.6e\n", restart, iter, error);
+	}
+	else
+		U = grid_alloc(n, m); /* Plate temperature */
+	F = grid_alloc(n, m);	  /* Heat source */
+	GRID_ROW(F, n / 2)[m / 2] = h; /* Set point heat source */
+	U_new = grid_alloc(n, m); /* Temporary new temperature */
+	if (checkpoint_every > 0)
+		cp = checkpoint_create(checkpoint_name, n, m, codec);
+	if (!output_filename)
+	{
+		snprintf(output_name, sizeof(output_name), "poisson_%dx%d_float32.l2d", n, m);
+		output_filename = output_name;
+	}
+
+	printf("%d x %d mesh, solver %s", n, m, laplace_solver_name(opts.solver));
+	if (opts.solver == SOLVER_JACOBI)
+	{
+		printf(", kernel %s", laplace_kernel_name(opts.kernel));
+		if (opts.kernel != KERNEL_ROWS)
+			printf(", tiles %d x %d", opts.tile_j, opts.tile_i);
+		if (opts.kernel == KERNEL_WAVEFRONT)
+			printf(", %d steps", opts.steps);
+	}
+	if (opts.solver == SOLVER_SOR)
+	{
+		if (opts.omega == 0)
+			opts.omega = laplace_sor_omega(n, m);
+		printf(", omega %.4f", opts.omega);
+	}
+	if (opts.solver >= SOLVER_MG)
+	{
+		mg = mg_alloc(n, m, &opts);
+		printf(", %d levels, %d + %d smoothing sweeps", mg->levels, opts.pre, opts.post);
+	}
+	if (!mg)
+		printf(", convergence test every %d sweeps", opts.check);
+	printf("\n");
+	print_every = opts.solver >= SOLVER_MG ? 1 : 200;
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+
+	if (opts.solver == SOLVER_FMG && opts.iter_max > 0 && iter == 0)
+	{
+		error = mg_fmg(mg, U, F);
+		printf("%5d, %0.6e, %10.4f s\n", iter++, error, elapsed(&ts_start));
+	}
+	/* The main loop. The error is computed on every check-th sweep or cycle, on those
+	   that print it and on the last one before a checkpoint */
+	while (error > opts.tol && isfinite(error) && iter < opts.iter_max)
+	{
+		next_check = (iter + opts.check - 1) / opts.check * opts.check;
+		if (next_check > (iter + print_every - 1) / print_every * print_every)
+			next_check = (iter + print_every - 1) / print_every * print_every;
+		if (cp && next_check > (iter / checkpoint_every + 1) * checkpoint_every - 1)
+			next_check = (iter / checkpoint_every + 1) * checkpoint_every - 1;
+		sweeps = next_check - iter + 1;
+		if (sweeps > opts.iter_max - iter)
+			sweeps = opts.iter_max - iter;
+		if (mg)
+			error = mg_vcycle(mg, U, F);
+		else
+			error = laplace_relax(&U, &U_new, F, &opts, sweeps);
+		iter += mg ? 1 : sweeps;
+		if ((iter - 1) % print_every == 0) /* Print error every 200 iterations */
+			printf("%5d, %0.6e, %10.4f s\n", iter - 1, error, elapsed(&ts_start));
+		if (cp && iter % checkpoint_every == 0)
+			checkpoint_start(cp, U, iter, error);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	time_total = (ts_end.tv_sec - ts_start.tv_sec) * 1e9 + (ts_end.tv_nsec - ts_start.tv_nsec);
+	printf("\nTotal relaxation time is %f sec, %d %s, %s\n", time_total / 1e9, iter, mg ? "cycles" : "iterations",
+		   !isfinite(error) ? "DIVERGED" : error > opts.tol ? "not converged" : "converged");
+	if (!mg)
+		printf("%.1f MLUP/s\n", (double)(n - 2) * (m - 2) * (iter - restart_iter) / (time_total / 1e3));
+
+	/* Write data to a binary file for paraview visualization */
+	clock_gettime(CLOCK_MONOTONIC, &ts_write);
+	status = field_write(output_filename, U, iter, error, codec, 1);
+	if (status == 0)
+		printf("Wrote %s in %.3f s with %d threads\n", output_filename, elapsed(&ts_write), omp_get_max_threads());
+	if (cp && checkpoint_finish(cp) != 0)
+		status = -1;
+	if (!isfinite(error))
+		status = -1;
+
+	checkpoint_free(cp);
+	grid_free(U);
+	grid_free(U_new);
+	grid_free(F);
+	mg_free(mg);
+	return status ? 1 : 0;
+}
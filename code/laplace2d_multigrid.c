@@ -0,0 +1,273 @@
+/* --- File laplace2d_multigrid.c --- */
+/* Geometric multigrid for the laplace2d engine. The equation of every level is written
+   like the finest one,
+     u = (sum of the four neighbours)/4 + g
+   with g = f on the finest level. A fine level of n points per side, n - 1 intervals,
+   has a coarser one with half as many intervals, rounded up: n/2 + 1 points, its first
+   and last on the boundary of the fine level. For an odd number of interior points the
+   coarse point J sits on the fine point 2J; otherwise the coarse spacing is a little
+   less than two fine ones, (n - 1)/(n/2) of them, and every coarse point lies between
+   two fine ones. Either way the boundaries coincide on every level, so meshes of any
+   size coarsen down to a few points.
+   The interpolation is bilinear, from the position of every fine point between the
+   coarse ones, the restriction its transpose: every fine residual goes to the coarse
+   points around it with the weights it was interpolated with. For coarse spacings of
+   2h these are full weighting times 4, the factor by which the right-hand side grows
+   with twice the spacing. For other spacings they scale the right-hand side by
+   Hx Hy / h^2, as if the coarse cells were square; the coarse grid correction is only
+   that much less accurate, by about h/H.
+   The smoother is red-black Gauss-Seidel */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "laplace2d.h"
+
+/* Points of a level of n points per side above, at least 4 */
+static int coarse_size(int n)
+{
+	return n / 2 + 1;
+}
+
+/* The fine points 0..n-1 against the coarse ones 0..nc-1 */
+static void axis_alloc(mg_axis *a, int n, int nc)
+{
+	double s = (double)(nc - 1) / (n - 1), x;
+	int j, J;
+
+	a->below = malloc(n * sizeof(int));
+	a->frac = malloc(n * sizeof(float));
+	a->first = malloc(nc * sizeof(int));
+	a->last = malloc(nc * sizeof(int));
+	for (j = 0; j < n; j++)
+	{
+		x = j * s;
+		a->below[j] = (int)x;
+		if (a->below[j] > nc - 2)
+			a->below[j] = nc - 2;
+		a->frac[j] = (float)(x - a->below[j]);
+	}
+	/* the interior fine points next to coarse point J, the boundary has no residual */
+	for (J = 0; J < nc; J++)
+	{
+		a->first[J] = n - 1;
+		a->last[J] = 0;
+	}
+	for (j = 1; j < n - 1; j++)
+	{
+		J = a->below[j];
+		if (j < a->first[J])
+			a->first[J] = j;
+		a->last[J] = j;
+		if (a->frac[j] > 0)
+		{
+			if (j < a->first[J + 1])
+				a->first[J + 1] = j;
+			a->last[J + 1] = j;
+		}
+	}
+}
+
+static void axis_free(mg_axis *a)
+{
+	free(a->below);
+	free(a->frac);
+	free(a->first);
+	free(a->last);
+}
+
+/* Weight of fine point j for coarse point J */
+static inline float axis_weight(const mg_axis *a, int j, int J)
+{
+	return a->below[j] == J ? 1.0f - a->frac[j] : a->frac[j];
+}
+
+multigrid *mg_alloc(int n, int m, const laplace_opts *opts)
+{
+	multigrid *mg = malloc(sizeof(multigrid));
+	int l, nl = n, ml = m, nc, mc;
+
+	mg->levels = 1;
+	while (coarse_size(nl) - 2 >= 2 && coarse_size(ml) - 2 >= 2)
+	{
+		nl = coarse_size(nl);
+		ml = coarse_size(ml);
+		mg->levels++;
+	}
+	mg->pre = opts->pre;
+	mg->post = opts->post;
+	mg->u = calloc(mg->levels, sizeof(grid *));
+	mg->g = calloc(mg->levels, sizeof(grid *));
+	mg->r = calloc(mg->levels, sizeof(grid *));
+	mg->t = calloc(mg->levels, sizeof(grid *));
+	mg->rows = calloc(mg->levels, sizeof(mg_axis));
+	mg->cols = calloc(mg->levels, sizeof(mg_axis));
+	mg->r[0] = grid_alloc(n, m);
+	for (l = 1; l < mg->levels; l++)
+	{
+		nc = coarse_size(n);
+		mc = coarse_size(m);
+		axis_alloc(&mg->rows[l], n, nc);
+		axis_alloc(&mg->cols[l], m, mc);
+		mg->t[l] = grid_alloc(nc, m);
+		n = nc;
+		m = mc;
+		mg->u[l] = grid_alloc(n, m);
+		mg->g[l] = grid_alloc(n, m);
+		mg->r[l] = grid_alloc(n, m);
+	}
+	return mg;
+}
+
+void mg_free(multigrid *mg)
+{
+	int l;
+
+	if (!mg)
+		return;
+	for (l = 0; l < mg->levels; l++)
+	{
+		grid_free(mg->u[l]);
+		grid_free(mg->g[l]);
+		grid_free(mg->r[l]);
+		grid_free(mg->t[l]);
+		if (l > 0)
+		{
+			axis_free(&mg->rows[l]);
+			axis_free(&mg->cols[l]);
+		}
+	}
+	free(mg->u);
+	free(mg->g);
+	free(mg->r);
+	free(mg->t);
+	free(mg->rows);
+	free(mg->cols);
+	free(mg);
+}
+
+static void zero_interior(grid *u)
+{
+	int j;
+
+	for (j = 1; j < u->n - 1; j++)
+		memset(GRID_ROW(u, j) + 1, 0, (u->m - 2) * sizeof(float));
+}
+
+/* Right-hand side of level l from the residual of level l - 1: the rows first, into
+   t[l], then the columns */
+static void restrict_fw(multigrid *mg, int l, grid *coarse, const grid *fine)
+{
+	const mg_axis *rows = &mg->rows[l], *cols = &mg->cols[l];
+	grid *t = mg->t[l];
+	int J, I, j, i, m = fine->m;
+	const float *in;
+	float *out, w;
+
+#pragma omp parallel for private(I, j, i, in, out, w) schedule(static) if (fine->n > 64)
+	for (J = 1; J < coarse->n - 1; J++)
+	{
+		out = GRID_ROW(t, J);
+		memset(out, 0, m * sizeof(float));
+		for (j = rows->first[J]; j <= rows->last[J]; j++)
+		{
+			in = GRID_ROW(fine, j);
+			w = axis_weight(rows, j, J);
+#pragma omp simd
+			for (i = 1; i < m - 1; i++)
+				out[i] += w * in[i];
+		}
+		in = out;
+		out = GRID_ROW(coarse, J);
+		for (I = 1; I < coarse->m - 1; I++)
+		{
+			out[I] = 0.f;
+			for (i = cols->first[I]; i <= cols->last[I]; i++)
+				out[I] += axis_weight(cols, i, I) * in[i];
+		}
+	}
+}
+
+/* fine += bilinear interpolation of coarse, level l into l - 1: the columns first, into
+   t[l], then the rows. The boundary rows of t stay zero, like those of coarse */
+static void prolong_add(multigrid *mg, int l, grid *fine, const grid *coarse)
+{
+	const mg_axis *rows = &mg->rows[l], *cols = &mg->cols[l];
+	grid *t = mg->t[l];
+	int j, i, J, m = fine->m;
+	const float *a, *b;
+	float *out, wa, wb;
+
+#pragma omp parallel for private(i, a, out) schedule(static) if (fine->n > 64)
+	for (J = 1; J < coarse->n - 1; J++)
+	{
+		a = GRID_ROW(coarse, J);
+		out = GRID_ROW(t, J);
+		for (i = 1; i < m - 1; i++)
+			out[i] = (1.0f - cols->frac[i]) * a[cols->below[i]] + cols->frac[i] * a[cols->below[i] + 1];
+	}
+#pragma omp parallel for private(i, J, a, b, out, wa, wb) schedule(static) if (fine->n > 64)
+	for (j = 1; j < fine->n - 1; j++)
+	{
+		J = rows->below[j];
+		a = GRID_ROW(t, J);
+		b = GRID_ROW(t, J + 1);
+		wb = rows->frac[j];
+		wa = 1.0f - wb;
+		out = GRID_ROW(fine, j);
+#pragma omp simd
+		for (i = 1; i < m - 1; i++)
+			out[i] += wa * a[i] + wb * b[i];
+	}
+}
+
+/* The coarsest level is a few points across, SOR converges in a few dozen sweeps */
+static void solve_coarsest(grid *u, const grid *g)
+{
+	laplace_sor(u, g, laplace_sor_omega(u->n, u->m), 2 * (u->n + u->m), 0);
+}
+
+static void vcycle(multigrid *mg, int l, grid *u, const grid *g)
+{
+	if (l == mg->levels - 1)
+	{
+		solve_coarsest(u, g);
+		return;
+	}
+	laplace_sor(u, g, 1.0f, mg->pre, 0);
+	laplace_residual(u, g, mg->r[l]);
+	restrict_fw(mg, l + 1, mg->g[l + 1], mg->r[l]);
+	zero_interior(mg->u[l + 1]);
+	vcycle(mg, l + 1, mg->u[l + 1], mg->g[l + 1]);
+	prolong_add(mg, l + 1, u, mg->u[l + 1]);
+	laplace_sor(u, g, 1.0f, mg->post, 0);
+}
+
+float mg_vcycle(multigrid *mg, grid *u, const grid *f)
+{
+	vcycle(mg, 0, u, f);
+	return laplace_residual(u, f, NULL);
+}
+
+float mg_fmg(multigrid *mg, grid *u, const grid *f)
+{
+	int l, last = mg->levels - 1;
+
+	/* the right-hand side of every level, the residual of u = 0 */
+	for (l = 1; l <= last; l++)
+		restrict_fw(mg, l, mg->g[l], l == 1 ? f : mg->g[l - 1]);
+	if (last == 0)
+	{
+		zero_interior(u);
+		solve_coarsest(u, f);
+		return laplace_residual(u, f, NULL);
+	}
+	zero_interior(mg->u[last]);
+	solve_coarsest(mg->u[last], mg->g[last]);
+	for (l = last - 1; l >= 0; l--)
+	{
+		zero_interior(l ? mg->u[l] : u);
+		prolong_add(mg, l + 1, l ? mg->u[l] : u, mg->u[l + 1]);
+		vcycle(mg, l, l ? mg->u[l] : u, l ? mg->g[l] : f);
+	}
+	return laplace_residual(u, f, NULL);
+}
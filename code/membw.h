@@ -0,0 +1,137 @@
+/* --- File membw.h --- */
+/* Memory-bound kernels of the lessons (vadd, array_multiply, matrix_sum) on arrays placed
+   by the threads that use them */
+#ifndef MEMBW_H
+#define MEMBW_H
+
+#include <stddef.h>
+#include <omp.h>
+
+/* Arrays start on a page, the first write to a page puts it on the NUMA node of the
+   writing thread */
+#define MEMBW_ALIGN 4096
+
+/* Binding of the OpenMP threads to CPUs */
+enum membw_bind
+{
+	BIND_OMP = 0, /* left to OMP_PROC_BIND and OMP_PLACES */
+	BIND_NONE,	  /* threads may run on any CPU */
+	BIND_COMPACT, /* thread t on the t-th CPU, filling one socket after the other */
+	BIND_SPREAD,  /* thread t on socket t % sockets, round robin */
+	BIND_LIST	  /* thread t on the t-th CPU of a list such as "0-3,8,10" */
+};
+
+/* CPUs this process may run on, ordered by socket, then core */
+typedef struct
+{
+	int cpus;	 /* number of CPUs */
+	int sockets; /* number of sockets with at least one of them */
+	int *cpu;	 /* Linux CPU numbers */
+	int *socket; /* socket of every entry of cpu */
+} membw_topology;
+
+membw_topology *topology_read(void);
+void topology_free(membw_topology *t);
+
+int membw_bind_from_name(const char *name);
+const char *membw_bind_name(int bind);
+/* Binds the threads of the next parallel regions of 'threads' threads according to
+   'bind' (list is the CPU list of BIND_LIST). Returns the number of sockets the threads
+   are on, or -1 if the binding failed */
+int membw_bind(const membw_topology *t, int bind, const char *list, int threads);
+/* Prints the CPU and socket of every thread */
+void membw_print_binding(const membw_topology *t, int threads);
+
+/* Size of the last level cache of all sockets together, from sysfs */
+double membw_llc_bytes(const membw_topology *t);
+
+/* Page-aligned, untouched memory, exits when out of memory */
+void *membw_alloc(size_t bytes);
+void membw_free(void *p);
+
+/* The first touch of an array of n elements, by the threads that access element i in a
+   parallel for with schedule(static) of the same length, or by the calling thread if
+   parallel is 0. fill_random_float gives the values of a hash of seed and i in [0, 1),
+   the same for any number of threads */
+void fill_float(float *a, long n, float value, int parallel);
+void fill_random_float(float *a, long n, unsigned seed, int parallel);
+void fill_int(int *a, long n, int value, int parallel);
+
+/* Stores of the write-only kernels (membw_nt.c) */
+enum membw_store
+{
+	STORE_AUTO = 0, /* streaming if the arrays do not fit in the last level cache */
+	STORE_NORMAL,	/* through the cache */
+	STORE_STREAM	/* non-temporal, past the cache, with AVX2 or AVX-512 */
+};
+
+int membw_store_from_name(const char *name);
+const char *membw_store_name(int store);
+/* STORE_NORMAL or STORE_STREAM for 'bytes' of arrays and a last level cache of 'llc'
+   bytes. STORE_STREAM becomes STORE_NORMAL on CPUs without AVX2 */
+int membw_store_select(int store, double bytes, double llc);
+/* c = a + b and c = q a with schedule(static), with the stores of STORE_NORMAL or
+   STORE_STREAM */
+void vadd_float(float *c, const float *a, const float *b, long n, int store);
+void scale_int(int *c, const int *a, int q, long n, int store);
+
+/* Summation of the fused C = A + B and sum of C (membw_vadd.c) */
+enum membw_sum
+{
+	SUM_SERIAL = 0,	 /* one thread, one running sum, the loop of vadd_gpu_template.c */
+	SUM_FAST,		 /* partial sums in the vector lanes of every thread */
+	SUM_REPRODUCIBLE /* a fixed tree of partial sums, the same bits on any number of threads */
+};
+
+int membw_sum_from_name(const char *name);
+const char *membw_sum_name(int mode);
+/* c = a + b, returns the sum of c in double precision */
+double vadd_sum(float *c, const float *a, const float *b, long n, int mode);
+
+/* The cycle loop of vadd_gpu_template.c around vadd_sum with SUM_REPRODUCIBLE */
+enum membw_cycles
+{
+	CYCLES_NAIVE = 0, /* every cycle sweeps the arrays */
+	CYCLES_BLOCKED,	  /* all cycles on a cache-sized chunk before the next chunk */
+	CYCLES_LAZY		  /* one sweep, its sum added for every cycle */
+};
+
+int membw_cycles_from_name(const char *name);
+const char *membw_cycles_name(int mode);
+/* c = a + b 'ncycles' times, returns the sum of the sums of c of every cycle, the same in
+   all modes. 'chunk' is the number of elements of a chunk of CYCLES_BLOCKED, 0 for the
+   default */
+double vadd_sum_cycles(float *c, const float *a, const float *b, long n, int ncycles, int mode, long chunk);
+
+/* STREAM kernels (membw_stream.c), on arrays of doubles */
+enum stream_kernel
+{
+	STREAM_COPY = 0, /* c = a */
+	STREAM_SCALE,	 /* b = q c */
+	STREAM_ADD,		 /* c = a + b */
+	STREAM_TRIAD,	 /* a = b + q c */
+	STREAM_SUM,		 /* sum of a */
+	STREAM_KERNELS
+};
+
+typedef struct
+{
+	double min, median, max;
+} stream_stats;
+
+int stream_kernel_from_name(const char *name);
+const char *stream_kernel_name(int kernel);
+/* Bytes of traffic per element */
+int stream_bytes(int kernel);
+/* "kind[,chunk]" as in OMP_SCHEDULE, 0 or -1 if it is not one */
+int schedule_parse(const char *text, omp_sched_t *kind, int *chunk);
+/* 'reps' runs of the kernel over n elements, with the schedule set by omp_set_schedule.
+   Returns the sum of all runs for STREAM_SUM */
+double stream_run(int kernel, double *a, double *b, double *c, long n, int reps);
+/* 0 if the arrays, or the sum, are what the kernel makes of elements a0, b0 and c0 */
+int stream_check(int kernel, const double *a, const double *b, const double *c, long n, int reps, double a0, double b0,
+				 double c0, double sum);
+/* Smallest, median and largest of the samples, which are sorted */
+void stream_stats_of(double *samples, int count, stream_stats *s);
+
+#endif
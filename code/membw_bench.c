@@ -0,0 +1,288 @@
+/* --- File membw_bench.c --- */
+/* STREAM-style bandwidth benchmark of the membw engine, from the L1 cache to DRAM.
+
+   gcc -O3 -fopenmp -o membw_bench membw_bench.c membw_stream.c membw_lib.c
+
+   Usage: membw_bench [-k kernel,...] [-s min_bytes] [-S max_bytes] [-f factor]
+                      [-t threads,...] [-d schedule]... [-r samples] [-w warmups]
+                      [-m min_sample_time] [-A omp|none|compact|spread|list] [-L cpu_list]
+                      [-o text|csv|json]
+   Every combination of thread count (-t, default all), schedule (-d, repeatable, in the
+   syntax of OMP_SCHEDULE, default static), working set and kernel (-k, default
+   copy,scale,add,triad,sum) is measured. The working set, the three arrays together,
+   goes from -s (default 16K) to -S (default 1G) in steps of -f (default 4); sizes take
+   K, M and G. The arrays of every thread count, schedule and size are new and first
+   written with that schedule.
+   A sample runs the kernel as often as it takes to last -m seconds (default 0.002), in
+   one parallel region. -w samples (default 2) are thrown away, then the smallest, median
+   and largest bandwidth of -r samples (default 10) are reported in GB/s. Every result is
+   checked against the values the kernel must produce; a wrong one is marked in the
+   output and makes the exit status 1.
+   -o csv and -o json write one record per measurement to stdout for dashboards, the
+   text format also lists the cache sizes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+#include "membw.h"
+
+#define MAX_LIST 64
+
+enum bench_format
+{
+	FORMAT_TEXT = 0,
+	FORMAT_CSV,
+	FORMAT_JSON
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-k kernel,...] [-s min_bytes] [-S max_bytes] [-f factor]\n"
+					"       [-t threads,...] [-d schedule]... [-r samples] [-w warmups]\n"
+					"       [-m min_sample_time] [-A omp|none|compact|spread|list] [-L cpu_list]\n"
+					"       [-o text|csv|json]\n",
+			prog);
+	exit(1);
+}
+
+/* 64K, 1M, 2G or plain bytes, 0 if it is none */
+static double parse_bytes(const char *text)
+{
+	char *end;
+	double x = strtod(text, &end);
+
+	if (*end == 'K' || *end == 'k')
+		x *= 1024, end++;
+	else if (*end == 'M' || *end == 'm')
+		x *= 1024 * 1024, end++;
+	else if (*end == 'G' || *end == 'g')
+		x *= 1024 * 1024 * 1024, end++;
+	return *end || x < 0 ? 0 : x;
+}
+
+static void print_bytes(double x)
+{
+	if (x >= 1 << 30)
+		printf("%6.1fG", x / (1 << 30));
+	else if (x >= 1 << 20)
+		printf("%6.1fM", x / (1 << 20));
+	else
+		printf("%6.1fK", x / 1024);
+}
+
+/* The data caches of CPU 0 from sysfs */
+static void print_caches(void)
+{
+	char path[128], size[32];
+	int index, level;
+	FILE *f;
+
+	printf("Caches of CPU 0:");
+	for (index = 0; index < 8; index++)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+		if (!(f = fopen(path, "r")))
+			break;
+		level = 0;
+		if (fscanf(f, "%d", &level) != 1)
+			level = 0;
+		fclose(f);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+		if ((f = fopen(path, "r")))
+		{
+			/* the instruction cache does not matter here */
+			if (fscanf(f, "%31s", size) == 1 && strcmp(size, "Instruction") == 0)
+				level = -1;
+			fclose(f);
+		}
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+		if (level > 0 && (f = fopen(path, "r")))
+		{
+			if (fscanf(f, "%31s", size) == 1)
+				printf(" L%d %s", level, size);
+			fclose(f);
+		}
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt, k, t, d, s, kernel, reps, valid, failures = 0, records = 0;
+	int kernels[STREAM_KERNELS], nkernels = 0, threads[MAX_LIST], nthreads = 0, chunks[MAX_LIST], nschedules = 0;
+	int samples = 10, warmups = 2, bind = BIND_OMP, format = FORMAT_TEXT;
+	const char *schedule_text[MAX_LIST], *list = NULL;
+	omp_sched_t kinds[MAX_LIST];
+	double min_bytes = 16 * 1024, max_bytes = 1024.0 * 1024 * 1024, factor = 4, min_time = 0.002;
+	double bytes, time, sum, a0, b0, c0, *bw, *a, *b, *c;
+	char *copy, *item;
+	long i, n;
+	stream_stats st;
+	membw_topology *topo;
+
+	while ((opt = getopt(argc, argv, "k:s:S:f:t:d:r:w:m:A:L:o:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'k':
+			copy = strdup(optarg);
+			for (item = strtok(copy, ","); item && nkernels < STREAM_KERNELS; item = strtok(NULL, ","))
+				if ((kernels[nkernels++] = stream_kernel_from_name(item)) < 0)
+					usage(argv[0]);
+			free(copy);
+			break;
+		case 's':
+			min_bytes = parse_bytes(optarg);
+			break;
+		case 'S':
+			max_bytes = parse_bytes(optarg);
+			break;
+		case 'f':
+			factor = atof(optarg);
+			break;
+		case 't':
+			copy = strdup(optarg);
+			for (item = strtok(copy, ","); item && nthreads < MAX_LIST; item = strtok(NULL, ","))
+				if ((threads[nthreads++] = atoi(item)) < 1)
+					usage(argv[0]);
+			free(copy);
+			break;
+		case 'd':
+			if (nschedules == MAX_LIST || schedule_parse(optarg, &kinds[nschedules], &chunks[nschedules]) < 0)
+				usage(argv[0]);
+			schedule_text[nschedules++] = optarg;
+			break;
+		case 'r':
+			samples = atoi(optarg);
+			break;
+		case 'w':
+			warmups = atoi(optarg);
+			break;
+		case 'm':
+			min_time = atof(optarg);
+			break;
+		case 'A':
+			bind = membw_bind_from_name(optarg);
+			break;
+		case 'L':
+			list = optarg;
+			break;
+		case 'o':
+			format = strcmp(optarg, "text") == 0 ? FORMAT_TEXT
+					 : strcmp(optarg, "csv") == 0 ? FORMAT_CSV
+					 : strcmp(optarg, "json") == 0 ? FORMAT_JSON
+												   : -1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (min_bytes < 3 * sizeof(double) || max_bytes < min_bytes || factor <= 1 || samples < 1 || warmups < 0 ||
+		min_time <= 0 || bind < 0 || format < 0)
+		usage(argv[0]);
+	if (nkernels == 0)
+		for (nkernels = 0; nkernels < STREAM_KERNELS; nkernels++)
+			kernels[nkernels] = nkernels;
+	if (nthreads == 0)
+		threads[nthreads++] = omp_get_max_threads();
+	if (nschedules == 0)
+	{
+		schedule_parse("static", &kinds[0], &chunks[0]);
+		schedule_text[nschedules++] = "static";
+	}
+
+	topo = topology_read();
+	bw = malloc(samples * sizeof(double));
+	if (format == FORMAT_TEXT)
+	{
+		printf("%d CPUs on %d sockets, binding %s\n", topo->cpus, topo->sockets, membw_bind_name(bind));
+		print_caches();
+		printf("\n%7s %-14s %7s %-6s %6s %10s %10s %10s\n", "threads", "schedule", "bytes", "kernel", "reps", "min GB/s",
+			   "median", "max");
+	}
+	else if (format == FORMAT_CSV)
+		printf("threads,schedule,bytes,elements,kernel,reps,samples,min_gbs,median_gbs,max_gbs,valid\n");
+	else
+		printf("[");
+
+	for (t = 0; t < nthreads; t++)
+	{
+		omp_set_num_threads(threads[t]);
+		if (membw_bind(topo, bind, list, threads[t]) < 0)
+			return 1;
+		for (d = 0; d < nschedules; d++)
+		{
+			omp_set_schedule(kinds[d], chunks[d]);
+			for (bytes = min_bytes; bytes <= max_bytes * 1.0001; bytes *= factor)
+			{
+				n = bytes / (3 * sizeof(double));
+				a = membw_alloc(n * sizeof(double));
+				b = membw_alloc(n * sizeof(double));
+				c = membw_alloc(n * sizeof(double));
+				/* first touch with the schedule of the kernels; STREAM's initial values */
+#pragma omp parallel for schedule(runtime)
+				for (i = 0; i < n; i++)
+				{
+					a[i] = 1.0;
+					b[i] = 2.0;
+					c[i] = 0.0;
+				}
+				for (s = 0; s < nkernels; s++)
+				{
+					kernel = kernels[s];
+					a0 = a[0];
+					b0 = b[0];
+					c0 = c[0];
+					/* repetitions for min_time, doubled until a run takes long enough */
+					for (reps = 1;; reps *= 2)
+					{
+						time = omp_get_wtime();
+						stream_run(kernel, a, b, c, n, reps);
+						if (omp_get_wtime() - time >= min_time || reps >= 1 << 30)
+							break;
+					}
+					for (k = 0; k < warmups; k++)
+						stream_run(kernel, a, b, c, n, reps);
+					for (k = 0; k < samples; k++)
+					{
+						time = omp_get_wtime();
+						sum = stream_run(kernel, a, b, c, n, reps);
+						time = omp_get_wtime() - time;
+						bw[k] = (double)stream_bytes(kernel) * n * reps / time * 1e-9;
+					}
+					valid = stream_check(kernel, a, b, c, n, reps, a0, b0, c0, sum) == 0;
+					failures += !valid;
+					stream_stats_of(bw, samples, &st);
+
+					if (format == FORMAT_TEXT)
+					{
+						printf("%7d %-14s ", threads[t], schedule_text[d]);
+						print_bytes(bytes);
+						printf(" %-6s %6d %10.2f %10.2f %10.2f%s\n", stream_kernel_name(kernel), reps, st.min, st.median,
+							   st.max, valid ? "" : "  WRONG RESULT");
+					}
+					else if (format == FORMAT_CSV)
+						printf("%d,\"%s\",%.0f,%ld,%s,%d,%d,%.4f,%.4f,%.4f,%d\n", threads[t], schedule_text[d], bytes, n,
+							   stream_kernel_name(kernel), reps, samples, st.min, st.median, st.max, valid);
+					else
+						printf("%s\n {\"threads\": %d, \"schedule\": \"%s\", \"bytes\": %.0f, \"elements\": %ld, "
+							   "\"kernel\": \"%s\", \"reps\": %d, \"samples\": %d, \"min_gbs\": %.4f, "
+							   "\"median_gbs\": %.4f, \"max_gbs\": %.4f, \"valid\": %s}",
+							   records ? "," : "", threads[t], schedule_text[d], bytes, n, stream_kernel_name(kernel),
+							   reps, samples, st.min, st.median, st.max, valid ? "true" : "false");
+					records++;
+					fflush(stdout);
+				}
+				membw_free(a);
+				membw_free(b);
+				membw_free(c);
+			}
+		}
+	}
+	if (format == FORMAT_JSON)
+		printf("\n]\n");
+	free(bw);
+	topology_free(topo);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/* --- File membw_cycles.c --- */
+/* The cycles of vadd_gpu_template.c, C = A + B and the sum of C repeated over the same
+   arrays, swept from memory every cycle, blocked in the cache or computed once.
+
+   gcc -O3 -fopenmp -o membw_cycles membw_cycles.c membw_vadd.c membw_lib.c
+
+   Usage: membw_cycles [-n elements] [-c ncycles] [-M naive|blocked|lazy|all] [-b chunk]
+   Runs the cycles of -c (default 10) on -n elements (default 1e8) in every mode of -M
+   (default all), see membw_vadd.c, with the threads of OMP_NUM_THREADS. -b sets the
+   elements of a chunk of the blocked mode, rounded up to whole blocks of the sum; by
+   default the arrays of a chunk take 768 KB. Reported are the time per cycle, the
+   bandwidth of one cycle (12 bytes per element) and the sum, divided by n and ncycles as
+   in the template. The sums of all modes must be the same to the bit, the exit status is
+   1 if they are not.
+   On one core with a 2 MB L2 cache, 1e8 elements and 10 cycles:
+       naive      0.159 s per cycle    7.5 GB/s
+       blocked    0.073 s per cycle   16.5 GB/s
+       lazy       0.013 s per cycle   89.8 GB/s
+   The blocked cycles after the first run at the 20-24 GB/s this core gets from vadd_sum
+   on arrays in the cache. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+#include "membw.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n elements] [-c ncycles] [-M naive|blocked|lazy|all] [-b chunk]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, mode, first = CYCLES_NAIVE, last = CYCLES_LAZY, ncycles = 10, failed = 0;
+	long n = 100000000, chunk = 0;
+	double t, sum, reference = 0;
+	float *a, *b, *c;
+
+	while ((opt = getopt(argc, argv, "n:c:M:b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			n = atof(optarg);
+			break;
+		case 'c':
+			ncycles = atoi(optarg);
+			break;
+		case 'M':
+			if (strcmp(optarg, "all") != 0)
+				first = last = membw_cycles_from_name(optarg);
+			break;
+		case 'b':
+			chunk = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (n < 1 || ncycles < 1 || first < 0 || chunk < 0)
+		usage(argv[0]);
+
+	a = membw_alloc(n * sizeof(float));
+	b = membw_alloc(n * sizeof(float));
+	c = membw_alloc(n * sizeof(float));
+	fill_random_float(a, n, 1, 1);
+	fill_random_float(b, n, 2, 1);
+	fill_float(c, n, 0.0f, 1);
+
+	printf("%ld elements, %d cycles, %d threads\n\n", n, ncycles, omp_get_max_threads());
+	printf("%-8s %12s %12s %10s %24s\n", "mode", "time", "per cycle", "GB/s", "sum");
+	for (mode = first; mode <= last; mode++)
+	{
+		t = omp_get_wtime();
+		sum = vadd_sum_cycles(c, a, b, n, ncycles, mode, chunk);
+		t = omp_get_wtime() - t;
+		if (mode == first)
+			reference = sum;
+		printf("%-8s %12.4f %12.4f %10.2f %24.17g", membw_cycles_name(mode), t, t / ncycles,
+			   12.0 * n * ncycles / t * 1e-9, sum / n / ncycles);
+		if (sum != reference || c[n - 1] != a[n - 1] + b[n - 1])
+		{
+			printf("  WRONG RESULT");
+			failed = 1;
+		}
+		printf("\n");
+	}
+	membw_free(a);
+	membw_free(b);
+	membw_free(c);
+	return failed;
+}
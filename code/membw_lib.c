@@ -0,0 +1,321 @@
+/* --- File membw_lib.c --- */
+/* Placement of the arrays and binding of the threads of the membw engine. Linux puts a
+   page on the NUMA node of the thread that writes it first. An array initialised by the
+   master thread therefore sits on one socket and every other socket reads it through the
+   link between them; initialised by the threads that compute on it, with the same static
+   schedule, every thread finds its part on its own memory controller. This only holds
+   while the threads stay where they were, hence the binding */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <omp.h>
+#include "membw.h"
+
+static const char *bind_names[] = {"omp", "none", "compact", "spread", "list"};
+
+int membw_bind_from_name(const char *name)
+{
+	int b;
+
+	for (b = 0; b < 5; b++)
+		if (strcmp(name, bind_names[b]) == 0)
+			return b;
+	return -1;
+}
+
+const char *membw_bind_name(int bind)
+{
+	return bind_names[bind];
+}
+
+static int read_int(const char *format, int cpu)
+{
+	char path[128];
+	FILE *f;
+	int value = 0;
+
+	snprintf(path, sizeof(path), format, cpu);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%d", &value) != 1)
+		value = 0;
+	fclose(f);
+	return value;
+}
+
+typedef struct
+{
+	int cpu, package, core, smt;
+} cpu_entry;
+
+/* By socket, then one CPU of every core before the second hardware thread of any */
+static int cpu_order(const void *a, const void *b)
+{
+	const cpu_entry *x = a, *y = b;
+
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->smt != y->smt)
+		return x->smt - y->smt;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+membw_topology *topology_read(void)
+{
+	membw_topology *t = malloc(sizeof(membw_topology));
+	cpu_set_t allowed;
+	cpu_entry *e;
+	int c, k, n = 0;
+
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	e = malloc(CPU_SETSIZE * sizeof(cpu_entry));
+	for (c = 0; c < CPU_SETSIZE; c++)
+	{
+		if (!CPU_ISSET(c, &allowed))
+			continue;
+		e[n].cpu = c;
+		e[n].package = read_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c);
+		e[n].core = read_int("/sys/devices/system/cpu/cpu%d/topology/core_id", c);
+		/* hardware threads of the same core come in the order of their CPU numbers */
+		e[n].smt = 0;
+		for (k = 0; k < n; k++)
+			if (e[k].package == e[n].package && e[k].core == e[n].core)
+				e[n].smt++;
+		n++;
+	}
+	qsort(e, n, sizeof(cpu_entry), cpu_order);
+
+	t->cpus = n;
+	t->cpu = malloc(n * sizeof(int));
+	t->socket = malloc(n * sizeof(int));
+	t->sockets = 0;
+	for (c = 0; c < n; c++)
+	{
+		/* sockets numbered from 0 in the order they appear */
+		if (c > 0 && e[c].package != e[c - 1].package)
+			t->sockets++;
+		t->cpu[c] = e[c].cpu;
+		t->socket[c] = t->sockets;
+	}
+	t->sockets++;
+	free(e);
+	return t;
+}
+
+void topology_free(membw_topology *t)
+{
+	if (!t)
+		return;
+	free(t->cpu);
+	free(t->socket);
+	free(t);
+}
+
+static int socket_of_cpu(const membw_topology *t, int cpu)
+{
+	int c;
+
+	for (c = 0; c < t->cpus; c++)
+		if (t->cpu[c] == cpu)
+			return t->socket[c];
+	return -1;
+}
+
+/* CPU numbers of a list such as "0-3,8,10", -1 if it is not one */
+static int parse_list(const char *list, int *cpus, int max)
+{
+	int n = 0, a, b, used;
+
+	while (*list)
+	{
+		if (sscanf(list, "%d%n", &a, &used) != 1)
+			return -1;
+		list += used;
+		b = a;
+		if (*list == '-' && sscanf(list + 1, "%d%n", &b, &used) == 1)
+			list += used + 1;
+		for (; a <= b && n < max; a++)
+			cpus[n++] = a;
+		if (*list == ',')
+			list++;
+		else if (*list)
+			return -1;
+	}
+	return n > 0 ? n : -1;
+}
+
+int membw_bind(const membw_topology *t, int bind, const char *list, int threads)
+{
+	int *target = malloc(threads * sizeof(int)), *on = calloc(t->sockets, sizeof(int));
+	int *listed = malloc(CPU_SETSIZE * sizeof(int));
+	int th, s, c, k, count, failed = 0, sockets = 0, nlisted = 0;
+
+	if (bind == BIND_LIST && (nlisted = parse_list(list ? list : "", listed, CPU_SETSIZE)) < 0)
+	{
+		fprintf(stderr, "membw_bind: %s is not a CPU list\n", list ? list : "(none)");
+		free(target);
+		free(on);
+		free(listed);
+		return -1;
+	}
+	for (th = 0; th < threads; th++)
+	{
+		target[th] = -1;
+		if (bind == BIND_COMPACT)
+			target[th] = t->cpu[th % t->cpus];
+		else if (bind == BIND_LIST)
+			target[th] = listed[th % nlisted];
+		else if (bind == BIND_SPREAD)
+		{
+			/* the k-th CPU of socket s, round robin if it has fewer */
+			s = th % t->sockets;
+			for (c = 0, count = 0; c < t->cpus; c++)
+				count += t->socket[c] == s;
+			k = th / t->sockets % count;
+			for (c = 0; t->socket[c] != s || k-- > 0; c++)
+				;
+			target[th] = t->cpu[c];
+		}
+	}
+
+#pragma omp parallel num_threads(threads) private(c)
+	{
+		cpu_set_t set;
+		int me = omp_get_thread_num();
+
+		if (bind != BIND_OMP)
+		{
+			CPU_ZERO(&set);
+			if (target[me] >= 0)
+				CPU_SET(target[me], &set);
+			else
+				for (c = 0; c < t->cpus; c++)
+					CPU_SET(t->cpu[c], &set);
+			if (sched_setaffinity(0, sizeof(set), &set) != 0)
+			{
+#pragma omp atomic write
+				failed = 1;
+			}
+		}
+		/* where the thread runs now, which for unbound threads may change */
+		c = socket_of_cpu(t, sched_getcpu());
+		if (c >= 0)
+		{
+#pragma omp atomic write
+			on[c] = 1;
+		}
+	}
+	for (s = 0; s < t->sockets; s++)
+		sockets += on[s];
+	if (failed)
+		perror("membw_bind");
+	free(target);
+	free(on);
+	free(listed);
+	return failed ? -1 : sockets;
+}
+
+void membw_print_binding(const membw_topology *t, int threads)
+{
+	int *cpu = malloc(threads * sizeof(int)), th;
+
+#pragma omp parallel num_threads(threads)
+	cpu[omp_get_thread_num()] = sched_getcpu();
+	for (th = 0; th < threads; th++)
+		printf("thread %3d on CPU %3d, socket %d\n", th, cpu[th], socket_of_cpu(t, cpu[th]));
+	free(cpu);
+}
+
+double membw_llc_bytes(const membw_topology *t)
+{
+	char path[128], size[32], unit = 'K';
+	int index, level, last = 0;
+	double bytes = 0, x;
+	FILE *f;
+
+	for (index = 0; index < 8; index++)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", t->cpu[0], index);
+		if (!(f = fopen(path, "r")))
+			break;
+		if (fscanf(f, "%d", &level) != 1)
+			level = 0;
+		fclose(f);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/size", t->cpu[0], index);
+		if (level >= last && (f = fopen(path, "r")))
+		{
+			if (fscanf(f, "%31s", size) == 1 && sscanf(size, "%lf%c", &x, &unit) >= 1)
+			{
+				last = level;
+				bytes = x * (unit == 'M' ? 1 << 20 : unit == 'G' ? 1 << 30 : 1024);
+			}
+			fclose(f);
+		}
+	}
+	/* unknown: the last level caches of today are a few tens of MB per socket */
+	if (bytes == 0)
+		bytes = 32 << 20;
+	return bytes * t->sockets;
+}
+
+void *membw_alloc(size_t bytes)
+{
+	void *p = aligned_alloc(MEMBW_ALIGN, (bytes + MEMBW_ALIGN - 1) / MEMBW_ALIGN * MEMBW_ALIGN);
+
+	if (!p)
+	{
+		fprintf(stderr, "membw_alloc: out of memory (%zu bytes)\n", bytes);
+		exit(1);
+	}
+	return p;
+}
+
+void membw_free(void *p)
+{
+	free(p);
+}
+
+void fill_float(float *a, long n, float value, int parallel)
+{
+	long i;
+
+#pragma omp parallel for schedule(static) if (parallel)
+	for (i = 0; i < n; i++)
+		a[i] = value;
+}
+
+/* splitmix64 of seed and i, 24 bits of it make a float in [0, 1) */
+static inline float hash_float(unsigned seed, long i)
+{
+	uint64_t z = ((uint64_t)seed << 40) + (uint64_t)i + 0x9e3779b97f4a7c15ull;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	z ^= z >> 31;
+	return (z >> 40) * (1.0f / 16777216.0f);
+}
+
+void fill_random_float(float *a, long n, unsigned seed, int parallel)
+{
+	long i;
+
+#pragma omp parallel for schedule(static) if (parallel)
+	for (i = 0; i < n; i++)
+		a[i] = hash_float(seed, i);
+}
+
+void fill_int(int *a, long n, int value, int parallel)
+{
+	long i;
+
+#pragma omp parallel for schedule(static) if (parallel)
+	for (i = 0; i < n; i++)
+		a[i] = value;
+}
@@ -0,0 +1,211 @@
+/* --- File membw_nt.c --- */
+/* Write-only array kernels of the membw engine with non-temporal stores. A normal store
+   to a line that is not in the cache first reads the line (read for ownership), so
+   C = A + B moves four arrays instead of three and C = k A three instead of two. Streaming
+   stores write whole lines straight to memory without reading them and without evicting
+   A and B from the cache. That only pays when C does not fit in the cache anyway: a
+   streamed C has to come back from memory when it is read next, hence STORE_AUTO.
+   Stores go to aligned vectors of C, the first elements up to the first aligned one and
+   the elements after the last full vector are written normally. Streaming stores are
+   weakly ordered, every thread fences them before the barrier at the end of the loop.
+   The AVX2 and AVX-512 versions are compiled with target attributes and picked at run
+   time, like the elect_energy kernels */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <omp.h>
+#include "membw.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f")))
+
+/* Elements of c before the first 'align'-byte boundary */
+static long head_of(const void *c, size_t elem, int align)
+{
+	return (align - (uintptr_t)c % align) % align / elem;
+}
+
+AVX512 static void vadd_float_avx512(float *c, const float *a, const float *b, long n)
+{
+	long head = head_of(c, sizeof(float), 64), blocks, k, i;
+
+	if (head > n)
+		head = n;
+	blocks = (n - head) / 16;
+#pragma omp parallel private(i)
+	{
+#pragma omp for schedule(static) nowait
+		for (k = 0; k < blocks; k++)
+		{
+			i = head + 16 * k;
+			_mm512_stream_ps(c + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+		}
+		_mm_sfence();
+	}
+	for (i = 0; i < head; i++)
+		c[i] = a[i] + b[i];
+	for (i = head + 16 * blocks; i < n; i++)
+		c[i] = a[i] + b[i];
+}
+
+AVX512 static void scale_int_avx512(int *c, const int *a, int q, long n)
+{
+	long head = head_of(c, sizeof(int), 64), blocks, k, i;
+	__m512i vq = _mm512_set1_epi32(q);
+
+	if (head > n)
+		head = n;
+	blocks = (n - head) / 16;
+#pragma omp parallel private(i)
+	{
+#pragma omp for schedule(static) nowait
+		for (k = 0; k < blocks; k++)
+		{
+			i = head + 16 * k;
+			_mm512_stream_si512((__m512i *)(c + i), _mm512_mullo_epi32(vq, _mm512_loadu_si512(a + i)));
+		}
+		_mm_sfence();
+	}
+	for (i = 0; i < head; i++)
+		c[i] = q * a[i];
+	for (i = head + 16 * blocks; i < n; i++)
+		c[i] = q * a[i];
+}
+
+AVX2 static void vadd_float_avx2(float *c, const float *a, const float *b, long n)
+{
+	long head = head_of(c, sizeof(float), 32), blocks, k, i;
+
+	if (head > n)
+		head = n;
+	blocks = (n - head) / 8;
+#pragma omp parallel private(i)
+	{
+#pragma omp for schedule(static) nowait
+		for (k = 0; k < blocks; k++)
+		{
+			i = head + 8 * k;
+			_mm256_stream_ps(c + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+		}
+		_mm_sfence();
+	}
+	for (i = 0; i < head; i++)
+		c[i] = a[i] + b[i];
+	for (i = head + 8 * blocks; i < n; i++)
+		c[i] = a[i] + b[i];
+}
+
+AVX2 static void scale_int_avx2(int *c, const int *a, int q, long n)
+{
+	long head = head_of(c, sizeof(int), 32), blocks, k, i;
+	__m256i vq = _mm256_set1_epi32(q);
+
+	if (head > n)
+		head = n;
+	blocks = (n - head) / 8;
+#pragma omp parallel private(i)
+	{
+#pragma omp for schedule(static) nowait
+		for (k = 0; k < blocks; k++)
+		{
+			i = head + 8 * k;
+			_mm256_stream_si256((__m256i *)(c + i),
+								_mm256_mullo_epi32(vq, _mm256_loadu_si256((const __m256i *)(a + i))));
+		}
+		_mm_sfence();
+	}
+	for (i = 0; i < head; i++)
+		c[i] = q * a[i];
+	for (i = head + 8 * blocks; i < n; i++)
+		c[i] = q * a[i];
+}
+
+/* 2 for AVX-512, 1 for AVX2, 0 if there are no streaming kernels for this CPU */
+static int stream_isa(void)
+{
+	static int isa = -1;
+
+	if (isa < 0)
+		isa = __builtin_cpu_supports("avx512f") ? 2 : __builtin_cpu_supports("avx2") ? 1 : 0;
+	return isa;
+}
+
+#else
+
+static int stream_isa(void)
+{
+	return 0;
+}
+
+#endif
+
+static const char *store_names[] = {"auto", "normal", "stream"};
+
+int membw_store_from_name(const char *name)
+{
+	int s;
+
+	for (s = 0; s < 3; s++)
+		if (strcmp(name, store_names[s]) == 0)
+			return s;
+	return -1;
+}
+
+const char *membw_store_name(int store)
+{
+	return store_names[store];
+}
+
+int membw_store_select(int store, double bytes, double llc)
+{
+	if (store == STORE_AUTO)
+		store = bytes > llc ? STORE_STREAM : STORE_NORMAL;
+	if (store == STORE_STREAM && stream_isa() == 0)
+		store = STORE_NORMAL;
+	return store;
+}
+
+void vadd_float(float *c, const float *a, const float *b, long n, int store)
+{
+	long i;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (store == STORE_STREAM && stream_isa() == 2)
+	{
+		vadd_float_avx512(c, a, b, n);
+		return;
+	}
+	if (store == STORE_STREAM && stream_isa() == 1)
+	{
+		vadd_float_avx2(c, a, b, n);
+		return;
+	}
+#endif
+#pragma omp parallel for schedule(static)
+	for (i = 0; i < n; i++)
+		c[i] = a[i] + b[i];
+}
+
+void scale_int(int *c, const int *a, int q, long n, int store)
+{
+	long i;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (store == STORE_STREAM && stream_isa() == 2)
+	{
+		scale_int_avx512(c, a, q, n);
+		return;
+	}
+	if (store == STORE_STREAM && stream_isa() == 1)
+	{
+		scale_int_avx2(c, a, q, n);
+		return;
+	}
+#endif
+#pragma omp parallel for schedule(static)
+	for (i = 0; i < n; i++)
+		c[i] = q * a[i];
+}
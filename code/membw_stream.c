@@ -0,0 +1,150 @@
+/* --- File membw_stream.c --- */
+/* STREAM kernels of the membw engine: copy, scale, add and triad as defined by McCalpin's
+   STREAM, on doubles, and a sum reduction. They cover the loops of vadd_gpu_template.c
+   (add, and add plus sum), array_multiply_template.c (scale) and vectorize_1.c (a triad
+   with a product). Traffic is counted the STREAM way, one read or write of every array
+   element per access, without the reads for ownership of the written lines */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "membw.h"
+
+/* the scalar of scale and triad */
+#define STREAM_SCALAR 3.0
+
+static const char *stream_names[] = {"copy", "scale", "add", "triad", "sum"};
+/* bytes per element */
+static const int stream_traffic[] = {16, 16, 24, 24, 8};
+
+int stream_kernel_from_name(const char *name)
+{
+	int k;
+
+	for (k = 0; k < STREAM_KERNELS; k++)
+		if (strcmp(name, stream_names[k]) == 0)
+			return k;
+	return -1;
+}
+
+const char *stream_kernel_name(int kernel)
+{
+	return stream_names[kernel];
+}
+
+int stream_bytes(int kernel)
+{
+	return stream_traffic[kernel];
+}
+
+/* "static", "dynamic,1024", ... as in OMP_SCHEDULE. Returns -1 if it is not one */
+int schedule_parse(const char *text, omp_sched_t *kind, int *chunk)
+{
+	static const char *kinds[] = {"static", "dynamic", "guided", "auto"};
+	static const omp_sched_t values[] = {omp_sched_static, omp_sched_dynamic, omp_sched_guided, omp_sched_auto};
+	size_t len = strcspn(text, ",");
+	int k;
+
+	*chunk = 0;
+	if (text[len] == ',' && (*chunk = atoi(text + len + 1)) < 1)
+		return -1;
+	for (k = 0; k < 4; k++)
+		if (strlen(kinds[k]) == len && strncmp(text, kinds[k], len) == 0)
+		{
+			*kind = values[k];
+			return 0;
+		}
+	return -1;
+}
+
+double stream_run(int kernel, double *restrict a, double *restrict b, double *restrict c, long n, int reps)
+{
+	const double q = STREAM_SCALAR;
+	double sum = 0;
+	long i;
+	int r;
+
+	/* one parallel region for all repetitions, small arrays would time its start-up */
+#pragma omp parallel private(r)
+	for (r = 0; r < reps; r++)
+	{
+		switch (kernel)
+		{
+		case STREAM_COPY:
+#pragma omp for simd schedule(runtime)
+			for (i = 0; i < n; i++)
+				c[i] = a[i];
+			break;
+		case STREAM_SCALE:
+#pragma omp for simd schedule(runtime)
+			for (i = 0; i < n; i++)
+				b[i] = q * c[i];
+			break;
+		case STREAM_ADD:
+#pragma omp for simd schedule(runtime)
+			for (i = 0; i < n; i++)
+				c[i] = a[i] + b[i];
+			break;
+		case STREAM_TRIAD:
+#pragma omp for simd schedule(runtime)
+			for (i = 0; i < n; i++)
+				a[i] = b[i] + q * c[i];
+			break;
+		default:
+#pragma omp for simd schedule(runtime) reduction(+ : sum)
+			for (i = 0; i < n; i++)
+				sum += a[i];
+		}
+	}
+	return sum;
+}
+
+/* The values of element 0 after the kernel, from those before it */
+static void expected(int kernel, double *a, double *b, double *c)
+{
+	switch (kernel)
+	{
+	case STREAM_COPY:
+		*c = *a;
+		break;
+	case STREAM_SCALE:
+		*b = STREAM_SCALAR * *c;
+		break;
+	case STREAM_ADD:
+		*c = *a + *b;
+		break;
+	case STREAM_TRIAD:
+		*a = *b + STREAM_SCALAR * *c;
+	}
+}
+
+int stream_check(int kernel, const double *a, const double *b, const double *c, long n, int reps, double a0, double b0,
+				 double c0, double sum)
+{
+	long probe[3] = {0, n / 2, n - 1};
+	int p;
+
+	if (kernel == STREAM_SUM)
+		/* small whole numbers add up exactly in any order */
+		return sum == (double)reps * n * a0 ? 0 : -1;
+	expected(kernel, &a0, &b0, &c0);
+	for (p = 0; p < 3; p++)
+		if (a[probe[p]] != a0 || b[probe[p]] != b0 || c[probe[p]] != c0)
+			return -1;
+	return 0;
+}
+
+static int compare_double(const void *x, const void *y)
+{
+	double a = *(const double *)x, b = *(const double *)y;
+
+	return a < b ? -1 : a > b;
+}
+
+void stream_stats_of(double *samples, int count, stream_stats *s)
+{
+	qsort(samples, count, sizeof(double), compare_double);
+	s->min = samples[0];
+	s->max = samples[count - 1];
+	s->median = count % 2 ? samples[count / 2] : 0.5 * (samples[count / 2 - 1] + samples[count / 2]);
+}
@@ -0,0 +1,210 @@
+/* --- File membw_vadd.c --- */
+/* The loop of vadd_gpu_template.c, C = A + B and the sum of C, in one pass. The template
+   adds every C[i] to one double, each addition waits for the one before, and the loop
+   neither vectorises nor runs in parallel. Here every thread keeps SUM_LANES partial sums,
+   element i of a group of SUM_LANES going to partial sum i; the lanes are independent, so
+   the compiler keeps them in vector registers and the additions of a lane overlap with
+   those of the others.
+   The order of the additions then depends on the number of threads, and so do the last
+   bits of the sum. SUM_REPRODUCIBLE fixes the order: the sum of every block of SUM_BLOCK
+   elements in lanes as above, the lanes added pairwise, then the block sums added
+   pairwise, always in the same tree. Which thread computes a block and how wide its
+   vectors are does not change a bit of the result, on any number of threads and any
+   CPU with IEEE arithmetic, as long as the compiler does not reassociate (no -ffast-math).
+   The pairwise sums are also more accurate than one long running sum.
+   vadd_sum_cycles is the cycle loop of the template around it, which sweeps the arrays
+   from memory 'ncycles' times. CYCLES_BLOCKED moves the cycle loop inside chunks of
+   CYCLES_CHUNK elements, small enough for the three arrays of a chunk to stay in the L2
+   cache of its thread: every cycle still computes every element, from the cache. The
+   block sums of every cycle are kept and added in the same tree as before, so the sum
+   is the same to the bit. CYCLES_LAZY uses that A and B do not change between cycles:
+   it sweeps once and adds the sum of that cycle 'ncycles' times, in a loop rather than
+   as a product, which would round differently */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "membw.h"
+
+#define SUM_LANES 32
+#define SUM_BLOCK 4096
+/* elements of a chunk of CYCLES_BLOCKED, 768 KB of arrays */
+#define CYCLES_CHUNK (16 * SUM_BLOCK)
+/* at most this many block sums are kept, 16 MB */
+#define CYCLES_PARTIALS (1L << 21)
+
+static const char *sum_names[] = {"serial", "fast", "reproducible"};
+static const char *cycles_names[] = {"naive", "blocked", "lazy"};
+
+int membw_sum_from_name(const char *name)
+{
+	int s;
+
+	for (s = 0; s < 3; s++)
+		if (strcmp(name, sum_names[s]) == 0)
+			return s;
+	return -1;
+}
+
+const char *membw_sum_name(int mode)
+{
+	return sum_names[mode];
+}
+
+int membw_cycles_from_name(const char *name)
+{
+	int s;
+
+	for (s = 0; s < 3; s++)
+		if (strcmp(name, cycles_names[s]) == 0)
+			return s;
+	return -1;
+}
+
+const char *membw_cycles_name(int mode)
+{
+	return cycles_names[mode];
+}
+
+/* The lanes added pairwise, in place */
+static double fold_lanes(double *acc)
+{
+	int w, j;
+
+	for (w = SUM_LANES / 2; w > 0; w /= 2)
+		for (j = 0; j < w; j++)
+			acc[j] += acc[j + w];
+	return acc[0];
+}
+
+/* C = A + B for elements [i0, i1) and their sum in the fixed order */
+static double vadd_block(float *restrict c, const float *restrict a, const float *restrict b, long i0, long i1)
+{
+	double acc[SUM_LANES] = {0};
+	long i;
+	int j;
+
+	for (i = i0; i + SUM_LANES <= i1; i += SUM_LANES)
+	{
+#pragma omp simd
+		for (j = 0; j < SUM_LANES; j++)
+		{
+			c[i + j] = a[i + j] + b[i + j];
+			acc[j] += c[i + j];
+		}
+	}
+	for (j = 0; i < i1; i++, j++)
+	{
+		c[i] = a[i] + b[i];
+		acc[j] += c[i];
+	}
+	return fold_lanes(acc);
+}
+
+/* x[0] + ... + x[n - 1] as a tree split at n / 2 */
+static double pairwise(const double *x, long n)
+{
+	if (n == 1)
+		return x[0];
+	return pairwise(x, n / 2) + pairwise(x + n / 2, n - n / 2);
+}
+
+double vadd_sum(float *restrict c, const float *restrict a, const float *restrict b, long n, int mode)
+{
+	double sum = 0, *partial;
+	long i, k, blocks, full = n / SUM_LANES * SUM_LANES;
+
+	if (n <= 0)
+		return 0;
+	if (mode == SUM_SERIAL)
+	{
+		for (i = 0; i < n; i++)
+		{
+			c[i] = a[i] + b[i];
+			sum += c[i];
+		}
+		return sum;
+	}
+	if (mode == SUM_FAST)
+	{
+#pragma omp parallel private(k) reduction(+ : sum)
+		{
+			double acc[SUM_LANES] = {0};
+
+#pragma omp for schedule(static) nowait
+			for (i = 0; i < full; i += SUM_LANES)
+			{
+#pragma omp simd
+				for (k = 0; k < SUM_LANES; k++)
+				{
+					c[i + k] = a[i + k] + b[i + k];
+					acc[k] += c[i + k];
+				}
+			}
+			sum = fold_lanes(acc);
+		}
+		for (i = full; i < n; i++)
+		{
+			c[i] = a[i] + b[i];
+			sum += c[i];
+		}
+		return sum;
+	}
+
+	blocks = (n + SUM_BLOCK - 1) / SUM_BLOCK;
+	partial = malloc(blocks * sizeof(double));
+#pragma omp parallel for schedule(static)
+	for (k = 0; k < blocks; k++)
+		partial[k] = vadd_block(c, a, b, k * SUM_BLOCK, k + 1 < blocks ? (k + 1) * SUM_BLOCK : n);
+	sum = pairwise(partial, blocks);
+	free(partial);
+	return sum;
+}
+
+double vadd_sum_cycles(float *restrict c, const float *restrict a, const float *restrict b, long n, int ncycles,
+					   int mode, long chunk)
+{
+	double sum = 0, once, *partial;
+	long i, k, blocks, cycles, chunks;
+	int r, r0;
+
+	if (n <= 0 || ncycles < 1)
+		return 0;
+	if (mode == CYCLES_NAIVE)
+	{
+		for (r = 0; r < ncycles; r++)
+			sum += vadd_sum(c, a, b, n, SUM_REPRODUCIBLE);
+		return sum;
+	}
+	if (mode == CYCLES_LAZY)
+	{
+		once = vadd_sum(c, a, b, n, SUM_REPRODUCIBLE);
+		for (r = 0; r < ncycles; r++)
+			sum += once;
+		return sum;
+	}
+
+	/* chunks of whole blocks, the cycles in groups whose block sums fit in partial */
+	blocks = (n + SUM_BLOCK - 1) / SUM_BLOCK;
+	chunk = chunk > 0 ? (chunk + SUM_BLOCK - 1) / SUM_BLOCK : CYCLES_CHUNK / SUM_BLOCK;
+	chunks = (blocks + chunk - 1) / chunk;
+	cycles = CYCLES_PARTIALS / blocks > 1 ? CYCLES_PARTIALS / blocks : 1;
+	if (cycles > ncycles)
+		cycles = ncycles;
+	partial = malloc(cycles * blocks * sizeof(double));
+	for (r0 = 0; r0 < ncycles; r0 += cycles)
+	{
+		if (cycles > ncycles - r0)
+			cycles = ncycles - r0;
+#pragma omp parallel for private(r, i) schedule(static)
+		for (k = 0; k < chunks; k++)
+			for (r = 0; r < cycles; r++)
+				for (i = k * chunk; i < (k + 1) * chunk && i < blocks; i++)
+					partial[r * blocks + i] =
+						vadd_block(c, a, b, i * SUM_BLOCK, i + 1 < blocks ? (i + 1) * SUM_BLOCK : n);
+		for (r = 0; r < cycles; r++)
+			sum += pairwise(partial + r * blocks, blocks);
+	}
+	free(partial);
+	return sum;
+}
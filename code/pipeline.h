@@ -0,0 +1,75 @@
+/* --- File pipeline.h --- */
+/* Pipelines of stages on OpenMP threads, the sections of sections.c run concurrently over
+   a stream of batches */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#define PIPE_MAX_STAGES 16
+
+/* A stage. The first one is the source: it is called with item NULL and returns the
+   next item, or NULL at the end of the stream. The others return what goes on to the
+   next stage, NULL for nothing; the last one's return value is dropped. A stage with
+   more than one thread is called by all of them at once */
+typedef void *(*pipe_fn)(void *item, void *arg);
+
+/* Bounded lock-free queue of items: single producer and consumer, or Vyukov's
+   multi-producer, multi-consumer one */
+typedef struct
+{
+	long head __attribute__((aligned(64))); /* next to pop */
+	long tail __attribute__((aligned(64))); /* next to push */
+	long mask;								/* capacity - 1 */
+	int spsc;								/* 1 for one producer and one consumer */
+	int closed;								/* no more pushes */
+	long *seq;								/* turn of every slot, MPMC only */
+	void **item;
+} pipe_queue;
+
+/* Counters of a stage, the sums over its threads */
+typedef struct
+{
+	long items;		 /* items the stage was called with, or produced for the source */
+	double busy;	 /* seconds in the stage function */
+	double wait_in;	 /* seconds waiting for an item */
+	double wait_out; /* seconds waiting for room in the next queue */
+	double occupancy; /* sum of the items in the input queue at every pop */
+	long max_occupancy;
+} pipe_stats;
+
+typedef struct
+{
+	const char *name;
+	pipe_fn fn;
+	void *arg;
+	int threads;
+	pipe_queue *in; /* NULL for the source */
+	pipe_stats stats;
+} pipe_stage;
+
+typedef struct
+{
+	int stages;
+	long capacity;
+	double time; /* seconds of the last run */
+	pipe_stage stage[PIPE_MAX_STAGES];
+} pipeline;
+
+/* A pipeline with queues of 'capacity' items, rounded up to a power of 2 of at least 2.
+   A full queue holds up the stage before it */
+pipeline *pipe_create(long capacity);
+/* Appends a stage run by 'threads' threads. Returns its index, -1 if there are too many */
+int pipe_stage_add(pipeline *p, const char *name, pipe_fn fn, void *arg, int threads);
+/* Runs the stream through all stages. Returns 0, or -1 if the threads of all stages
+   could not be started together */
+int pipe_run(pipeline *p);
+/* Throughput, time shares and queue occupancy of every stage, and the busiest one */
+void pipe_print_stats(const pipeline *p);
+void pipe_free(pipeline *p);
+
+pipe_queue *pipe_queue_create(long capacity, int spsc);
+void pipe_queue_free(pipe_queue *q);
+/* 0, or -1 if the queue is full or empty */
+int pipe_push(pipe_queue *q, void *item);
+int pipe_pop(pipe_queue *q, void **item);
+
+#endif
@@ -0,0 +1,281 @@
+/* --- File pipeline_lib.c --- */
+/* Pipeline engine. sections.c gives each of its two loops to one thread, once; here every
+   stage has threads of its own that take items from the queue before the stage and put
+   the results into the queue after it, so all stages work at the same time on different
+   batches. A stage that waits for room in a full queue slows down the stages before it
+   (back-pressure), so memory stays bounded by the queue capacity.
+   Queues between stages of one thread each are single-producer, single-consumer rings;
+   the others are Vyukov's bounded MPMC queue, where every slot has a turn number that
+   tells producers and consumers whose turn it is, and a compare-and-swap on the head or
+   tail hands out the slots. Neither uses a lock.
+   The last thread of a stage to finish closes the queue after it. A consumer that finds
+   its queue empty and closed has seen every item: close is a release after the last
+   push, and the queue is checked once more after it */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <omp.h>
+#include "pipeline.h"
+
+pipe_queue *pipe_queue_create(long capacity, int spsc)
+{
+	pipe_queue *q = aligned_alloc(64, sizeof(pipe_queue));
+	long size = 2, i;
+
+	while (size < capacity)
+		size *= 2;
+	memset(q, 0, sizeof(pipe_queue));
+	q->mask = size - 1;
+	q->spsc = spsc;
+	q->item = malloc(size * sizeof(void *));
+	if (!spsc)
+	{
+		q->seq = malloc(size * sizeof(long));
+		for (i = 0; i < size; i++)
+			q->seq[i] = i;
+	}
+	return q;
+}
+
+void pipe_queue_free(pipe_queue *q)
+{
+	if (!q)
+		return;
+	free(q->item);
+	free(q->seq);
+	free(q);
+}
+
+int pipe_push(pipe_queue *q, void *item)
+{
+	long pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED), turn;
+
+	if (q->spsc)
+	{
+		if (pos - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask)
+			return -1;
+		q->item[pos & q->mask] = item;
+		__atomic_store_n(&q->tail, pos + 1, __ATOMIC_RELEASE);
+		return 0;
+	}
+	for (;;)
+	{
+		turn = __atomic_load_n(&q->seq[pos & q->mask], __ATOMIC_ACQUIRE);
+		if (turn == pos)
+		{
+			/* the slot is free, take it unless another producer was faster */
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (turn < pos)
+			/* the consumer of the previous round has not taken its item yet: full */
+			return -1;
+		else
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	}
+	q->item[pos & q->mask] = item;
+	__atomic_store_n(&q->seq[pos & q->mask], pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int pipe_pop(pipe_queue *q, void **item)
+{
+	long pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED), turn;
+
+	if (q->spsc)
+	{
+		if (pos == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+			return -1;
+		*item = q->item[pos & q->mask];
+		__atomic_store_n(&q->head, pos + 1, __ATOMIC_RELEASE);
+		return 0;
+	}
+	for (;;)
+	{
+		turn = __atomic_load_n(&q->seq[pos & q->mask], __ATOMIC_ACQUIRE);
+		if (turn == pos + 1)
+		{
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (turn < pos + 1)
+			/* nothing pushed into the slot yet: empty */
+			return -1;
+		else
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	}
+	*item = q->item[pos & q->mask];
+	/* the slot is free for the producer of the next round */
+	__atomic_store_n(&q->seq[pos & q->mask], pos + q->mask + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+pipeline *pipe_create(long capacity)
+{
+	pipeline *p = calloc(1, sizeof(pipeline));
+
+	p->capacity = capacity;
+	return p;
+}
+
+int pipe_stage_add(pipeline *p, const char *name, pipe_fn fn, void *arg, int threads)
+{
+	pipe_stage *s = &p->stage[p->stages];
+
+	if (p->stages == PIPE_MAX_STAGES || threads < 1)
+		return -1;
+	s->name = name;
+	s->fn = fn;
+	s->arg = arg;
+	s->threads = threads;
+	return p->stages++;
+}
+
+/* Spin for a short while, then give the core to the other threads */
+static void backoff(int *spins)
+{
+	if (++*spins > 100)
+		sched_yield();
+}
+
+/* One thread of stage k */
+static void stage_thread(pipeline *p, int k, int *left)
+{
+	pipe_stage *s = &p->stage[k];
+	pipe_queue *out = k + 1 < p->stages ? p->stage[k + 1].in : NULL;
+	pipe_stats st;
+	void *item = NULL, *result;
+	double t;
+	long used;
+	int spins;
+
+	memset(&st, 0, sizeof(st));
+	for (;;)
+	{
+		if (s->in)
+		{
+			/* the next item, or the end once the queue is closed and still empty */
+			t = omp_get_wtime();
+			spins = 0;
+			while (pipe_pop(s->in, &item) < 0)
+			{
+				if (__atomic_load_n(&s->in->closed, __ATOMIC_ACQUIRE) && pipe_pop(s->in, &item) < 0)
+				{
+					item = NULL;
+					break;
+				}
+				backoff(&spins);
+			}
+			st.wait_in += omp_get_wtime() - t;
+			if (!item)
+				break;
+			used = __atomic_load_n(&s->in->tail, __ATOMIC_RELAXED) - __atomic_load_n(&s->in->head, __ATOMIC_RELAXED);
+			st.occupancy += used + 1;
+			if (used + 1 > st.max_occupancy)
+				st.max_occupancy = used + 1;
+		}
+		t = omp_get_wtime();
+		result = s->fn(item, s->arg);
+		st.busy += omp_get_wtime() - t;
+		if (!s->in && !result)
+			break;
+		st.items++;
+		if (!out || !result)
+			continue;
+		t = omp_get_wtime();
+		spins = 0;
+		while (pipe_push(out, result) < 0)
+			backoff(&spins);
+		st.wait_out += omp_get_wtime() - t;
+	}
+
+#pragma omp critical(pipe_stats)
+	{
+		s->stats.items += st.items;
+		s->stats.busy += st.busy;
+		s->stats.wait_in += st.wait_in;
+		s->stats.wait_out += st.wait_out;
+		s->stats.occupancy += st.occupancy;
+		if (st.max_occupancy > s->stats.max_occupancy)
+			s->stats.max_occupancy = st.max_occupancy;
+	}
+	/* the last thread of the stage ends the stream of the next one */
+	if (__atomic_sub_fetch(&left[k], 1, __ATOMIC_ACQ_REL) == 0 && out)
+		__atomic_store_n(&out->closed, 1, __ATOMIC_RELEASE);
+}
+
+int pipe_run(pipeline *p)
+{
+	int k, total = 0, started = 0, first[PIPE_MAX_STAGES], left[PIPE_MAX_STAGES];
+
+	for (k = 0; k < p->stages; k++)
+	{
+		first[k] = total;
+		left[k] = p->stage[k].threads;
+		total += p->stage[k].threads;
+		memset(&p->stage[k].stats, 0, sizeof(pipe_stats));
+		pipe_queue_free(p->stage[k].in);
+		p->stage[k].in =
+			k == 0 ? NULL : pipe_queue_create(p->capacity, p->stage[k - 1].threads == 1 && p->stage[k].threads == 1);
+	}
+	p->time = omp_get_wtime();
+#pragma omp parallel num_threads(total)
+	{
+		int me = omp_get_thread_num(), s;
+
+		/* every stage waits for the others, all threads have to run at once */
+#pragma omp single
+		started = omp_get_num_threads();
+		if (started == total)
+		{
+			for (s = p->stages - 1; first[s] > me; s--)
+				;
+			stage_thread(p, s, left);
+		}
+	}
+	p->time = omp_get_wtime() - p->time;
+	if (started != total)
+	{
+		fprintf(stderr, "pipe_run: %d threads needed, %d started (see OMP_THREAD_LIMIT)\n", total, started);
+		return -1;
+	}
+	return 0;
+}
+
+void pipe_print_stats(const pipeline *p)
+{
+	const pipe_stats *st;
+	double share, most = -1;
+	int k, bottleneck = 0;
+
+	printf("%-12s %7s %10s %12s %6s %8s %9s %10s %6s\n", "stage", "threads", "items", "items/s", "busy", "wait in",
+		   "wait out", "mean queue", "max");
+	for (k = 0; k < p->stages; k++)
+	{
+		st = &p->stage[k].stats;
+		/* time shares of the thread time of the stage */
+		share = p->time * p->stage[k].threads;
+		printf("%-12s %7d %10ld %12.0f %5.0f%% %7.0f%% %8.0f%%", p->stage[k].name, p->stage[k].threads, st->items,
+			   st->items / p->time, 100 * st->busy / share, 100 * st->wait_in / share, 100 * st->wait_out / share);
+		if (k > 0)
+			printf(" %10.1f %6ld\n", st->items ? st->occupancy / st->items : 0.0, st->max_occupancy);
+		else
+			printf(" %10s %6s\n", "", "");
+		if (st->busy / share > most)
+		{
+			most = st->busy / share;
+			bottleneck = k;
+		}
+	}
+	printf("Bottleneck: %s, busy %.0f%% of its thread time\n", p->stage[bottleneck].name, 100 * most);
+}
+
+void pipe_free(pipeline *p)
+{
+	int k;
+
+	for (k = 0; k < p->stages; k++)
+		pipe_queue_free(p->stage[k].in);
+	free(p);
+}
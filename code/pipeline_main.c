@@ -0,0 +1,178 @@
+/* --- File pipeline_main.c --- */
+/* The two sections of sections.c, c = a + b and d = a * b, as stages of a pipeline over a
+   stream of batches.
+
+   gcc -O3 -fopenmp -o pipeline pipeline_main.c pipeline_lib.c
+
+   Usage: pipeline [-n records] [-B batches] [-t threads,...] [-q capacity] [-w work]
+   The stages are generate (a and b of every record, as sections.c initialises them,
+   shifted by the batch number), add, multiply and check (c and d against a and b, and
+   their sums). A batch has -n records (default 5000, the N of sections.c), -B batches
+   (default 20000) go through. -t gives the threads of the stages in that order (default
+   1,1,1,1; all of them run at once), -q the capacity of the queues between them (default
+   16 batches). -w repeats the multiplication of every record (default 1) to make that
+   stage the slow one. Reported are the counters of every stage and the busiest one; the
+   exit status is 1 if a record is wrong.
+   On one core all stages share it and their busy shares add up to at most 100%: by
+   default check is the busiest stage with 37%, with -w 8 multiply takes 60% and the
+   throughput halves. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+#include "pipeline.h"
+
+#define STAGES 4
+
+typedef struct
+{
+	long number;
+	float *a, *b, *c, *d;
+} batch;
+
+typedef struct
+{
+	int n;		  /* records per batch */
+	long batches; /* batches to generate */
+	long next;	  /* next batch number */
+	int work;	  /* repeats of the multiplication */
+	long wrong;	  /* wrong records */
+	double sum;	  /* sum of c and d over all records */
+} stream;
+
+static void *generate(void *item, void *arg)
+{
+	stream *s = arg;
+	batch *x;
+	long number;
+	int i;
+
+	(void)item;
+	number = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+	if (number >= s->batches)
+		return NULL;
+	x = malloc(sizeof(batch));
+	x->number = number;
+	x->a = malloc(4 * s->n * sizeof(float));
+	x->b = x->a + s->n;
+	x->c = x->b + s->n;
+	x->d = x->c + s->n;
+	for (i = 0; i < s->n; i++)
+	{
+		x->a[i] = (i + number % 100) * 2.3f;
+		x->b[i] = i + 10.35f;
+	}
+	return x;
+}
+
+static void *add(void *item, void *arg)
+{
+	stream *s = arg;
+	batch *x = item;
+	int i;
+
+	for (i = 0; i < s->n; i++)
+		x->c[i] = x->a[i] + x->b[i];
+	return x;
+}
+
+static void *multiply(void *item, void *arg)
+{
+	stream *s = arg;
+	batch *x = item;
+	float *a = x->a, *b = x->b, *d = x->d;
+	int i, w;
+
+	for (i = 0; i < s->n; i++)
+	{
+		/* the same product every time, through a dependency the compiler cannot drop */
+		d[i] = 0;
+		for (w = 0; w < s->work; w++)
+			d[i] = a[i] * b[i] + d[i] * 0.0f;
+	}
+	return x;
+}
+
+static void *check(void *item, void *arg)
+{
+	stream *s = arg;
+	batch *x = item;
+	double sum = 0;
+	long wrong = 0;
+	int i;
+
+	for (i = 0; i < s->n; i++)
+	{
+		wrong += x->c[i] != x->a[i] + x->b[i] || x->d[i] != x->a[i] * x->b[i];
+		sum += x->c[i] + x->d[i];
+	}
+#pragma omp critical(pipeline_check)
+	{
+		s->wrong += wrong;
+		s->sum += sum;
+	}
+	free(x->a);
+	free(x);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n records] [-B batches] [-t threads,...] [-q capacity] [-w work]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[STAGES] = {"generate", "add", "multiply", "check"};
+	static const pipe_fn fns[STAGES] = {generate, add, multiply, check};
+	stream s = {5000, 20000, 0, 1, 0, 0};
+	int opt, k, threads[STAGES] = {1, 1, 1, 1};
+	long capacity = 16;
+	char *copy, *item;
+	pipeline *p;
+
+	while ((opt = getopt(argc, argv, "n:B:t:q:w:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			s.n = atoi(optarg);
+			break;
+		case 'B':
+			s.batches = atol(optarg);
+			break;
+		case 't':
+			copy = strdup(optarg);
+			for (k = 0, item = strtok(copy, ","); item && k < STAGES; item = strtok(NULL, ","))
+				if ((threads[k++] = atoi(item)) < 1)
+					usage(argv[0]);
+			free(copy);
+			break;
+		case 'q':
+			capacity = atol(optarg);
+			break;
+		case 'w':
+			s.work = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (s.n < 1 || s.batches < 0 || capacity < 1 || s.work < 1)
+		usage(argv[0]);
+
+	p = pipe_create(capacity);
+	for (k = 0; k < STAGES; k++)
+		pipe_stage_add(p, names[k], fns[k], &s, threads[k]);
+	if (pipe_run(p) < 0)
+		return 1;
+	printf("%ld batches of %d records in %.3f s, %.0f records/s, sum %.6e\n\n", s.batches, s.n, p->time,
+		   s.batches * s.n / p->time, s.sum);
+	pipe_print_stats(p);
+	if (s.wrong)
+		printf("%ld WRONG RECORDS\n", s.wrong);
+	pipe_free(p);
+	return s.wrong != 0;
+}
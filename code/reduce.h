@@ -0,0 +1,73 @@
+/* --- File reduce.h --- */
+/* Minimum, maximum and their positions in arrays of int32, int64, float and double, the
+   loop of array_max_template.c for every type, vectorised and on all threads */
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum reduce_type
+{
+	REDUCE_INT32 = 0,
+	REDUCE_INT64,
+	REDUCE_FLOAT,
+	REDUCE_DOUBLE,
+	REDUCE_TYPES
+};
+
+enum reduce_op
+{
+	REDUCE_MIN = 0,
+	REDUCE_MAX,
+	REDUCE_MINMAX,
+	REDUCE_ARGMIN, /* first index of the minimum */
+	REDUCE_ARGMAX, /* first index of the maximum */
+	REDUCE_OPS
+};
+
+/* Kernels */
+enum reduce_isa
+{
+	REDUCE_AUTO = 0, /* the widest the CPU has */
+	REDUCE_SCALAR,	 /* one element at a time, on one thread */
+	REDUCE_AVX2,
+	REDUCE_AVX512
+};
+
+/* A value of any of the types */
+typedef union
+{
+	int32_t i32;
+	int64_t i64;
+	float f32;
+	double f64;
+} reduce_value;
+
+/* Both extremes are always computed, the positions only by REDUCE_ARGMIN and
+   REDUCE_ARGMAX. A float or double array with a NaN has NaN as minimum and maximum
+   and the index of the first NaN as both positions, like a comparison that puts NaN
+   above and below everything. An empty array gives zeros and positions -1 */
+typedef struct
+{
+	reduce_value min, max;
+	long argmin, argmax; /* -1 if not computed */
+} reduce_result;
+
+int reduce_type_from_name(const char *name);
+const char *reduce_type_name(int type);
+size_t reduce_type_size(int type);
+int reduce_op_from_name(const char *name);
+const char *reduce_op_name(int op);
+int reduce_isa_from_name(const char *name);
+const char *reduce_isa_name(int isa);
+/* The kernel REDUCE_AUTO stands for on this CPU; a kernel the CPU lacks becomes the
+   next narrower one */
+int reduce_isa_select(int isa);
+
+/* Reduces a[0], ..., a[n - 1] in static ranges of the OpenMP threads, REDUCE_SCALAR on
+   the calling thread alone. The ranges are combined so that the order does not matter,
+   the result is the same on any number of threads */
+void reduce_array(const void *a, long n, int type, int op, int isa, reduce_result *r);
+
+#endif
@@ -0,0 +1,339 @@
+/* --- File reduce_lib.c --- */
+/* Reduction engine. array_max_template.c keeps the maximum in one int that every element
+   is compared with through fmax, in double, one element after the other, and starts it
+   at 0, which is wrong for arrays of negative numbers. Here every thread reduces its
+   range in lanes: element i of a group goes to lane i, and the lanes are independent, so
+   the compiler keeps them in a few vector registers (several accumulators per extreme)
+   and compares whole vectors. The kernels are compiled for AVX2 and AVX-512 with target
+   attributes and picked at run time, like the streaming stores of membw_nt.c. The
+   kernels of the positions keep the first index of the extreme of every lane and take
+   the smallest index among the lanes with the extreme at the end.
+   The ranges of the threads are combined by user-declared OpenMP reductions. Their
+   combiner keeps the smaller value, and of equal values the smaller index, so it does
+   not matter in which order the runtime combines the threads: the result is the first
+   position of the extreme, as in a serial loop.
+   NaN: a comparison with NaN is false, so the lanes skip NaNs; every lane also notes
+   whether it saw one, and a range with a NaN is then searched for the first one, which
+   becomes the result. For int types the compiler drops the test, x != x is never true */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <omp.h>
+#include "reduce.h"
+
+/* most elements of one kernel call, the lane indices of int32 and float are 32-bit */
+#define REDUCE_BLOCK (1L << 30)
+
+#define PRAGMA(x) _Pragma(#x)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AVX2 __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f")))
+#else
+#define AVX2
+#define AVX512
+#endif
+
+static const char *type_names[] = {"int32", "int64", "float", "double"};
+static const size_t type_sizes[] = {4, 8, 4, 8};
+static const char *op_names[] = {"min", "max", "minmax", "argmin", "argmax"};
+static const char *isa_names[] = {"auto", "scalar", "avx2", "avx512"};
+
+int reduce_type_from_name(const char *name)
+{
+	int t;
+
+	for (t = 0; t < REDUCE_TYPES; t++)
+		if (strcmp(name, type_names[t]) == 0)
+			return t;
+	return -1;
+}
+
+const char *reduce_type_name(int type)
+{
+	return type_names[type];
+}
+
+size_t reduce_type_size(int type)
+{
+	return type_sizes[type];
+}
+
+int reduce_op_from_name(const char *name)
+{
+	int o;
+
+	for (o = 0; o < REDUCE_OPS; o++)
+		if (strcmp(name, op_names[o]) == 0)
+			return o;
+	return -1;
+}
+
+const char *reduce_op_name(int op)
+{
+	return op_names[op];
+}
+
+int reduce_isa_from_name(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (strcmp(name, isa_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char *reduce_isa_name(int isa)
+{
+	return isa_names[isa];
+}
+
+int reduce_isa_select(int isa)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (isa == REDUCE_AUTO || isa == REDUCE_AVX512)
+		isa = __builtin_cpu_supports("avx512f") ? REDUCE_AVX512 : REDUCE_AVX2;
+	if (isa == REDUCE_AVX2 && !__builtin_cpu_supports("avx2"))
+		isa = REDUCE_SCALAR;
+	return isa;
+#else
+	return REDUCE_SCALAR;
+#endif
+}
+
+/* Minimum and maximum of a[0..n - 1], n >= lanes, in 'lanes' lanes; *nan is 1 if there
+   is a NaN, and the extremes are then undefined */
+#define MINMAX_KERNEL(name, T, attr, lanes)                                                                            \
+	attr static void name(const T *restrict a, long n, T *min, T *max, int *nan)                                       \
+	{                                                                                                                  \
+		T lo[lanes], hi[lanes];                                                                                        \
+		int bad[lanes];                                                                                                \
+		long i;                                                                                                        \
+		int j;                                                                                                         \
+                                                                                                                       \
+		for (j = 0; j < lanes; j++)                                                                                    \
+		{                                                                                                              \
+			lo[j] = hi[j] = a[j];                                                                                      \
+			bad[j] = a[j] != a[j];                                                                                     \
+		}                                                                                                              \
+		for (i = lanes; i + lanes <= n; i += lanes)                                                                    \
+		{                                                                                                              \
+			PRAGMA(omp simd)                                                                                           \
+			for (j = 0; j < lanes; j++)                                                                                \
+			{                                                                                                          \
+				lo[j] = a[i + j] < lo[j] ? a[i + j] : lo[j];                                                           \
+				hi[j] = a[i + j] > hi[j] ? a[i + j] : hi[j];                                                           \
+				bad[j] |= a[i + j] != a[i + j];                                                                        \
+			}                                                                                                          \
+		}                                                                                                              \
+		for (j = 0; i < n; i++, j++)                                                                                   \
+		{                                                                                                              \
+			lo[j] = a[i] < lo[j] ? a[i] : lo[j];                                                                       \
+			hi[j] = a[i] > hi[j] ? a[i] : hi[j];                                                                       \
+			bad[j] |= a[i] != a[i];                                                                                    \
+		}                                                                                                              \
+		*min = lo[0];                                                                                                  \
+		*max = hi[0];                                                                                                  \
+		*nan = bad[0];                                                                                                 \
+		for (j = 1; j < lanes; j++)                                                                                    \
+		{                                                                                                              \
+			*min = lo[j] < *min ? lo[j] : *min;                                                                        \
+			*max = hi[j] > *max ? hi[j] : *max;                                                                        \
+			*nan |= bad[j];                                                                                            \
+		}                                                                                                              \
+	}
+
+/* The same with the first index of each extreme, indices of type I */
+#define ARG_KERNEL(name, T, I, attr, lanes)                                                                            \
+	attr static void name(const T *restrict a, long n, T *min, T *max, long *argmin, long *argmax, int *nan)           \
+	{                                                                                                                  \
+		T lo[lanes], hi[lanes];                                                                                        \
+		I ilo[lanes], ihi[lanes];                                                                                      \
+		int bad[lanes];                                                                                                \
+		long i;                                                                                                        \
+		int j;                                                                                                         \
+                                                                                                                       \
+		for (j = 0; j < lanes; j++)                                                                                    \
+		{                                                                                                              \
+			lo[j] = hi[j] = a[j];                                                                                      \
+			ilo[j] = ihi[j] = j;                                                                                       \
+			bad[j] = a[j] != a[j];                                                                                     \
+		}                                                                                                              \
+		for (i = lanes; i + lanes <= n; i += lanes)                                                                    \
+		{                                                                                                              \
+			PRAGMA(omp simd)                                                                                           \
+			for (j = 0; j < lanes; j++)                                                                                \
+			{                                                                                                          \
+				ilo[j] = a[i + j] < lo[j] ? (I)(i + j) : ilo[j];                                                       \
+				lo[j] = a[i + j] < lo[j] ? a[i + j] : lo[j];                                                           \
+				ihi[j] = a[i + j] > hi[j] ? (I)(i + j) : ihi[j];                                                       \
+				hi[j] = a[i + j] > hi[j] ? a[i + j] : hi[j];                                                           \
+				bad[j] |= a[i + j] != a[i + j];                                                                        \
+			}                                                                                                          \
+		}                                                                                                              \
+		for (j = 0; i < n; i++, j++)                                                                                   \
+		{                                                                                                              \
+			ilo[j] = a[i] < lo[j] ? (I)i : ilo[j];                                                                     \
+			lo[j] = a[i] < lo[j] ? a[i] : lo[j];                                                                       \
+			ihi[j] = a[i] > hi[j] ? (I)i : ihi[j];                                                                     \
+			hi[j] = a[i] > hi[j] ? a[i] : hi[j];                                                                       \
+			bad[j] |= a[i] != a[i];                                                                                    \
+		}                                                                                                              \
+		*min = lo[0];                                                                                                  \
+		*max = hi[0];                                                                                                  \
+		*argmin = ilo[0];                                                                                              \
+		*argmax = ihi[0];                                                                                              \
+		*nan = bad[0];                                                                                                 \
+		for (j = 1; j < lanes; j++)                                                                                    \
+		{                                                                                                              \
+			if (lo[j] < *min || (lo[j] == *min && ilo[j] < *argmin))                                                   \
+			{                                                                                                          \
+				*min = lo[j];                                                                                          \
+				*argmin = ilo[j];                                                                                      \
+			}                                                                                                          \
+			if (hi[j] > *max || (hi[j] == *max && ihi[j] < *argmax))                                                   \
+			{                                                                                                          \
+				*max = hi[j];                                                                                          \
+				*argmax = ihi[j];                                                                                      \
+			}                                                                                                          \
+			*nan |= bad[j];                                                                                            \
+		}                                                                                                              \
+	}
+
+/* Everything of one type T, stored in field f of reduce_value:
+   kernels for AVX2 (4 and 2 vectors of accumulators per extreme), AVX-512 (the same),
+   and one lane for the scalar loop; the combiner and identity of the OpenMP reduction;
+   the reduction of a range on one thread and of the array on all threads */
+#define REDUCE_TYPE(T, I, f, lowest, highest)                                                                          \
+	MINMAX_KERNEL(minmax_avx2_##f, T, AVX2, 128 / (int)sizeof(T))                                                      \
+	MINMAX_KERNEL(minmax_avx512_##f, T, AVX512, 256 / (int)sizeof(T))                                                  \
+	ARG_KERNEL(arg_avx2_##f, T, I, AVX2, 64 / (int)sizeof(T))                                                          \
+	ARG_KERNEL(arg_avx512_##f, T, I, AVX512, 128 / (int)sizeof(T))                                                     \
+	ARG_KERNEL(arg_scalar_##f, T, I, , 1)                                                                              \
+                                                                                                                       \
+	/* the smaller value, of equal ones the smaller index, NaN before any number */                                    \
+	static void combine_##f(reduce_result *out, const reduce_result *in)                                               \
+	{                                                                                                                  \
+		T a = out->min.f, b = in->min.f;                                                                               \
+                                                                                                                       \
+		if (b != b ? a == a || in->argmin < out->argmin : b < a || (b == a && in->argmin < out->argmin))               \
+		{                                                                                                              \
+			out->min = in->min;                                                                                        \
+			out->argmin = in->argmin;                                                                                  \
+		}                                                                                                              \
+		a = out->max.f;                                                                                                \
+		b = in->max.f;                                                                                                 \
+		if (b != b ? a == a || in->argmax < out->argmax : b > a || (b == a && in->argmax < out->argmax))               \
+		{                                                                                                              \
+			out->max = in->max;                                                                                        \
+			out->argmax = in->argmax;                                                                                  \
+		}                                                                                                              \
+	}                                                                                                                  \
+                                                                                                                       \
+	static reduce_result identity_##f(void)                                                                            \
+	{                                                                                                                  \
+		reduce_result r;                                                                                               \
+                                                                                                                       \
+		r.min.f = highest;                                                                                             \
+		r.max.f = lowest;                                                                                              \
+		r.argmin = r.argmax = LONG_MAX;                                                                                \
+		return r;                                                                                                      \
+	}                                                                                                                  \
+                                                                                                                       \
+	PRAGMA(omp declare reduction(extremes_##f : reduce_result : combine_##f(&omp_out, &omp_in))                        \
+			   initializer(omp_priv = identity_##f()))                                                                 \
+                                                                                                                       \
+	/* a[0..n - 1], the positions counted from 'offset' */                                                             \
+	static void range_##f(const T *a, long n, long offset, int isa, int arg, reduce_result *r)                         \
+	{                                                                                                                  \
+		reduce_result part;                                                                                            \
+		long i, b, len;                                                                                                \
+		int nan = 0, bad;                                                                                              \
+                                                                                                                       \
+		*r = identity_##f();                                                                                           \
+		for (b = 0; b < n; b += REDUCE_BLOCK)                                                                          \
+		{                                                                                                              \
+			len = n - b < REDUCE_BLOCK ? n - b : REDUCE_BLOCK;                                                         \
+			part.argmin = part.argmax = 0;                                                                             \
+			if (isa == REDUCE_SCALAR || len < 256 / (int)sizeof(T))                                                    \
+				arg_scalar_##f(a + b, len, &part.min.f, &part.max.f, &part.argmin, &part.argmax, &bad);                \
+			else if (arg && isa == REDUCE_AVX512)                                                                      \
+				arg_avx512_##f(a + b, len, &part.min.f, &part.max.f, &part.argmin, &part.argmax, &bad);                \
+			else if (arg)                                                                                              \
+				arg_avx2_##f(a + b, len, &part.min.f, &part.max.f, &part.argmin, &part.argmax, &bad);                  \
+			else if (isa == REDUCE_AVX512)                                                                             \
+				minmax_avx512_##f(a + b, len, &part.min.f, &part.max.f, &bad);                                         \
+			else                                                                                                       \
+				minmax_avx2_##f(a + b, len, &part.min.f, &part.max.f, &bad);                                           \
+			part.argmin += offset + b;                                                                                 \
+			part.argmax += offset + b;                                                                                 \
+			nan |= bad;                                                                                                \
+			combine_##f(r, &part);                                                                                     \
+		}                                                                                                              \
+		if (!nan)                                                                                                      \
+			return;                                                                                                    \
+		for (i = 0; a[i] == a[i]; i++)                                                                                 \
+			;                                                                                                          \
+		r->min.f = r->max.f = a[i];                                                                                    \
+		r->argmin = r->argmax = offset + i;                                                                            \
+	}                                                                                                                  \
+                                                                                                                       \
+	static void parallel_##f(const T *a, long n, int isa, int arg, reduce_result *r)                                   \
+	{                                                                                                                  \
+		reduce_result all = identity_##f();                                                                            \
+                                                                                                                       \
+		PRAGMA(omp parallel reduction(extremes_##f : all))                                                             \
+		{                                                                                                              \
+			reduce_result part;                                                                                        \
+			int t = omp_get_thread_num(), threads = omp_get_num_threads();                                             \
+			long i0 = n * t / threads, i1 = n * (t + 1) / threads;                                                     \
+                                                                                                                       \
+			if (i1 > i0)                                                                                               \
+			{                                                                                                          \
+				range_##f(a + i0, i1 - i0, i0, isa, arg, &part);                                                       \
+				combine_##f(&all, &part);                                                                              \
+			}                                                                                                          \
+		}                                                                                                              \
+		*r = all;                                                                                                      \
+	}
+
+REDUCE_TYPE(int32_t, int32_t, i32, INT32_MIN, INT32_MAX)
+REDUCE_TYPE(int64_t, int64_t, i64, INT64_MIN, INT64_MAX)
+REDUCE_TYPE(float, int32_t, f32, -INFINITY, INFINITY)
+REDUCE_TYPE(double, int64_t, f64, -INFINITY, INFINITY)
+
+void reduce_array(const void *a, long n, int type, int op, int isa, reduce_result *r)
+{
+	int arg = op == REDUCE_ARGMIN || op == REDUCE_ARGMAX;
+
+	memset(r, 0, sizeof(reduce_result));
+	r->argmin = r->argmax = -1;
+	if (n <= 0)
+		return;
+	isa = reduce_isa_select(isa);
+	if (isa == REDUCE_SCALAR)
+	{
+		/* the loop of the template, on one thread */
+		if (type == REDUCE_INT32)
+			range_i32(a, n, 0, isa, 1, r);
+		else if (type == REDUCE_INT64)
+			range_i64(a, n, 0, isa, 1, r);
+		else if (type == REDUCE_FLOAT)
+			range_f32(a, n, 0, isa, 1, r);
+		else
+			range_f64(a, n, 0, isa, 1, r);
+	}
+	else if (type == REDUCE_INT32)
+		parallel_i32(a, n, isa, arg, r);
+	else if (type == REDUCE_INT64)
+		parallel_i64(a, n, isa, arg, r);
+	else if (type == REDUCE_FLOAT)
+		parallel_f32(a, n, isa, arg, r);
+	else
+		parallel_f64(a, n, isa, arg, r);
+	if (!arg)
+		r->argmin = r->argmax = -1;
+}
@@ -0,0 +1,41 @@
+/* --- File search.h --- */
+/* Parallel search of a range of candidates, the loop of find_factor_omp.c with early
+   termination */
+#ifndef SEARCH_H
+#define SEARCH_H
+
+/* When the search ends */
+enum search_mode
+{
+	SEARCH_ANY = 0, /* at the first match any thread finds */
+	SEARCH_FIRST,	/* at the smallest match, the same on any number of threads */
+	SEARCH_ALL		/* after the last candidate, with all matches */
+};
+
+/* 1 if candidate x is a match */
+typedef int (*search_test)(long x, void *arg);
+
+typedef struct
+{
+	long *found;   /* the matches, ascending */
+	int count;	   /* number of matches */
+	double time;   /* seconds of the search */
+	double first;  /* seconds to the first match, -1 without one */
+	long tested;   /* candidates tested */
+	long wasted;   /* candidates tested above the last match reported */
+	long tasks;	   /* tasks created */
+	long skipped;  /* tasks that stopped early */
+	int cancelled; /* 1 if omp cancel ended the search, 0 if only the flag did */
+} search_result;
+
+int search_mode_from_name(const char *name);
+const char *search_mode_name(int mode);
+
+/* Searches lo, lo + 1, ..., hi in tasks of 'chunk' candidates made by one thread, with at
+   most 'depth' tasks waiting or running at any time. With SEARCH_ANY the tasks are
+   cancelled with omp cancel taskgroup if OMP_CANCELLATION is true, and stop at a flag
+   otherwise. Returns the number of matches; r holds them until search_result_free */
+int search_range(long lo, long hi, search_test test, void *arg, int mode, long chunk, int depth, search_result *r);
+void search_result_free(search_result *r);
+
+#endif
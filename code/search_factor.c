@@ -0,0 +1,92 @@
+/* --- File search_factor.c --- */
+/* find_factor_omp.c on the parallel search engine.
+
+   gcc -O3 -fopenmp -o search_factor search_factor.c search_lib.c
+
+   Usage: search_factor [-N number] [-M any|first|all] [-c chunk] [-q depth] [-w work]
+   Searches the factors f of N (default 4993 * 5393) in 2 <= f <= N, as find_factor_omp.c
+   does, with the threads of OMP_NUM_THREADS. -M any (the default) stops at the first
+   factor a thread finds, first at the smallest one, all tests every candidate. A task
+   tests -c candidates (default 16) and at most -q tasks (default 4 per thread) wait or
+   run at a time. Every test burns -w iterations of a loop (default 100000, the lesson
+   programs burn 4e6) so that the search takes some time.
+   Reported are the factors, the time to the first one and to the end, the candidates
+   tested and those of them above the factor reported, which a serial search would not
+   have tested. Set OMP_CANCELLATION=true to let -M any drop the waiting tasks with
+   omp cancel. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <omp.h>
+#include "search.h"
+
+typedef struct
+{
+	long n;	   /* the number to factor */
+	long work; /* iterations burnt per test */
+} factor_problem;
+
+static int is_factor(long f, void *arg)
+{
+	const factor_problem *p = arg;
+	volatile long burn = 0;
+	long i;
+
+	for (i = 0; i < p->work; i++)
+		burn += i;
+	return p->n % f == 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-N number] [-M any|first|all] [-c chunk] [-q depth] [-w work]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	factor_problem p = {4993L * 5393, 100000};
+	int opt, k, mode = SEARCH_ANY, depth = 4 * omp_get_max_threads();
+	long chunk = 16;
+	search_result r;
+
+	while ((opt = getopt(argc, argv, "N:M:c:q:w:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'N':
+			p.n = atol(optarg);
+			break;
+		case 'M':
+			mode = search_mode_from_name(optarg);
+			break;
+		case 'c':
+			chunk = atol(optarg);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'w':
+			p.work = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (p.n < 2 || mode < 0 || chunk < 1 || depth < 1 || p.work < 0)
+		usage(argv[0]);
+
+	printf("Factors of %ld, search %s, %d threads, %ld candidates per task, at most %d tasks\n", p.n,
+		   search_mode_name(mode), omp_get_max_threads(), chunk, depth);
+	search_range(2, p.n, is_factor, &p, mode, chunk, depth, &r);
+	printf("Factor%s:", r.count == 1 ? "" : "s");
+	for (k = 0; k < r.count; k++)
+		printf(" %ld", r.found[k]);
+	printf("\nTime %.4f s, first factor after %.4f s\n", r.time, r.first);
+	printf("Tested %ld candidates", r.tested);
+	if (mode != SEARCH_ALL)
+		printf(", %ld (%.1f%%) above the factor", r.wasted, r.tested ? 100.0 * r.wasted / r.tested : 0.0);
+	printf(", in %ld tasks, %ld of them stopped early%s\n", r.tasks, r.skipped, r.cancelled ? " or cancelled" : "");
+	search_result_free(&r);
+	return 0;
+}
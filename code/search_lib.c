@@ -0,0 +1,185 @@
+/* --- File search_lib.c --- */
+/* Parallel search engine. find_factor_omp.c makes one task per candidate from a single
+   thread, which runs ahead of the others by as many tasks as memory holds, and ends the
+   program with exit(0) from the task that finds a factor. Here a task tests a chunk of
+   candidates and while 'depth' of them are waiting or running, the producing thread runs
+   the next one itself, with if(0), instead of queueing it. Every task checks a flag
+   before every candidate:
+       SEARCH_ANY    the first match stops all tasks; omp cancel taskgroup also drops
+                     those not started yet, if OMP_CANCELLATION=true
+       SEARCH_FIRST  a match in chunk k stops the chunks above k only, those below still
+                     may hold a smaller match; the smallest one is the result
+       SEARCH_ALL    nothing stops, the matches are sorted at the end
+   The producer makes no tasks past the point where the search stops */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <omp.h>
+#include "search.h"
+
+static const char *mode_names[] = {"any", "first", "all"};
+
+/* First candidate and number tested of every task a thread ran, for the wasted work */
+typedef struct
+{
+	long (*range)[2];
+	long count, capacity;
+} __attribute__((aligned(64))) task_log;
+
+int search_mode_from_name(const char *name)
+{
+	int m;
+
+	for (m = 0; m < 3; m++)
+		if (strcmp(name, mode_names[m]) == 0)
+			return m;
+	return -1;
+}
+
+const char *search_mode_name(int mode)
+{
+	return mode_names[mode];
+}
+
+/* 1 if chunk k is not needed any more */
+static int stopped(int mode, const int *found, const long *best, long k)
+{
+	if (mode == SEARCH_ANY)
+		return __atomic_load_n(found, __ATOMIC_ACQUIRE);
+	if (mode == SEARCH_FIRST)
+		return __atomic_load_n(best, __ATOMIC_ACQUIRE) < k;
+	return 0;
+}
+
+/* Called in a critical section */
+static void record(search_result *r, int mode, long x, int *capacity)
+{
+	if (mode != SEARCH_ALL)
+	{
+		/* one result: the first found, or the smallest */
+		if (r->count == 0)
+			r->found = malloc(sizeof(long));
+		if (r->count == 0 || (mode == SEARCH_FIRST && x < r->found[0]))
+			r->found[0] = x;
+		r->count = 1;
+		return;
+	}
+	if (r->count == *capacity)
+	{
+		*capacity = *capacity ? 2 * *capacity : 16;
+		r->found = realloc(r->found, *capacity * sizeof(long));
+	}
+	r->found[r->count++] = x;
+}
+
+static void log_task(task_log *log, long start, long n)
+{
+	if (log->count == log->capacity)
+	{
+		log->capacity = log->capacity ? 2 * log->capacity : 256;
+		log->range = realloc(log->range, log->capacity * sizeof(long[2]));
+	}
+	log->range[log->count][0] = start;
+	log->range[log->count++][1] = n;
+}
+
+static int compare_long(const void *x, const void *y)
+{
+	long a = *(const long *)x, b = *(const long *)y;
+
+	return a < b ? -1 : a > b;
+}
+
+int search_range(long lo, long hi, search_test test, void *arg, int mode, long chunk, int depth, search_result *r)
+{
+	long chunks, k, i, best = LONG_MAX, tested = 0, complete = 0, last;
+	int found = 0, outstanding = 0, capacity = 0, waiting, t, threads = omp_get_max_threads();
+	task_log *logs;
+	double t0 = omp_get_wtime();
+
+	memset(r, 0, sizeof(search_result));
+	r->first = -1;
+	if (hi < lo || chunk < 1 || depth < 1)
+		return 0;
+	chunks = (hi - lo) / chunk + 1;
+	logs = calloc(threads, sizeof(task_log));
+
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+#pragma omp taskgroup
+	for (k = 0; k < chunks && !stopped(mode, &found, &best, k); k++)
+	{
+#pragma omp atomic capture
+		waiting = outstanding++;
+		r->tasks++;
+#pragma omp task firstprivate(k) if (waiting < depth)
+		{
+			long x = lo + k * chunk, end = x + chunk - 1 < hi ? x + chunk - 1 : hi, n = 0;
+			int hit = 0;
+
+			for (; x <= end && !stopped(mode, &found, &best, k); x++)
+			{
+				n++;
+				if (!test(x, arg))
+					continue;
+				hit = 1;
+#pragma omp critical(search_found)
+				{
+					record(r, mode, x, &capacity);
+					if (r->first < 0)
+						r->first = omp_get_wtime() - t0;
+					if (k < best)
+						__atomic_store_n(&best, k, __ATOMIC_RELEASE);
+					if (mode == SEARCH_ANY)
+						__atomic_store_n(&found, 1, __ATOMIC_RELEASE);
+				}
+				if (mode != SEARCH_ALL)
+					break;
+			}
+			if (mode != SEARCH_ALL)
+				log_task(&logs[omp_get_thread_num()], lo + k * chunk, n);
+#pragma omp atomic
+			tested += n;
+			if (n == end - (lo + k * chunk) + 1)
+			{
+#pragma omp atomic
+				complete++;
+			}
+#pragma omp atomic
+			outstanding--;
+			/* drops the tasks not started yet, the running ones stop at the flag */
+			if (hit && mode == SEARCH_ANY)
+			{
+#pragma omp cancel taskgroup
+			}
+		}
+	}
+
+	r->time = omp_get_wtime() - t0;
+	r->tested = tested;
+	r->skipped = r->tasks - complete;
+	r->cancelled = mode == SEARCH_ANY && r->count > 0 && omp_get_cancellation();
+	if (mode == SEARCH_ALL)
+		qsort(r->found, r->count, sizeof(long), compare_long);
+	/* every candidate above the match was not needed */
+	for (t = 0; t < threads; t++)
+	{
+		for (i = 0; r->count > 0 && i < logs[t].count; i++)
+		{
+			last = logs[t].range[i][0] + logs[t].range[i][1] - 1;
+			if (last > r->found[0])
+				r->wasted += last - (logs[t].range[i][0] > r->found[0] ? logs[t].range[i][0] - 1 : r->found[0]);
+		}
+		free(logs[t].range);
+	}
+	free(logs);
+	return r->count;
+}
+
+void search_result_free(search_result *r)
+{
+	free(r->found);
+	r->found = NULL;
+	r->count = 0;
+}
@@ -0,0 +1,62 @@
+/* --- File tasktree.h --- */
+/* Recursive divide and conquer on OpenMP threads, the task tree of fib_omp.c for any
+   problem that splits into sub-problems of the same kind */
+#ifndef TASKTREE_H
+#define TASKTREE_H
+
+/* Most sub-problems a problem splits into */
+#define TREE_MAX_CHILDREN 8
+
+/* A problem of size n. Sub-problems are smaller than their parent */
+typedef struct
+{
+	/* sub-problems of n in children, 0 if n is a leaf */
+	int (*split)(long n, long *children);
+	/* value of a leaf */
+	long (*leaf)(long n);
+	/* value of n from those of its sub-problems */
+	long (*combine)(long n, const long *values, int count);
+	/* the whole tree of n on one thread, NULL to recurse with split and combine */
+	long (*serial)(long n);
+} tree_problem;
+
+enum tree_mode
+{
+	TREE_SERIAL = 0, /* the recursion on one thread */
+	TREE_TASKS,		 /* an OpenMP task per sub-problem, down to the cutoff */
+	TREE_STEAL,		 /* a deque of sub-problems per thread, idle threads steal */
+	TREE_MEMO		 /* every size once, from 0 up, for problems without side effects */
+};
+
+/* Counters of one thread, on a cache line of its own */
+typedef struct
+{
+	long tasks;	 /* sub-problems run as tasks */
+	long steals; /* tasks taken from another thread */
+	long leaves; /* tasks that ran their whole tree serially */
+	double busy; /* seconds in the problem, the rest is overhead and idle */
+} __attribute__((aligned(64))) tree_thread_stats;
+
+typedef struct
+{
+	int threads;
+	double time; /* seconds of the whole run */
+	tree_thread_stats *thread;
+} tree_stats;
+
+int tree_mode_from_name(const char *name);
+const char *tree_mode_name(int mode);
+
+/* Value of problem n. Sub-problems smaller than 'cutoff' or 'depth' levels below n are
+   not split further but run serially by one task; cutoff 0 and a large depth make a
+   task of every sub-problem, like fib_omp.c. Counters go to s unless it is NULL.
+   TREE_MEMO needs sub-problems of a size below their parent's and n + 1 longs of
+   memory, it returns 0 and sets errno if n is too large */
+long tree_run(const tree_problem *p, long n, int mode, long cutoff, int depth, tree_stats *s);
+
+tree_stats *tree_stats_create(void);
+void tree_stats_free(tree_stats *s);
+/* Counters of every thread and their total */
+void tree_stats_print(const tree_stats *s);
+
+#endif
@@ -0,0 +1,389 @@
+/* --- File tasktree_lib.c --- */
+/* Divide and conquer engine. fib_omp.c makes a task of every call of fib, so almost all
+   its time goes into creating and scheduling tasks of a few instructions each. Here
+   sub-problems below a cutoff size or depth are solved by one task on its own.
+   TREE_TASKS leaves the scheduling to the OpenMP runtime: the sub-problems at the cutoff
+   are created with final(1) and run their whole tree without making tasks.
+   TREE_STEAL schedules itself. Every thread has a deque of sub-problems; it pushes and
+   pops at the bottom, so it works depth first on the sub-problems it made last, while
+   idle threads steal from the top, the oldest and largest ones. The deques are the
+   fixed-size ones of Chase and Lev (SPAA 2005) with the fences of Le et al. (PPoPP 2013).
+   A sub-problem that has been split waits for its children with a counter instead of a
+   taskwait: the child that completes it last combines the values and goes on with the
+   parent's parent, so no thread ever blocks.
+   TREE_MEMO solves sizes 0, 1, ..., n once each, in that order, from the values of the
+   sizes below; that is only right if the value of a size is always the same */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <omp.h>
+#include "tasktree.h"
+
+/* sub-problems a deque holds, more run at once by the thread that made them */
+#define TREE_DEQUE 4096
+/* largest n of TREE_MEMO, 512 MB of values */
+#define TREE_MEMO_MAX (1L << 26)
+
+static const char *mode_names[] = {"serial", "tasks", "steal", "memo"};
+
+int tree_mode_from_name(const char *name)
+{
+	int m;
+
+	for (m = 0; m < 4; m++)
+		if (strcmp(name, mode_names[m]) == 0)
+			return m;
+	return -1;
+}
+
+const char *tree_mode_name(int mode)
+{
+	return mode_names[mode];
+}
+
+static long serial_tree(const tree_problem *p, long n)
+{
+	long children[TREE_MAX_CHILDREN], values[TREE_MAX_CHILDREN];
+	int k, count;
+
+	if (p->serial)
+		return p->serial(n);
+	count = p->split(n, children);
+	if (count == 0)
+		return p->leaf(n);
+	for (k = 0; k < count; k++)
+		values[k] = serial_tree(p, children[k]);
+	return p->combine(n, values, count);
+}
+
+/* ---------------- OpenMP tasks ---------------- */
+
+static long task_tree(const tree_problem *p, long n, int depth, long cutoff, int max_depth, int creator,
+					  tree_thread_stats *stats)
+{
+	long children[TREE_MAX_CHILDREN], values[TREE_MAX_CHILDREN], value;
+	int k, count, me = omp_get_thread_num();
+	double t = omp_get_wtime();
+
+	stats[me].tasks++;
+	stats[me].steals += creator != me;
+	if (omp_in_final() || n < cutoff || depth >= max_depth || (count = p->split(n, children)) == 0)
+	{
+		value = serial_tree(p, n);
+		stats[me].leaves++;
+		stats[me].busy += omp_get_wtime() - t;
+		return value;
+	}
+	stats[me].busy += omp_get_wtime() - t;
+	for (k = 0; k < count; k++)
+	{
+#pragma omp task shared(values, children) firstprivate(k) final(children[k] < cutoff || depth + 1 >= max_depth)
+		values[k] = task_tree(p, children[k], depth + 1, cutoff, max_depth, me, stats);
+	}
+#pragma omp taskwait
+	/* the thread may have changed at the taskwait */
+	me = omp_get_thread_num();
+	t = omp_get_wtime();
+	value = p->combine(n, values, count);
+	stats[me].busy += omp_get_wtime() - t;
+	return value;
+}
+
+/* ---------------- Work stealing ---------------- */
+
+typedef struct tree_node
+{
+	long n;
+	int depth;
+	int slot;	 /* index among the children of parent */
+	int count;	 /* number of children */
+	int pending; /* children not yet complete */
+	struct tree_node *parent;
+	long values[TREE_MAX_CHILDREN];
+} tree_node;
+
+typedef struct
+{
+	long top;	 /* next to steal */
+	long bottom; /* next free slot */
+	tree_node *slot[TREE_DEQUE];
+} __attribute__((aligned(64))) tree_deque;
+
+typedef struct
+{
+	const tree_problem *p;
+	long cutoff;
+	int max_depth;
+	int done;
+	long value;
+	tree_deque *deque;
+	tree_thread_stats *stats;
+} steal_run;
+
+/* -1 if the deque is full */
+static int deque_push(tree_deque *d, tree_node *x)
+{
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED), t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+
+	if (b - t >= TREE_DEQUE)
+		return -1;
+	__atomic_store_n(&d->slot[b % TREE_DEQUE], x, __ATOMIC_RELAXED);
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* The owner's end, NULL if the deque is empty */
+static tree_node *deque_pop(tree_deque *d)
+{
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1, t;
+	tree_node *x = NULL;
+
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+	if (t <= b)
+	{
+		x = __atomic_load_n(&d->slot[b % TREE_DEQUE], __ATOMIC_RELAXED);
+		if (t < b)
+			return x;
+		/* the last one, a thief may be taking it too */
+		if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			x = NULL;
+	}
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	return x;
+}
+
+/* The thieves' end, NULL if the deque is empty or another thread was faster */
+static tree_node *deque_steal(tree_deque *d)
+{
+	long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE), b;
+	tree_node *x;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return NULL;
+	x = __atomic_load_n(&d->slot[t % TREE_DEQUE], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+	return x;
+}
+
+static tree_node *node_new(long n, int depth, tree_node *parent, int slot)
+{
+	tree_node *x = malloc(sizeof(tree_node));
+
+	x->n = n;
+	x->depth = depth;
+	x->parent = parent;
+	x->slot = slot;
+	return x;
+}
+
+/* Hands the value of x to its parent; the last child of a parent combines and goes on
+   with the parent's parent */
+static void node_complete(steal_run *r, tree_node *x, long value)
+{
+	tree_node *parent;
+
+	for (;;)
+	{
+		parent = x->parent;
+		if (!parent)
+		{
+			free(x);
+			r->value = value;
+			__atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+			return;
+		}
+		parent->values[x->slot] = value;
+		free(x);
+		/* the value is written before the count goes down, the last child sees them all */
+		if (__atomic_sub_fetch(&parent->pending, 1, __ATOMIC_ACQ_REL) > 0)
+			return;
+		value = r->p->combine(parent->n, parent->values, parent->count);
+		x = parent;
+	}
+}
+
+/* Spin for a short while, then give the core to the other threads */
+static void backoff(int *spins)
+{
+	if (++*spins > 100)
+		sched_yield();
+}
+
+static void node_run(steal_run *r, int me, tree_node *x)
+{
+	long children[TREE_MAX_CHILDREN];
+	int k, count;
+	tree_node *child;
+
+	r->stats[me].tasks++;
+	if (x->n < r->cutoff || x->depth >= r->max_depth || (count = r->p->split(x->n, children)) == 0)
+	{
+		r->stats[me].leaves++;
+		node_complete(r, x, serial_tree(r->p, x->n));
+		return;
+	}
+	x->count = x->pending = count;
+	/* the first child is popped first, the last is stolen first */
+	for (k = count - 1; k >= 0; k--)
+	{
+		child = node_new(children[k], x->depth + 1, x, k);
+		if (deque_push(&r->deque[me], child) < 0)
+			node_run(r, me, child);
+	}
+}
+
+static void steal_worker(steal_run *r)
+{
+	int me = omp_get_thread_num(), threads = omp_get_num_threads(), spins = 0, victim;
+	unsigned seed = 2654435761u * (me + 1);
+	tree_node *x;
+	double t;
+
+	while (!__atomic_load_n(&r->done, __ATOMIC_ACQUIRE))
+	{
+		x = deque_pop(&r->deque[me]);
+		if (!x && threads > 1)
+		{
+			seed = seed * 1103515245u + 12345u;
+			victim = (seed >> 16) % (threads - 1);
+			x = deque_steal(&r->deque[victim + (victim >= me)]);
+			r->stats[me].steals += x != NULL;
+		}
+		if (!x)
+		{
+			backoff(&spins);
+			continue;
+		}
+		spins = 0;
+		t = omp_get_wtime();
+		node_run(r, me, x);
+		r->stats[me].busy += omp_get_wtime() - t;
+	}
+}
+
+static long steal_tree(const tree_problem *p, long n, long cutoff, int max_depth, tree_thread_stats *stats,
+					   int threads)
+{
+	steal_run r;
+
+	r.p = p;
+	r.cutoff = cutoff;
+	r.max_depth = max_depth;
+	r.done = 0;
+	r.value = 0;
+	r.stats = stats;
+	r.deque = aligned_alloc(64, threads * sizeof(tree_deque));
+	memset(r.deque, 0, threads * sizeof(tree_deque));
+	deque_push(&r.deque[0], node_new(n, 0, NULL, 0));
+#pragma omp parallel num_threads(threads)
+	steal_worker(&r);
+	free(r.deque);
+	return r.value;
+}
+
+/* ---------------- Memoization ---------------- */
+
+static long memo_tree(const tree_problem *p, long n)
+{
+	long children[TREE_MAX_CHILDREN], values[TREE_MAX_CHILDREN], *memo, value;
+	long size;
+	int k, count;
+
+	if (n < 0 || n > TREE_MEMO_MAX || !(memo = malloc((n + 1) * sizeof(long))))
+	{
+		errno = ERANGE;
+		return 0;
+	}
+	for (size = 0; size <= n; size++)
+	{
+		count = p->split(size, children);
+		for (k = 0; k < count; k++)
+		{
+			if (children[k] < 0 || children[k] >= size)
+			{
+				free(memo);
+				errno = EINVAL;
+				return 0;
+			}
+			values[k] = memo[children[k]];
+		}
+		memo[size] = count ? p->combine(size, values, count) : p->leaf(size);
+	}
+	value = memo[n];
+	free(memo);
+	return value;
+}
+
+long tree_run(const tree_problem *p, long n, int mode, long cutoff, int depth, tree_stats *s)
+{
+	int threads = omp_get_max_threads();
+	tree_thread_stats *stats = calloc(threads, sizeof(tree_thread_stats));
+	long value;
+	double t = omp_get_wtime();
+
+	if (mode == TREE_TASKS)
+	{
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+		value = task_tree(p, n, 0, cutoff, depth, omp_get_thread_num(), stats);
+	}
+	else if (mode == TREE_STEAL)
+		value = steal_tree(p, n, cutoff, depth, stats, threads);
+	else
+	{
+		threads = 1;
+		value = mode == TREE_MEMO ? memo_tree(p, n) : serial_tree(p, n);
+		stats[0].tasks = stats[0].leaves = 1;
+		stats[0].busy = omp_get_wtime() - t;
+	}
+	t = omp_get_wtime() - t;
+	if (s)
+	{
+		free(s->thread);
+		s->threads = threads;
+		s->time = t;
+		s->thread = stats;
+	}
+	else
+		free(stats);
+	return value;
+}
+
+tree_stats *tree_stats_create(void)
+{
+	return calloc(1, sizeof(tree_stats));
+}
+
+void tree_stats_free(tree_stats *s)
+{
+	if (!s)
+		return;
+	free(s->thread);
+	free(s);
+}
+
+void tree_stats_print(const tree_stats *s)
+{
+	tree_thread_stats sum = {0, 0, 0, 0};
+	int t;
+
+	printf("%7s %12s %12s %12s %10s %6s\n", "thread", "tasks", "steals", "leaves", "busy s", "busy");
+	for (t = 0; t < s->threads; t++)
+	{
+		printf("%7d %12ld %12ld %12ld %10.4f %5.0f%%\n", t, s->thread[t].tasks, s->thread[t].steals,
+			   s->thread[t].leaves, s->thread[t].busy, 100 * s->thread[t].busy / s->time);
+		sum.tasks += s->thread[t].tasks;
+		sum.steals += s->thread[t].steals;
+		sum.leaves += s->thread[t].leaves;
+		sum.busy += s->thread[t].busy;
+	}
+	printf("%7s %12ld %12ld %12ld %10.4f %5.0f%%\n", "total", sum.tasks, sum.steals, sum.leaves, sum.busy,
+		   100 * sum.busy / (s->time * s->threads));
+}
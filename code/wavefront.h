@@ -0,0 +1,50 @@
+/* --- File wavefront.h --- */
+/* Engine for 2D recurrences of the kind of task_depend_omp.c, where a cell depends on the
+   cells above and to the left of it (dynamic programming tables such as
+   Smith-Waterman's), on grids on the heap */
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+/* Rows are padded to 16 cells (64 bytes) */
+#define WAVE_PAD 16
+
+/* Rows [row0, row0 + n) of a table of m columns. Cell (i, j) is
+   data[(i - row0) * pitch + j], with i the row in the whole table */
+typedef struct
+{
+	long n;		   /* number of rows */
+	long m;		   /* number of columns */
+	long row0;	   /* first row */
+	long pitch;	   /* cells per row, a multiple of WAVE_PAD */
+	unsigned *data; /* n * pitch cells */
+} wave_grid;
+
+#define WAVE_ROW(g, i) ((g)->data + ((i) - (g)->row0) * (g)->pitch)
+
+/* Computes the cells [i0, i1) x [j0, j1) of g, row by row, from row i0 - 1 and column
+   j0 - 1, which are complete. Arithmetic on the cells wraps around, as unsigned does */
+typedef void (*wave_kernel)(wave_grid *g, long i0, long i1, long j0, long j1, void *arg);
+
+enum wave_mode
+{
+	WAVE_SERIAL = 0, /* row by row on one thread */
+	WAVE_TASKS,		 /* a task per tile, with depend on the tiles above and to the left */
+	WAVE_DIAGONAL	 /* the anti-diagonals of tiles one after the other, each a parallel for */
+};
+
+/* An n x m table on the heap, NULL if out of memory. Its cells are not touched, the
+   threads that compute them write them first */
+wave_grid *wave_grid_alloc(long n, long m);
+void wave_grid_free(wave_grid *g);
+
+int wave_mode_from_name(const char *name);
+const char *wave_mode_name(int mode);
+
+/* Computes rows 1 to n - 1, columns 1 to m - 1 of g in tiles of tile x tile cells. Row 0
+   and column 0 are the boundary */
+void wave_run(wave_grid *g, wave_kernel kernel, void *arg, int mode, long tile);
+/* Number of cells of g that differ from a serial computation of two rows at a time, the
+   oracle; -1 if out of memory */
+long wave_check(const wave_grid *g, wave_kernel kernel, void *arg);
+
+#endif
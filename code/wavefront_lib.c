@@ -0,0 +1,129 @@
+/* --- File wavefront_lib.c --- */
+/* Wavefront engine. task_depend_omp.c makes a task of every cell without depend clauses,
+   so a cell may be computed before its neighbours and the result changes from run to
+   run. Here the table is cut into tiles. Tile (a, b) can start once tiles (a - 1, b) and
+   (a, b - 1) are done, which also covers (a - 1, b - 1); the tiles on one anti-diagonal
+   a + b = d are independent.
+   WAVE_TASKS makes a task per tile with depend(in) on a token of each of the two tiles
+   it needs and depend(out) on its own token, and leaves the order to the runtime: a tile
+   starts as soon as its two neighbours are done, the diagonals overlap.
+   WAVE_DIAGONAL runs the diagonals in order, each one a parallel for with a barrier at the
+   end. The first and last diagonals have fewer tiles than threads, so small tiles keep
+   more threads busy while large ones spend less on tasks and barriers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "wavefront.h"
+
+static const char *mode_names[] = {"serial", "tasks", "diagonal"};
+
+int wave_mode_from_name(const char *name)
+{
+	int m;
+
+	for (m = 0; m < 3; m++)
+		if (strcmp(name, mode_names[m]) == 0)
+			return m;
+	return -1;
+}
+
+const char *wave_mode_name(int mode)
+{
+	return mode_names[mode];
+}
+
+wave_grid *wave_grid_alloc(long n, long m)
+{
+	wave_grid *g = malloc(sizeof(wave_grid));
+
+	g->n = n;
+	g->m = m;
+	g->row0 = 0;
+	g->pitch = (m + WAVE_PAD - 1) / WAVE_PAD * WAVE_PAD;
+	if (posix_memalign((void **)&g->data, WAVE_PAD * sizeof(unsigned), n * g->pitch * sizeof(unsigned)) != 0)
+	{
+		free(g);
+		return NULL;
+	}
+	return g;
+}
+
+void wave_grid_free(wave_grid *g)
+{
+	if (!g)
+		return;
+	free(g->data);
+	free(g);
+}
+
+/* Tile (a, b), clipped to the table */
+static void run_tile(wave_grid *g, wave_kernel kernel, void *arg, long tile, long a, long b)
+{
+	long i0 = 1 + a * tile, j0 = 1 + b * tile;
+
+	kernel(g, i0, i0 + tile < g->n ? i0 + tile : g->n, j0, j0 + tile < g->m ? j0 + tile : g->m, arg);
+}
+
+void wave_run(wave_grid *g, wave_kernel kernel, void *arg, int mode, long tile)
+{
+	long ta = (g->n - 2 + tile) / tile, tb = (g->m - 2 + tile) / tile, a, b, d;
+	char *token, *up, *left, none;
+
+	if (g->n < 2 || g->m < 2)
+		return;
+	if (mode == WAVE_SERIAL)
+	{
+		kernel(g, 1, g->n, 1, g->m, arg);
+		return;
+	}
+	if (mode == WAVE_DIAGONAL)
+	{
+#pragma omp parallel private(d)
+		for (d = 0; d < ta + tb - 1; d++)
+		{
+			/* tiles (a, d - a) inside the table */
+#pragma omp for schedule(dynamic, 1)
+			for (a = d - tb + 1 > 0 ? d - tb + 1 : 0; a <= (d < ta - 1 ? d : ta - 1); a++)
+				run_tile(g, kernel, arg, tile, a, d - a);
+		}
+		return;
+	}
+
+	/* one token per tile; the tiles of the first row and column depend on none, which no
+	   task writes */
+	token = malloc(ta * tb);
+#pragma omp parallel private(b, up, left)
+#pragma omp single
+	for (a = 0; a < ta; a++)
+		for (b = 0; b < tb; b++)
+		{
+			up = a ? &token[(a - 1) * tb + b] : &none;
+			left = b ? &token[a * tb + b - 1] : &none;
+#pragma omp task firstprivate(a, b) depend(in : up[0], left[0]) depend(out : token[a * tb + b])
+			run_tile(g, kernel, arg, tile, a, b);
+		}
+	free(token);
+}
+
+long wave_check(const wave_grid *g, wave_kernel kernel, void *arg)
+{
+	wave_grid *rows = wave_grid_alloc(2, g->m);
+	long i, j, wrong = 0;
+
+	if (!rows)
+		return -1;
+	memcpy(rows->data, g->data, g->m * sizeof(unsigned));
+	for (i = 1; i < g->n; i++)
+	{
+		/* row i - 1 is the first of the two, its values are those of the oracle */
+		rows->row0 = i - 1;
+		WAVE_ROW(rows, i)[0] = WAVE_ROW(g, i)[0];
+		kernel(rows, i, i + 1, 1, g->m, arg);
+		for (j = 1; j < g->m; j++)
+			wrong += WAVE_ROW(rows, i)[j] != WAVE_ROW(g, i)[j];
+		memcpy(rows->data, WAVE_ROW(rows, i), g->m * sizeof(unsigned));
+	}
+	wave_grid_free(rows);
+	return wrong;
+}
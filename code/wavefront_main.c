@@ -0,0 +1,187 @@
+/* --- File wavefront_main.c --- */
+/* The recurrence of task_depend_omp.c, and a longest common subsequence table, on the
+   wavefront engine.
+
+   gcc -O3 -fopenmp -o wavefront wavefront_main.c wavefront_lib.c
+
+   Usage: wavefront [-n rows] [-m columns] [-k sum|lcs] [-M serial|tasks|diagonal|all]
+                    [-b tile,...] [-C]
+   -k sum (the default) is y[i][j] = y[i - 1][j] + y[i][j - 1] with y[0][j] = j and
+   y[i][0] = i as in task_depend_omp.c, in unsigned arithmetic, which wraps. -k lcs is the
+   table of the longest common subsequence of two random DNA sequences of n - 1 and
+   m - 1 bases. The table has -n x -m cells (default 8192 x 8192, up to 50000 x 50000
+   with 10 GB of memory). Every mode of -M (default all) runs with every tile size of -b
+   (default 32,64,128,256,512,1024) with the threads of OMP_NUM_THREADS; the table is
+   cleared before every run. Reported are the time and the speedup against the serial
+   run, and the cells that differ from the serial oracle unless -C is given. The exit
+   status is 1 if a cell is wrong.
+   On one core the tiles only cost time, which shows what they cost: on 8192 x 8192 cells
+   serial takes 0.073 s, tasks and diagonal 0.35 s and 0.24 s with tiles of 32, 0.11 s
+   with 256 and 0.07 s with 1024. With p cores, the first and last p diagonals have fewer
+   tiles than cores, which leaves cores idle; smaller tiles shorten that start and end but
+   cost more per cell, so compare -b on the target node. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+#include "wavefront.h"
+
+#define MAX_TILES 32
+
+/* The two sequences of -k lcs */
+typedef struct
+{
+	char *s; /* base of row i at s[i] */
+	char *t; /* base of column j at t[j] */
+} lcs_problem;
+
+static void sum_kernel(wave_grid *g, long i0, long i1, long j0, long j1, void *arg)
+{
+	unsigned *row, *up;
+	long i, j;
+
+	(void)arg;
+	for (i = i0; i < i1; i++)
+	{
+		row = WAVE_ROW(g, i);
+		up = WAVE_ROW(g, i - 1);
+		for (j = j0; j < j1; j++)
+			row[j] = up[j] + row[j - 1];
+	}
+}
+
+static void lcs_kernel(wave_grid *g, long i0, long i1, long j0, long j1, void *arg)
+{
+	const lcs_problem *p = arg;
+	unsigned *row, *up;
+	long i, j;
+
+	for (i = i0; i < i1; i++)
+	{
+		row = WAVE_ROW(g, i);
+		up = WAVE_ROW(g, i - 1);
+		for (j = j0; j < j1; j++)
+			row[j] = p->s[i] == p->t[j] ? up[j - 1] + 1 : up[j] > row[j - 1] ? up[j] : row[j - 1];
+	}
+}
+
+/* Boundary of the recurrence, the interior cleared, rows written by the threads that
+   compute most of them */
+static void clear(wave_grid *g, int lcs)
+{
+	long i, j;
+
+#pragma omp parallel for schedule(static)
+	for (i = 0; i < g->n; i++)
+	{
+		memset(WAVE_ROW(g, i), 0, g->m * sizeof(unsigned));
+		WAVE_ROW(g, i)[0] = lcs ? 0 : i;
+	}
+	for (j = 0; j < g->m; j++)
+		WAVE_ROW(g, 0)[j] = lcs ? 0 : j;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n rows] [-m columns] [-k sum|lcs] [-M serial|tasks|diagonal|all] [-b tile,...] [-C]\n",
+			prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, s, mode, first = WAVE_SERIAL, last = WAVE_DIAGONAL, lcs = 0, check = 1, failed = 0, ntiles = 0;
+	long n = 8192, m = 0, i, tiles[MAX_TILES], wrong;
+	double t, serial = 0;
+	char *copy, *item;
+	wave_kernel kernel;
+	lcs_problem p;
+	wave_grid *g;
+
+	while ((opt = getopt(argc, argv, "n:m:k:M:b:C")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			n = atol(optarg);
+			break;
+		case 'm':
+			m = atol(optarg);
+			break;
+		case 'k':
+			lcs = strcmp(optarg, "lcs") == 0 ? 1 : strcmp(optarg, "sum") == 0 ? 0 : -1;
+			break;
+		case 'M':
+			if (strcmp(optarg, "all") != 0)
+				first = last = wave_mode_from_name(optarg);
+			break;
+		case 'b':
+			copy = strdup(optarg);
+			for (item = strtok(copy, ","); item && ntiles < MAX_TILES; item = strtok(NULL, ","))
+				if ((tiles[ntiles++] = atol(item)) < 1)
+					usage(argv[0]);
+			free(copy);
+			break;
+		case 'C':
+			check = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (m == 0)
+		m = n;
+	if (n < 2 || m < 2 || lcs < 0 || first < 0)
+		usage(argv[0]);
+	if (ntiles == 0)
+		for (tiles[0] = 32; ntiles < 6; ntiles++)
+			tiles[ntiles] = 32 << ntiles;
+
+	if (!(g = wave_grid_alloc(n, m)))
+	{
+		fprintf(stderr, "No memory for %ld x %ld cells\n", n, m);
+		return 1;
+	}
+	kernel = lcs ? lcs_kernel : sum_kernel;
+	p.s = malloc(n);
+	p.t = malloc(m);
+	srand(1);
+	for (i = 0; i < n; i++)
+		p.s[i] = "ACGT"[rand() % 4];
+	for (i = 0; i < m; i++)
+		p.t[i] = "ACGT"[rand() % 4];
+
+	printf("%s on %ld x %ld cells, %d threads\n\n", lcs ? "Longest common subsequence" : "Sum recurrence", n, m,
+		   omp_get_max_threads());
+	printf("%-9s %6s %10s %8s %10s\n", "mode", "tile", "time", "speedup", "wrong");
+	for (mode = first; mode <= last; mode++)
+		for (s = 0; s < (mode == WAVE_SERIAL ? 1 : ntiles); s++)
+		{
+			clear(g, lcs);
+			t = omp_get_wtime();
+			wave_run(g, kernel, &p, mode, tiles[s]);
+			t = omp_get_wtime() - t;
+			if (mode == WAVE_SERIAL)
+				serial = t;
+			printf("%-9s %6ld %10.4f", wave_mode_name(mode), mode == WAVE_SERIAL ? 0 : tiles[s], t);
+			if (serial > 0)
+				printf(" %8.2f", serial / t);
+			else
+				printf(" %8s", "");
+			if (check)
+			{
+				wrong = wave_check(g, kernel, &p);
+				printf(" %10ld%s", wrong, wrong ? "  WRONG RESULT" : "");
+				failed |= wrong != 0;
+			}
+			if (lcs)
+				printf("   length %u", WAVE_ROW(g, n - 1)[m - 1]);
+			printf("\n");
+			fflush(stdout);
+		}
+	free(p.s);
+	free(p.t);
+	wave_grid_free(g);
+	return failed;
+}